@@ -0,0 +1,95 @@
+#include "async_writer.h"
+
+#include <algorithm>
+
+namespace prnet {
+
+AsyncWriter::AsyncWriter(uint32_t n_threads, size_t _max_pending)
+    : max_pending(std::max(size_t(1), _max_pending)) {
+  if (n_threads > 0) {
+    pool.reset(new ThreadPool(n_threads));
+  }
+}
+
+AsyncWriter::~AsyncWriter() { wait(); }
+
+void AsyncWriter::acquire_slot() {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (n_pending >= max_pending) {
+    n_stalls++;
+    cond.wait(lock, [this]() { return n_pending < max_pending; });
+  }
+  n_pending++;
+}
+
+void AsyncWriter::finish(bool ok) {
+  // Notify while locked, so `wait` does not return(and the writer is not
+  // destroyed) before this function leaves.
+  std::lock_guard<std::mutex> lock(mutex);
+  n_pending--;
+  failed |= !ok;
+  cond.notify_all();
+}
+
+void AsyncWriter::submit(std::function<bool()> task) {
+  if (!pool) {
+    const bool ok = task();
+    std::lock_guard<std::mutex> lock(mutex);
+    failed |= !ok;
+    return;
+  }
+
+  acquire_slot();
+  pool->enqueue([this, task]() { finish(task()); });
+}
+
+void AsyncWriter::submit_ordered(std::function<bool()> task) {
+  if (!pool) {
+    submit(std::move(task));
+    return;
+  }
+
+  acquire_slot();
+  bool start = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ordered_tasks.push_back(std::move(task));
+    start = !ordered_running;
+    ordered_running = true;
+  }
+  if (start) {
+    pool->enqueue([this]() { run_ordered(); });
+  }
+}
+
+void AsyncWriter::run_ordered() {
+  // Runs ordered tasks one by one until the queue becomes empty.
+  for (;;) {
+    std::function<bool()> task;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (ordered_tasks.empty()) {
+        ordered_running = false;
+        return;
+      }
+      task = std::move(ordered_tasks.front());
+      ordered_tasks.pop_front();
+    }
+    finish(task());
+  }
+}
+
+bool AsyncWriter::wait() {
+  std::unique_lock<std::mutex> lock(mutex);
+  cond.wait(lock, [this]() { return n_pending == 0; });
+  const bool ok = !failed;
+  failed = false;
+  return ok;
+}
+
+size_t AsyncWriter::num_stalls() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return n_stalls;
+}
+
+} // namespace prnet
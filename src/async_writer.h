@@ -0,0 +1,67 @@
+#ifndef PRNET_INFER_ASYNC_WRITER_H_
+#define PRNET_INFER_ASYNC_WRITER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "thread_pool.h"
+
+namespace prnet {
+
+///
+/// Runs output tasks(encoding and writing files) on a small I/O thread pool,
+/// so that inference does not wait for the disk.
+///
+/// At most `max_pending` tasks are queued or running. `submit` blocks while the
+/// queue is full(backpressure), which also bounds the memory held by tasks.
+/// Tasks return false on failure, and failures are reported by `wait`.
+///
+/// With 0 threads, tasks run synchronously in `submit`.
+///
+class AsyncWriter {
+public:
+  explicit AsyncWriter(uint32_t n_threads = 2, size_t max_pending = 16);
+  ~AsyncWriter();
+
+  AsyncWriter(const AsyncWriter &) = delete;
+  AsyncWriter &operator=(const AsyncWriter &) = delete;
+
+  // Queues `task`. Tasks may run in any order and concurrently.
+  void submit(std::function<bool()> task);
+
+  // Queues `task` which runs after all tasks previously queued with
+  // `submit_ordered`(e.g. appending frames to one file).
+  void submit_ordered(std::function<bool()> task);
+
+  // Waits for all tasks. Returns false if any task failed since the last
+  // call.
+  bool wait();
+
+  // # of `submit` calls blocked by the full queue.
+  size_t num_stalls() const;
+
+private:
+  void acquire_slot();
+  void finish(bool ok);
+  void run_ordered();
+
+  mutable std::mutex mutex;
+  std::condition_variable cond;
+  size_t max_pending;
+  size_t n_pending = 0;
+  size_t n_stalls = 0;
+  bool failed = false;
+
+  std::deque<std::function<bool()>> ordered_tasks;
+  bool ordered_running = false;
+
+  // Declared last so workers are joined before other members are destroyed.
+  std::unique_ptr<ThreadPool> pool;
+};
+
+} // namespace prnet
+
+#endif // PRNET_INFER_ASYNC_WRITER_H_
@@ -0,0 +1,171 @@
+#include "batch_scheduler.h"
+
+#include <algorithm>
+#include <iomanip>
+
+namespace prnet {
+
+BatchScheduler::BatchScheduler(TensorflowPredictor *_predictor,
+                               const BatchSchedulerOptions &_options)
+    : predictor(_predictor), options(_options) {
+  options.max_batch_size = std::max(size_t(1), options.max_batch_size);
+  options.max_wait_ms = std::max(0.0, options.max_wait_ms);
+  stats.batch_size_histogram.assign(options.max_batch_size + 1, 0);
+  stats.queue_depth_histogram.assign(2 * options.max_batch_size + 1, 0);
+  dispatcher = std::thread([this]() { dispatch_loop(); });
+}
+
+BatchScheduler::~BatchScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quit = true;
+  }
+  request_cond.notify_all();
+  dispatcher.join();
+}
+
+bool BatchScheduler::predict(const float *crops, size_t n,
+                             std::vector<Image<float>> *outputs) {
+  outputs->clear();
+  if (n == 0) {
+    return true;
+  }
+
+  Request request;
+  request.crops = crops;
+  request.n = n;
+  request.outputs = outputs;
+  request.submit_time = std::chrono::steady_clock::now();
+
+  std::unique_lock<std::mutex> lock(mutex);
+  if (quit) {
+    return false;
+  }
+  stats.num_requests++;
+  stats.queue_depth_histogram[std::min(
+      n_queued_faces, stats.queue_depth_histogram.size() - 1)]++;
+  queue.push_back(&request);
+  n_queued_faces += n;
+  request_cond.notify_one();
+
+  done_cond.wait(lock, [&request]() { return request.done; });
+  return request.ok;
+}
+
+void BatchScheduler::dispatch_loop() {
+  const auto max_wait = std::chrono::duration_cast<
+      std::chrono::steady_clock::duration>(
+      std::chrono::duration<double, std::milli>(options.max_wait_ms));
+
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;) {
+    request_cond.wait(lock, [this]() { return quit || !queue.empty(); });
+    if (queue.empty()) {
+      return;  // quit
+    }
+
+    // Wait for more faces until the batch is full or the deadline of the
+    // oldest request.
+    const auto deadline = queue.front()->submit_time + max_wait;
+    request_cond.wait_until(lock, deadline, [this]() {
+      return quit || (n_queued_faces >= options.max_batch_size);
+    });
+
+    // Take requests in FIFO order. The first one is always taken, even if it
+    // is larger than the max batch size.
+    std::vector<Request *> batch;
+    size_t n = 0;
+    const auto now = std::chrono::steady_clock::now();
+    while (!queue.empty() &&
+           (batch.empty() ||
+            (n + queue.front()->n <= options.max_batch_size))) {
+      Request *request = queue.front();
+      queue.pop_front();
+      batch.push_back(request);
+      n += request->n;
+
+      const double wait_ms =
+          std::chrono::duration<double, std::milli>(now - request->submit_time)
+              .count();
+      stats.total_wait_ms += wait_ms;
+      stats.max_wait_ms = std::max(stats.max_wait_ms, wait_ms);
+    }
+    n_queued_faces -= n;
+    stats.num_batches++;
+    stats.batch_size_histogram[std::min(
+        n, stats.batch_size_histogram.size() - 1)]++;
+
+    lock.unlock();
+    const bool ok = run_batch(batch);
+    lock.lock();
+
+    for (Request *request : batch) {
+      request->ok = ok;
+      request->done = true;
+    }
+    done_cond.notify_all();
+  }
+}
+
+bool BatchScheduler::run_batch(const std::vector<Request *> &batch) {
+  const size_t crop_floats = options.width * options.height * options.channels;
+
+  size_t n = 0;
+  for (const Request *request : batch) {
+    n += request->n;
+  }
+
+  predictor->allocate_input(n, options.width, options.height,
+                            options.channels);
+  size_t slot = 0;
+  for (const Request *request : batch) {
+    for (size_t i = 0; i < request->n; i++) {
+      const float *crop = request->crops + i * crop_floats;
+      std::copy(crop, crop + crop_floats, predictor->input_data(slot++));
+    }
+  }
+
+  std::vector<Image<float>> outputs;
+  if (!predictor->run(outputs) || (outputs.size() != n)) {
+    return false;
+  }
+
+  slot = 0;
+  for (Request *request : batch) {
+    request->outputs->resize(request->n);
+    for (size_t i = 0; i < request->n; i++) {
+      (*request->outputs)[i] = std::move(outputs[slot++]);
+    }
+  }
+  return true;
+}
+
+BatchSchedulerStats BatchScheduler::get_stats() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
+
+void BatchScheduler::print_stats(std::ostream &os) const {
+  const BatchSchedulerStats s = get_stats();
+  os << "Batching : " << s.num_requests << " requests in " << s.num_batches
+     << " batches, wait(avg/max) = " << std::fixed << std::setprecision(2)
+     << ((s.num_requests > 0) ? s.total_wait_ms / double(s.num_requests)
+                              : 0.0)
+     << " / " << s.max_wait_ms << " [ms]" << std::defaultfloat << std::endl;
+
+  auto PrintHistogram = [&os](const char *name,
+                              const std::vector<size_t> &histogram) {
+    os << "  " << name << " :";
+    for (size_t i = 0; i < histogram.size(); i++) {
+      if (histogram[i] > 0) {
+        os << " " << i << ((i + 1 == histogram.size()) ? "+" : "") << ":"
+           << histogram[i];
+      }
+    }
+    os << std::endl;
+  };
+  PrintHistogram("batch size ", s.batch_size_histogram);
+  PrintHistogram("queue depth", s.queue_depth_histogram);
+}
+
+} // namespace prnet
@@ -0,0 +1,91 @@
+#ifndef PRNET_INFER_BATCH_SCHEDULER_H_
+#define PRNET_INFER_BATCH_SCHEDULER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "image.h"
+#include "tf_predictor.h"
+
+namespace prnet {
+
+struct BatchSchedulerOptions {
+  size_t max_batch_size = 8;  // # of faces
+  double max_wait_ms = 5.0;   // Max time the oldest request waits for a batch.
+  size_t width = 256;         // Resolution of the input crops.
+  size_t height = 256;
+  size_t channels = 3;
+};
+
+struct BatchSchedulerStats {
+  // [i] = # of batches with i faces. The last bin also counts larger batches
+  // (a request larger than `max_batch_size` is run alone).
+  std::vector<size_t> batch_size_histogram;
+  // [i] = # of requests which found i faces waiting in the queue. The last
+  // bin also counts deeper queues.
+  std::vector<size_t> queue_depth_histogram;
+  size_t num_requests = 0;
+  size_t num_batches = 0;
+  double total_wait_ms = 0.0;  // from submission to dispatch
+  double max_wait_ms = 0.0;
+};
+
+///
+/// Dynamic batching in front of the predictor.
+///
+/// Faces from concurrent requests are accumulated into a batch, which is
+/// dispatched when it reaches `max_batch_size` faces or when the oldest
+/// request has waited `max_wait_ms`. Results are returned to each request.
+///
+class BatchScheduler {
+public:
+  BatchScheduler(TensorflowPredictor *predictor,
+                 const BatchSchedulerOptions &options);
+  ~BatchScheduler();
+
+  BatchScheduler(const BatchScheduler &) = delete;
+  BatchScheduler &operator=(const BatchScheduler &) = delete;
+
+  // Runs the network for `n` crops(`width` x `height` x `channels` floats
+  // each, contiguous) and blocks until their results are ready. Thread safe.
+  bool predict(const float *crops, size_t n,
+               std::vector<Image<float>> *outputs);
+
+  BatchSchedulerStats get_stats() const;
+  void print_stats(std::ostream &os) const;
+
+private:
+  struct Request {
+    const float *crops;
+    size_t n;
+    std::vector<Image<float>> *outputs;
+    std::chrono::steady_clock::time_point submit_time;
+    bool done = false;
+    bool ok = false;
+  };
+
+  void dispatch_loop();
+  bool run_batch(const std::vector<Request *> &batch);
+
+  TensorflowPredictor *predictor;
+  BatchSchedulerOptions options;
+
+  mutable std::mutex mutex;
+  std::condition_variable request_cond;  // wakes the dispatcher
+  std::condition_variable done_cond;     // wakes requests
+  std::deque<Request *> queue;
+  size_t n_queued_faces = 0;
+  bool quit = false;
+  BatchSchedulerStats stats;
+
+  std::thread dispatcher;
+};
+
+} // namespace prnet
+
+#endif // PRNET_INFER_BATCH_SCHEDULER_H_
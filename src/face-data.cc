@@ -1,9 +1,27 @@
 #include "face-data.h"
 
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 
+#include <sys/stat.h>
+
+#ifdef USE_EMBEDDED_FACE_DATA
+#include "face_data_embedded.h"  // generated
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#include <process.h>  // _getpid
+#endif
+
 namespace prnet {
 
 namespace {
@@ -22,12 +40,24 @@ std::string JoinPath(const std::string &dir, const std::string &filename) {
   }
 }
 
-} // namespace 
+const char *kTextFilenames[] = {"uv_kpt_ind.txt", "face_ind.txt",
+                                "triangles.txt", "canonical_vertices.txt"};
 
-bool LoadFaceData(const std::string &datapath, FaceData *face_data)
+// Face data parsed from text files.
+struct TextFaceData {
+  std::vector<uint32_t> uv_kpt_indices;
+  std::vector<uint32_t> face_indices;
+  std::vector<uint32_t> triangles;
+  std::vector<std::array<float, 3>> canonical_vertices;
+};
+
+// Parses text files of face data.
+bool LoadTextFaceData(const std::string &datapath, TextFaceData *face_data)
 {
+  face_data->uv_kpt_indices.clear();
   face_data->face_indices.clear();
   face_data->triangles.clear();
+  face_data->canonical_vertices.clear();
 
   // Load face index data.
   {
@@ -131,4 +161,352 @@ bool LoadFaceData(const std::string &datapath, FaceData *face_data)
   return true;
 }
 
+//
+// Binary cache. All values are stored in the native byte order, and each
+// array starts at 16 byte aligned offset from the beginning of the file.
+//
+const char kCacheMagic[8] = {'P', 'R', 'N', 'E', 'T', 'F', 'D', '\0'};
+const uint32_t kCacheVersion = 1;
+const uint32_t kCacheByteOrder = 0x01020304;
+const size_t kCacheAlignment = 16;
+
+// Arrays in the cache.
+enum {
+  kUVKptIndices = 0,
+  kFaceIndices,
+  kTriangles,
+  kCanonicalVertices,
+  kNumCacheArrays
+};
+
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t source_signature;  // of the text files
+  uint64_t counts[kNumCacheArrays];   // # of elements
+  uint64_t offsets[kNumCacheArrays];  // in bytes
+  uint64_t file_size;
+  uint64_t checksum;  // of the bytes after the header
+};
+
+inline uint64_t HashCombine(uint64_t h, uint64_t v) {
+  // FNV-1a like mixing of 64bit words.
+  h ^= v;
+  h *= 0x100000001b3ULL;
+  return h ^ (h >> 29);
+}
+
+uint64_t Checksum(const unsigned char *data, size_t size) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t w;
+    memcpy(&w, data + i, 8);
+    h = HashCombine(h, w);
+  }
+  for (; i < size; i++) {
+    h = HashCombine(h, data[i]);
+  }
+  return HashCombine(h, size);
+}
+
+// Signature of the text files(size and modification time) to detect a stale
+// cache.
+bool SourceSignature(const std::string &datapath, uint64_t *signature) {
+  uint64_t h = HashCombine(0xcbf29ce484222325ULL, kCacheVersion);
+  for (const char *filename : kTextFilenames) {
+    struct stat st;
+    if (stat(JoinPath(datapath, filename).c_str(), &st) != 0) {
+      return false;
+    }
+    h = HashCombine(h, uint64_t(st.st_size));
+    h = HashCombine(h, uint64_t(st.st_mtime));
+  }
+  (*signature) = h;
+  return true;
+}
+
+// Read only mapping of a whole file.
+class MappedFile {
+public:
+  ~MappedFile() {
+#ifndef _WIN32
+    if (addr) {
+      munmap(addr, size);
+    }
+#endif
+  }
+
+  bool open(const std::string &filename) {
+#ifdef _WIN32
+    std::ifstream ifs(filename, std::ios::binary | std::ios::ate);
+    if (!ifs) {
+      return false;
+    }
+    buffer.resize(size_t(ifs.tellg()));
+    ifs.seekg(0);
+    if (!ifs.read(reinterpret_cast<char *>(buffer.data()),
+                  std::streamsize(buffer.size()))) {
+      return false;
+    }
+    data = buffer.data();
+    size = buffer.size();
+    return true;
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (st.st_size <= 0)) {
+      ::close(fd);
+      return false;
+    }
+    void *p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+      return false;
+    }
+    addr = p;
+    data = static_cast<const unsigned char *>(p);
+    size = size_t(st.st_size);
+    return true;
+#endif
+  }
+
+  const unsigned char *data = nullptr;
+  size_t size = 0;
+
+private:
+#ifdef _WIN32
+  std::vector<unsigned char> buffer;
+#else
+  void *addr = nullptr;
+#endif
+};
+
+bool LoadFaceDataCache(const std::string &filename, uint64_t signature,
+                       FaceData *face_data) {
+  std::shared_ptr<MappedFile> file(new MappedFile());
+  if (!file->open(filename)) {
+    return false;
+  }
+
+  CacheHeader header;
+  if (file->size < sizeof(CacheHeader)) {
+    return false;
+  }
+  memcpy(&header, file->data, sizeof(CacheHeader));
+  if ((memcmp(header.magic, kCacheMagic, sizeof(kCacheMagic)) != 0) ||
+      (header.version != kCacheVersion) ||
+      (header.byte_order != kCacheByteOrder) ||
+      (header.source_signature != signature) ||
+      (header.file_size != file->size)) {
+    return false;
+  }
+
+  const size_t elem_sizes[kNumCacheArrays] = {
+      sizeof(uint32_t), sizeof(uint32_t), sizeof(uint32_t),
+      sizeof(std::array<float, 3>)};
+  for (size_t i = 0; i < kNumCacheArrays; i++) {
+    if ((header.offsets[i] % kCacheAlignment) ||
+        (header.offsets[i] < sizeof(CacheHeader)) ||
+        (header.offsets[i] > file->size) ||
+        (header.counts[i] > (file->size - header.offsets[i]) / elem_sizes[i])) {
+      return false;
+    }
+  }
+
+  if (header.checksum != Checksum(file->data + sizeof(CacheHeader),
+                                  file->size - sizeof(CacheHeader))) {
+    std::cerr << "Checksum mismatch in face data cache : " << filename
+              << std::endl;
+    return false;
+  }
+
+  const unsigned char *base = file->data;
+  face_data->uv_kpt_indices.reference(
+      reinterpret_cast<const uint32_t *>(base + header.offsets[kUVKptIndices]),
+      size_t(header.counts[kUVKptIndices]));
+  face_data->face_indices.reference(
+      reinterpret_cast<const uint32_t *>(base + header.offsets[kFaceIndices]),
+      size_t(header.counts[kFaceIndices]));
+  face_data->triangles.reference(
+      reinterpret_cast<const uint32_t *>(base + header.offsets[kTriangles]),
+      size_t(header.counts[kTriangles]));
+  face_data->canonical_vertices.reference(
+      reinterpret_cast<const std::array<float, 3> *>(
+          base + header.offsets[kCanonicalVertices]),
+      size_t(header.counts[kCanonicalVertices]));
+  face_data->mapping = file;
+
+  return true;
+}
+
+// Writes `buf` to a new temporary file next to `filename`. The name is unique
+// so that processes saving the same cache concurrently do not write to the
+// same file. The file is removed on failure.
+bool WriteTemporaryFile(const std::string &filename,
+                        const std::vector<unsigned char> &buf,
+                        std::string *tmp_filename) {
+#ifndef _WIN32
+  std::vector<char> name(filename.begin(), filename.end());
+  const char suffix[] = ".XXXXXX";
+  name.insert(name.end(), suffix, suffix + sizeof(suffix));  // with '\0'
+  const int fd = mkstemp(name.data());
+  if (fd < 0) {
+    return false;
+  }
+  *tmp_filename = name.data();
+
+  // mkstemp creates the file with 0600. The cache is shared like the data.
+  bool ok = (fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == 0);
+  size_t written = 0;
+  while (ok && (written < buf.size())) {
+    const ssize_t n = write(fd, buf.data() + written, buf.size() - written);
+    if (n < 0) {
+      ok = (errno == EINTR);
+    } else {
+      written += size_t(n);
+    }
+  }
+  if ((close(fd) != 0) || !ok) {
+    unlink(tmp_filename->c_str());
+    return false;
+  }
+  return true;
+#else
+  static std::atomic<unsigned int> counter{0};
+  std::ostringstream ss;
+  ss << filename << "." << _getpid() << "." << counter++ << ".tmp";
+  *tmp_filename = ss.str();
+
+  std::ofstream ofs(*tmp_filename, std::ios::binary);
+  if (!ofs) {
+    return false;
+  }
+  ofs.write(reinterpret_cast<const char *>(buf.data()),
+            std::streamsize(buf.size()));
+  ofs.close();
+  if (!ofs) {
+    std::remove(tmp_filename->c_str());
+    return false;
+  }
+  return true;
+#endif
+}
+
+bool SaveFaceDataCache(const std::string &filename, uint64_t signature,
+                       const TextFaceData &face_data) {
+  const void *arrays[kNumCacheArrays] = {
+      face_data.uv_kpt_indices.data(), face_data.face_indices.data(),
+      face_data.triangles.data(), face_data.canonical_vertices.data()};
+  const size_t bytes[kNumCacheArrays] = {
+      face_data.uv_kpt_indices.size() * sizeof(uint32_t),
+      face_data.face_indices.size() * sizeof(uint32_t),
+      face_data.triangles.size() * sizeof(uint32_t),
+      face_data.canonical_vertices.size() * sizeof(std::array<float, 3>)};
+
+  CacheHeader header;
+  memset(&header, 0, sizeof(CacheHeader));
+  memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+  header.version = kCacheVersion;
+  header.byte_order = kCacheByteOrder;
+  header.source_signature = signature;
+  header.counts[kUVKptIndices] = face_data.uv_kpt_indices.size();
+  header.counts[kFaceIndices] = face_data.face_indices.size();
+  header.counts[kTriangles] = face_data.triangles.size();
+  header.counts[kCanonicalVertices] = face_data.canonical_vertices.size();
+
+  size_t offset = sizeof(CacheHeader);
+  for (size_t i = 0; i < kNumCacheArrays; i++) {
+    offset = (offset + kCacheAlignment - 1) / kCacheAlignment * kCacheAlignment;
+    header.offsets[i] = offset;
+    offset += bytes[i];
+  }
+  header.file_size = offset;
+
+  std::vector<unsigned char> buf(offset, 0);
+  for (size_t i = 0; i < kNumCacheArrays; i++) {
+    if (bytes[i] > 0) {
+      memcpy(buf.data() + header.offsets[i], arrays[i], bytes[i]);
+    }
+  }
+  header.checksum = Checksum(buf.data() + sizeof(CacheHeader),
+                             buf.size() - sizeof(CacheHeader));
+  memcpy(buf.data(), &header, sizeof(CacheHeader));
+
+  // Write to a temporary file and rename it, so that other processes never
+  // see a partially written cache.
+  std::string tmp_filename;
+  if (!WriteTemporaryFile(filename, buf, &tmp_filename)) {
+    return false;
+  }
+#ifdef _WIN32
+  std::remove(filename.c_str());
+#endif
+  if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+    std::remove(tmp_filename.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+} // namespace
+
+bool LoadFaceData(const std::string &datapath, FaceData *face_data,
+                  const std::string &cache_filename)
+{
+  if (datapath.empty()) {
+#ifdef USE_EMBEDDED_FACE_DATA
+    namespace embedded = embedded_face_data;
+    face_data->uv_kpt_indices.reference(embedded::kUVKptIndices,
+                                        embedded::kNumUVKptIndices);
+    face_data->face_indices.reference(embedded::kFaceIndices,
+                                      embedded::kNumVertices);
+    face_data->triangles.reference(embedded::kTriangles,
+                                   3 * embedded::kNumTriangles);
+    face_data->canonical_vertices.reference(embedded::kCanonicalVertices,
+                                            embedded::kNumVertices);
+    face_data->mapping.reset();
+    return true;
+#else
+    std::cerr << "Face data is not embedded. Build with WITH_EMBEDDED_FACE_DATA "
+                 "or specify the path of face data." << std::endl;
+    return false;
+#endif
+  }
+
+  const std::string cache_path = cache_filename.empty()
+                                     ? JoinPath(datapath, "face_data.bin")
+                                     : cache_filename;
+
+  uint64_t signature = 0;
+  const bool has_signature = SourceSignature(datapath, &signature);
+  if (has_signature && LoadFaceDataCache(cache_path, signature, face_data)) {
+    return true;
+  }
+
+  TextFaceData text_data;
+  if (!LoadTextFaceData(datapath, &text_data)) {
+    return false;
+  }
+
+  if (has_signature && !SaveFaceDataCache(cache_path, signature, text_data)) {
+    std::cerr << "Failed to write face data cache : " << cache_path
+              << std::endl;
+  }
+
+  face_data->uv_kpt_indices.assign(std::move(text_data.uv_kpt_indices));
+  face_data->face_indices.assign(std::move(text_data.face_indices));
+  face_data->triangles.assign(std::move(text_data.triangles));
+  face_data->canonical_vertices.assign(
+      std::move(text_data.canonical_vertices));
+  face_data->mapping.reset();
+
+  return true;
+}
+
 } // namespace prnet
@@ -2,24 +2,88 @@
 #define PRNET_INFER_FACE_DATA_H_
 
 #include <array>
+#include <memory>
 #include <vector>
 #include <string>
 
 namespace prnet {
 
+///
+/// Read only array of FaceData. Elements are either owned by the array or
+/// refer to a mapped cache file(which is kept alive by FaceData).
+///
+template <typename T>
+class FaceDataArray {
+public:
+  FaceDataArray() {}
+  FaceDataArray(const FaceDataArray &rhs) { *this = rhs; }
+  FaceDataArray &operator=(const FaceDataArray &rhs) {
+    if (this != &rhs) {
+      storage = rhs.storage;
+      ptr = rhs.external ? rhs.ptr : storage.data();
+      n = rhs.n;
+      external = rhs.external;
+    }
+    return *this;
+  }
+
+  // Takes the ownership of `values`.
+  void assign(std::vector<T> &&values) {
+    storage = std::move(values);
+    ptr = storage.data();
+    n = storage.size();
+    external = false;
+  }
+
+  // Refers to `count` elements at `values`, which must outlive this array.
+  void reference(const T *values, size_t count) {
+    storage.clear();
+    ptr = values;
+    n = count;
+    external = true;
+  }
+
+  size_t size() const { return n; }
+  bool empty() const { return n == 0; }
+  const T *data() const { return ptr; }
+  const T &operator[](size_t i) const { return ptr[i]; }
+  const T *begin() const { return ptr; }
+  const T *end() const { return ptr + n; }
+
+private:
+  std::vector<T> storage;
+  const T *ptr = nullptr;
+  size_t n = 0;
+  bool external = false;
+};
+
 struct FaceData {
 
-  std::vector<uint32_t> uv_kpt_indices; // 2 x 68. uv-data/uv_kpt_ind.txt
-  std::vector<uint32_t> face_indices; // uv-data/face_idx.txt
-  std::vector<uint32_t> triangles; // # of triangles * xyz. uv-data/triangles.txt
-  std::vector<std::array<float, 3>> canonical_vertices;
+  FaceDataArray<uint32_t> uv_kpt_indices; // 2 x 68. uv-data/uv_kpt_ind.txt
+  FaceDataArray<uint32_t> face_indices; // uv-data/face_idx.txt
+  FaceDataArray<uint32_t> triangles; // # of triangles * xyz. uv-data/triangles.txt
+  FaceDataArray<std::array<float, 3>> canonical_vertices;
+
+  // Mapped cache file the arrays refer to(if any).
+  std::shared_ptr<const void> mapping;
 
 };
 
 ///
 /// Load face data(indices, triangles, uv_kpt)
 ///
-bool LoadFaceData(const std::string &datapath, FaceData *face_data);
+/// Text files in `datapath` are parsed once and converted to a binary cache
+/// `face_data.bin` in `datapath`(or `cache_filename` if specified). Later
+/// calls map the cache and use it in place. The cache has a version, the size
+/// and modification time of the text files and a checksum, and is rebuilt when
+/// any of them does not match. Failing to write the cache(e.g. read only
+/// directory) is not an error.
+///
+/// If `datapath` is empty, face data embedded in the executable is used
+/// (`WITH_EMBEDDED_FACE_DATA` CMake option). Returns false if not embedded.
+///
+bool LoadFaceData(const std::string &datapath, FaceData *face_data,
+                  const std::string &cache_filename = "");
 
 } // namespace prnet
 
@@ -1,248 +1,169 @@
 #include "face_cropper.h"
+#include "face_detector.h"
+#include "image_warp.h"
 
-#include <cassert>
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 
-#ifdef USE_DLIB
-#ifdef __clang__
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Weverything"
-#endif
-#include <dlib/image_processing/frontal_face_detector.h>
-#include <dlib/gui_widgets.h>
-
-#ifdef __clang__
-#pragma clang diagnostic pop
-#endif
-
-#endif
-
 namespace prnet {
 
 namespace {
 
-template <typename T>
-inline T clamp(T f, T fmin, T fmax) {
-  return std::max(std::min(fmax, f), fmin);
+// Resolution of the cropped image(input of PRNet).
+const size_t kCropSize = 256;
+
+// Square region centered at (`center_x`, `center_y`) with `size` pixels extent.
+CropParam MakeCropParam(float center_x, float center_y, float size) {
+  const AffineTransform xform =
+      MakeCropTransform(center_x, center_y, size, kCropSize, kCropSize);
+  CropParam param;
+  param.scale = xform.m[0];
+  param.shift_x = xform.m[2];
+  param.shift_y = xform.m[5];
+  return param;
 }
 
-inline void FilterFloat(float *rgba, const float *image, int i00, int i10,
-                        int i01, int i11,
-                        float w[4],  // weight
-                        int channels) {
-  float texel[4][4];
-
-  rgba[0] = rgba[1] = rgba[2] = 0.0f;
-
-  // Filter in linear space
-  for (int i = 0; i < channels; i++) {
-    texel[0][i] = image[i00 + i];
-    texel[1][i] = image[i10 + i];
-    texel[2][i] = image[i01 + i];
-    texel[3][i] = image[i11 + i];
-  }
-
-  for (int i = 0; i < channels; i++) {
-    rgba[i] = w[0] * texel[0][i] + w[1] * texel[1][i] + w[2] * texel[2][i] +
-              w[3] * texel[3][i];
-  }
-
-  if (channels < 4) {
-    rgba[3] = 1.0;
-  }
-}
-
-// Fetch texture with bilinear filtering.
-static void FetchTexture(const float u, const float v, int width, int height,
-                         int components, const float *image, float *rgba) {
-  // clamp to edge
-  if ((u < 0.0f) || (u >= 1.0f) || (v < 0.0f) || (v >= 1.0f)) {
-    rgba[0] = 0.0f;
-    rgba[1] = 0.0f;
-    rgba[2] = 0.0f;
-    rgba[3] = 0.0f;
-    return;
-  }
-
-  float sx = std::floor(u);
-  float sy = std::floor(v);
-
-  float uu = u - sx;
-  float vv = v - sy;
-
-  // clamp
-  uu = clamp(uu, 0.0f, 1.0f);
-  vv = clamp(vv, 0.0f, 1.0f);
-
-  float px = (width - 1) * uu;
-  float py = (height - 1) * vv;
-
-  int x0 = int(px);
-  int y0 = int(py);
-  int x1 = ((x0 + 1) >= width) ? (width - 1) : (x0 + 1);
-  int y1 = ((y0 + 1) >= height) ? (height - 1) : (y0 + 1);
-
-  float dx = px - float(x0);
-  float dy = py - float(y0);
-
-  float w[4];
-
-  w[0] = (1.0f - dx) * (1.0f - dy);
-  w[1] = (1.0f - dx) * (dy);
-  w[2] = (dx) * (1.0f - dy);
-  w[3] = (dx) * (dy);
-
-  int i00 = components * (y0 * width + x0);
-  int i01 = components * (y0 * width + x1);
-  int i10 = components * (y1 * width + x0);
-  int i11 = components * (y1 * width + x1);
+} // anonymous namespace
 
-  FilterFloat(rgba, image, i00, i10, i01, i11, w, components);
-}
+class FaceCropper::Impl {
+public:
+  bool set_detector(const std::string& name,
+                    const std::string& model_filename) {
+    detector_selected = true;
+    if (name == "none") {
+      detector.reset();
+      return true;
+    }
 
-//
-// Crop an image with bilinear filtering.
-// pixel bounding box is defined in (xs, ys) - (xe, ye)
-// bounding box range is in (0, 0) x (width-1, height-1)
-//
-static void CropImage(const Image<float> &in_img, int xs, int xe, int ys,
-                      int ye, Image<float> *out_img, size_t dst_width,
-                      size_t dst_height) {
-  size_t width = in_img.getWidth();
-  size_t height = in_img.getHeight();
-  size_t channels = in_img.getChannels();
-
-  out_img->create(dst_width, dst_height, channels);
-
-  if ((xs == xe) || (ys == ye)) {
-    return;
+    std::unique_ptr<FaceDetector> new_detector =
+        CreateFaceDetector(name, model_filename);
+    if (!new_detector) {
+      return false;
+    }
+    detector = std::move(new_detector);
+    detector->set_min_face_size(min_face_size);
+    return true;
   }
 
-  const float *src = in_img.getData();
-  float *dst = out_img->getData();
-
-  for (size_t y = 0; y < dst_height; y++) {
-    float v = (ys + 0.5f + (y / float(dst_height)) * (ye - ys + 1)) / float(height);
-    for (size_t x = 0; x < dst_width; x++) {
-      float u = (xs + 0.5f + (x / float(dst_width)) * (xe - xs + 1)) / float(width);
-
-      float rgba[4];
-      FetchTexture(u, v, int(width), int(height), int(channels), src, rgba);
-
-      for (size_t c = 0; c < channels; c++) {
-        dst[channels * (y * dst_width + x) + c] = rgba[c];
+  bool locate_faces(const Image<float>& inp_img,
+                    std::vector<CropParam>& params) {
+    params.clear();
+#ifdef USE_DLIB
+    // "hog" is the default. Created at the first use, so that the detector is
+    // not loaded when another one is selected.
+    if (!detector_selected) {
+      detector_selected = true;
+      detector = CreateFaceDetector("hog");
+      if (detector) {
+        detector->set_min_face_size(min_face_size);
       }
     }
-  }
-}
+#endif
+    if (!detector) {
+      return false;
+    }
 
-} // anonymous namespace
+    std::vector<FaceRect> faces;
+    if (!detector->detect(inp_img, &faces)) {
+      return false;
+    }
 
-class FaceCropper::Impl {
-public:
-  bool crop_dlib(const Image<float>& inp_img, Image<float>& out_img,
-                 float* scale, float *shift_x, float *shift_y) {
-#ifdef USE_DLIB
-    const int width = int(inp_img.getWidth());
-    const int height = int(inp_img.getHeight());
-    assert(inp_img.getChannels() == 3);
-
-    // Create dlib image
-    dlib::array2d<unsigned char> dlib_img(height, width);
-    inp_img.foreach ([&](int x, int y, const float *v) {
-      // Gray scale
-      dlib_img[y][x] = static_cast<uint8_t>(clamp( (0.2126f * v[0] + 0.7152f * v[1] + 0.0722f * v[2]) * 255.0f, 0.0f, 255.0f));
-    });
-
-    // Detect
-    const std::vector<dlib::rectangle> dets = detector(dlib_img);
-    if (0 < dets.size()) {
-      const dlib::rectangle &d = dets[0];
-
-      // Crop
-      const float left = float(d.left());
-      const float right = float(d.right());
-      const float top = float(d.top());
-      const float bottom = float(d.bottom());
+    const FaceBoxCalibration calibration = detector->box_calibration();
+    for (size_t i = 0; i < faces.size(); i++) {
+      const FaceRect &d = faces[i];
+
+      // Crop region
+      const float left = d.left;
+      const float right = d.right;
+      const float top = d.top;
+      const float bottom = d.bottom;
       const float old_size = (right - left + bottom - top) / 2.f;
       const float center[2] =
         {right - (right - left) / 2.f,
-         bottom - (bottom - top) / 2.f + old_size * 0.14f};
-      const float size = old_size * 1.58f;
-
-      int region[4];
-      region[0] = int(center[0] - (size / 2.0f));
-      region[1] = int(center[0] + (size / 2.0f));
-      region[2] = int(center[1] - (size / 2.0f));
-      region[3] = int(center[1] + (size / 2.0f));
+         bottom - (bottom - top) / 2.f + old_size * calibration.shift_y};
+      const float size = old_size * calibration.scale;
 
-      CropImage(inp_img, region[0], region[1], region[2], region[3], &out_img,
-                256, 256);
+      params.push_back(MakeCropParam(center[0], center[1], size));
+    }
 
-      *scale = size / float(width);
-      *shift_x = center[0];
-      *shift_y = center[1];
+    return !faces.empty();
+  }
 
-      return true;
+  void set_min_face_size(int size) {
+    min_face_size = size;
+    if (detector) {
+      detector->set_min_face_size(size);
     }
-#else
-    (void)inp_img;
-    (void)out_img;
-    (void)scale;
-    (void)shift_x;
-    (void)shift_y;
-#endif
-    return false;
   }
 
-  bool crop_center(const Image<float>& inp_img, Image<float>& out_img,
-                   float* scale, float *shift_x, float *shift_y) {
+  void locate_center(const Image<float>& inp_img, CropParam* param) {
     const int width = int(inp_img.getWidth());
     const int height = int(inp_img.getHeight());
 
     // In non dlib path, PRNet crops image from image center with 1/1.6 scaling
     // (minify) then revert it by x1.6 scaling.
     // (See PRNet's api.py::PRN::process for details)
+    // Square region is used to keep the aspect ratio of the face.
     const float SCALE = 1.6f;
-    float center[2] = {width / 2.0f - 0.5f, height / 2.0f - 0.5f};
+    const float center[2] = {width / 2.0f - 0.5f, height / 2.0f - 0.5f};
+    const float size = float(std::max(width, height)) * SCALE;
 
-    int region[4];
-    region[0] = int(center[0] - (width / 2.0f) * SCALE);
-    region[1] = int(center[0] + (width / 2.0f) * SCALE);
-    region[2] = int(center[1] - (height / 2.0f) * SCALE);
-    region[3] = int(center[1] + (height / 2.0f) * SCALE);
-
-    std::cout << "region = " << region[0] << ", " << region[1] << ", " << region[2] << ", " << region[3] << std::endl;
-
-    CropImage(inp_img, region[0], region[1], region[2], region[3], &out_img,
-              256, 256);
+    *param = MakeCropParam(center[0], center[1], size);
+  }
 
-    *scale = SCALE;
-    *shift_x = center[0] - ((256.0f / 2.0f) - 0.5f) * SCALE;
-    *shift_y = center[1] - ((256.0f / 2.0f) - 0.5f) * SCALE;
+  void crop(const Image<float>& inp_img, const CropParam& param,
+            size_t width, size_t height, float* dst) {
+    AffineTransform xform;
+    xform.m[0] = param.scale;
+    xform.m[2] = param.shift_x;
+    xform.m[4] = param.scale;
+    xform.m[5] = param.shift_y;
 
-    return true;
+    WarpAffine(inp_img, xform, width, height, dst);
   }
 
 private:
-#ifdef USE_DLIB
-  dlib::frontal_face_detector detector = dlib::get_frontal_face_detector();
-#endif
+  std::unique_ptr<FaceDetector> detector;
+  bool detector_selected = false;  // by `set_detector`
+  int min_face_size = 0;
 };
 
 // PImpl pattern
 FaceCropper::FaceCropper() : impl(new Impl()) {}
 FaceCropper::~FaceCropper() {}
-bool FaceCropper::crop_dlib(const Image<float>& inp_img,
-                            Image<float>& out_img, float* scale,
-                            float *shift_x, float *shift_y) {
-  return impl->crop_dlib(inp_img, out_img, scale, shift_x, shift_y);
+bool FaceCropper::set_detector(const std::string& name,
+                               const std::string& model_filename) {
+  return impl->set_detector(name, model_filename);
+}
+bool FaceCropper::locate_faces(const Image<float>& inp_img,
+                               std::vector<CropParam>& params) {
+  return impl->locate_faces(inp_img, params);
+}
+void FaceCropper::set_min_face_size(int size) {
+  impl->set_min_face_size(size);
+}
+void FaceCropper::locate_center(const Image<float>& inp_img,
+                                CropParam* param) {
+  impl->locate_center(inp_img, param);
+}
+void FaceCropper::crop(const Image<float>& inp_img, const CropParam& param,
+                       size_t width, size_t height, float* dst) {
+  impl->crop(inp_img, param, width, height, dst);
 }
 bool FaceCropper::crop_center(const Image<float>& inp_img,
                               Image<float>& out_img, float* scale,
                               float *shift_x, float *shift_y) {
-  return impl->crop_center(inp_img, out_img, scale, shift_x, shift_y);
+  CropParam param;
+  impl->locate_center(inp_img, &param);
+  out_img.create(kCropSize, kCropSize, inp_img.getChannels());
+  impl->crop(inp_img, param, kCropSize, kCropSize, out_img.getData());
+
+  *scale = param.scale;
+  *shift_x = param.shift_x;
+  *shift_y = param.shift_y;
+
+  return true;
 }
 
 } // namespace prnet
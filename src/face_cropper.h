@@ -1,16 +1,51 @@
 #ifndef FACE_CROPPER_H_180610
 #define FACE_CROPPER_H_180610
 
+#include <string>
+
 #include "image.h"
 
 namespace prnet {
 
+///
+/// Face region to crop. Maps a pixel of the cropped(256x256) image to the
+/// input image coordinate, and is also used to remap a position map.
+///
+///   x_in = scale * x_crop + shift_x
+///   y_in = scale * y_crop + shift_y
+///
+struct CropParam {
+  float scale = 1.f;
+  float shift_x = 0.f;
+  float shift_y = 0.f;
+};
+
 class FaceCropper {
 public:
   FaceCropper();
   ~FaceCropper();
-  bool crop_dlib(const Image<float>& inp_img, Image<float>& out_img,
-                 float* scale, float *shift_x, float *shift_y);
+
+  // Selects the face detector(see `CreateFaceDetector` for names).
+  // "none" disables detection. "hog" is the default in dlib build, which is
+  // created at the first `locate_faces` unless another one is selected.
+  bool set_detector(const std::string& name,
+                    const std::string& model_filename = "");
+
+  // Locates every face with the face detector. `params` has one entry per
+  // face(in detection order). Returns false when no face was found.
+  bool locate_faces(const Image<float>& inp_img, std::vector<CropParam>& params);
+  // Faces smaller than `size` pixels are not detected. Skipping fine pyramid
+  // levels makes detection faster. 0 = no limit(default).
+  void set_min_face_size(int size);
+  // Locates the face at the image center.
+  void locate_center(const Image<float>& inp_img, CropParam* param);
+
+  // Crops the region of `param` into `dst`(`width` x `height` x channels,
+  // tightly packed), e.g. a slot of the input tensor of the predictor.
+  void crop(const Image<float>& inp_img, const CropParam& param,
+            size_t width, size_t height, float* dst);
+
+  // locate + crop
   bool crop_center(const Image<float>& inp_img, Image<float>& out_img,
                    float* scale, float *shift_x, float *shift_y);
 
@@ -0,0 +1,472 @@
+#include "face_detector.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifdef USE_DLIB
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Weverything"
+#endif
+#include <dlib/image_processing/frontal_face_detector.h>
+
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+#endif
+
+namespace prnet {
+
+namespace {
+
+template <typename T>
+inline T clamp(T f, T fmin, T fmax) {
+  return std::max(std::min(fmax, f), fmin);
+}
+
+// Converts RGB image to 8bit gray scale image. `dst` has `width` x `height`
+// pixels with `stride` bytes per row.
+void ToGray(const Image<float>& img, unsigned char* dst, size_t stride) {
+  const size_t width = img.getWidth();
+  const size_t height = img.getHeight();
+  const float *src = img.getData();
+  assert(img.getChannels() == 3);
+
+  GetSharedThreadPool().parallel_for(height, [&](size_t y) {
+    const float *v = src + y * width * 3;
+    unsigned char *d = dst + y * stride;
+    for (size_t x = 0; x < width; x++, v += 3) {
+      d[x] = static_cast<uint8_t>(clamp( (0.2126f * v[0] + 0.7152f * v[1] + 0.0722f * v[2]) * 255.0f, 0.0f, 255.0f));
+    }
+  });
+}
+
+#ifdef USE_DLIB
+
+//
+// dlib's HOG frontal face detector.
+//
+// dlib's detector scans its image pyramid on a single thread. Here pyramid
+// levels are built once, then levels(large levels are split into overlapping
+// row strips) are scanned in parallel on the shared thread pool and detections
+// are merged with non-maximum suppression.
+//
+class HogFaceDetector : public FaceDetector {
+public:
+  // Same as PRNet's api.py::PRN::process, which uses dlib's detector.
+  FaceBoxCalibration box_calibration() const override {
+    FaceBoxCalibration calibration;
+    calibration.scale = 1.58f;
+    calibration.shift_y = 0.14f;
+    return calibration;
+  }
+
+  bool detect(const Image<float>& inp_img, std::vector<FaceRect>* faces) override {
+    faces->clear();
+
+    const size_t width = inp_img.getWidth();
+    const size_t height = inp_img.getHeight();
+
+    ThreadPool &pool = GetSharedThreadPool();
+
+    // Gray scale
+    std::vector<std::unique_ptr<gray_image_type>> levels;
+    levels.emplace_back(new gray_image_type(long(height), long(width)));
+    if ((width == 0) || (height == 0)) {
+      return true;
+    }
+    ToGray(inp_img, static_cast<unsigned char *>(dlib::image_data(*levels[0])),
+           size_t(dlib::width_step(*levels[0])));
+
+    const scanner_type &scanner = detector.get_scanner();
+    const long window_width = long(scanner.get_detection_window_width());
+    const long window_height = long(scanner.get_detection_window_height());
+
+    // Level l is downscaled by (5/6)^l, so the detection window there covers
+    // faces of about window_size * (6/5)^l pixels in the input image. Levels
+    // finer than `min_face_size` are skipped. The level is rounded down, so a
+    // face of `min_face_size`(between two levels) is still scanned at the
+    // finer one of them.
+    size_t first_level = 0;
+    const long window_size = std::max(window_width, window_height);
+    if (min_face_size > window_size) {
+      first_level = size_t(std::floor(std::log(float(min_face_size) / float(window_size)) /
+                                      std::log(6.0f / 5.0f)));
+    }
+
+    // Build pyramid.
+    pyramid_type pyr;
+    for (;;) {
+      const gray_image_type &prev = *levels.back();
+      if ((prev.nr() * 5 / 6 < window_height) || (prev.nc() * 5 / 6 < window_width)) {
+        break;
+      }
+      levels.emplace_back(new gray_image_type());
+      pyr(prev, *levels.back());
+    }
+
+    if (first_level >= levels.size()) {
+      return true;
+    }
+
+    // Split levels into row strips. Strips overlap by twice the detection
+    // window so that every window position(with HOG cell padding) is covered
+    // by a strip.
+    const long strip_rows = std::max(4 * window_height, long(height / pool.size()));
+    std::vector<ScanTask> tasks;
+    for (size_t l = first_level; l < levels.size(); l++) {
+      const long rows = levels[l]->nr();
+      for (long top = 0; top < rows; top += strip_rows) {
+        ScanTask task;
+        task.level = l;
+        task.top = top;
+        task.bottom = std::min(rows - 1, top + strip_rows + 2 * window_height);
+        tasks.push_back(task);
+        if (task.bottom == rows - 1) {
+          break;
+        }
+      }
+    }
+
+    // Single level detector.
+    scanner_type level_scanner;
+    level_scanner.copy_configuration(scanner);
+    level_scanner.set_max_pyramid_levels(1);
+    std::vector<dlib::frontal_face_detector::feature_vector_type> w;
+    for (unsigned long i = 0; i < detector.num_detectors(); i++) {
+      w.push_back(detector.get_w(i));
+    }
+    const dlib::frontal_face_detector level_detector(
+        level_scanner, detector.get_overlap_tester(), w);
+
+    std::vector<std::vector<dlib::rect_detection>> task_dets(tasks.size());
+    pool.parallel_for(tasks.size(), [&](size_t t) {
+      const ScanTask &task = tasks[t];
+      const gray_image_type &level = *levels[task.level];
+
+      gray_image_type strip(task.bottom - task.top + 1, level.nc());
+      for (long r = 0; r < strip.nr(); r++) {
+        std::copy(&level[task.top + r][0], &level[task.top + r][0] + level.nc(), &strip[r][0]);
+      }
+
+      dlib::frontal_face_detector det(level_detector);  // not thread safe.
+      det(strip, task_dets[t]);
+
+      for (auto &d : task_dets[t]) {
+        d.rect = pyr.rect_up(dlib::translate_rect(d.rect, 0, task.top),
+                             (unsigned int)(task.level));
+      }
+    });
+
+    // Merge with non-maximum suppression.
+    std::vector<dlib::rect_detection> all_dets;
+    for (const auto &dets : task_dets) {
+      all_dets.insert(all_dets.end(), dets.begin(), dets.end());
+    }
+    std::sort(all_dets.begin(), all_dets.end(),
+              [](const dlib::rect_detection &a, const dlib::rect_detection &b) {
+                return a.detection_confidence > b.detection_confidence;
+              });
+
+    const dlib::test_box_overlap &overlaps = detector.get_overlap_tester();
+    std::vector<dlib::rectangle> kept;
+    for (const auto &d : all_dets) {
+      bool suppressed = false;
+      for (const auto &k : kept) {
+        if (overlaps(d.rect, k)) {
+          suppressed = true;
+          break;
+        }
+      }
+      if (!suppressed) {
+        kept.push_back(d.rect);
+
+        FaceRect face;
+        face.left = float(d.rect.left());
+        face.top = float(d.rect.top());
+        face.right = float(d.rect.right());
+        face.bottom = float(d.rect.bottom());
+        face.confidence = float(d.detection_confidence);
+        faces->push_back(face);
+      }
+    }
+
+    return true;
+  }
+
+private:
+  typedef dlib::pyramid_down<6> pyramid_type;  // Same as frontal_face_detector
+  typedef dlib::frontal_face_detector::image_scanner_type scanner_type;
+  typedef dlib::array2d<unsigned char> gray_image_type;
+
+  // Part of a pyramid level to scan.
+  struct ScanTask {
+    size_t level;
+    long top;     // first row in the level
+    long bottom;  // last row in the level(inclusive)
+  };
+
+  dlib::frontal_face_detector detector = dlib::get_frontal_face_detector();
+};
+
+#endif  // USE_DLIB
+
+//
+// Pixel intensity comparison based cascade(pico).
+// N. Markus et al., "Object Detection with Pixel Intensity Comparisons
+// Organized in Decision Trees", 2013. https://github.com/nenadmarkus/pico
+//
+// Each tree compares pairs of pixels at positions relative to the window, so
+// no image pyramid nor feature image is required.
+//
+class PicoFaceDetector : public FaceDetector {
+public:
+  // facefinder's square is larger than dlib's box(it includes the forehead
+  // and the chin) and centered closer to the face center, so it is scaled and
+  // shifted less. Tuned to roughly match the crop of "hog".
+  FaceBoxCalibration box_calibration() const override {
+    FaceBoxCalibration calibration;
+    calibration.scale = 1.3f;
+    calibration.shift_y = 0.06f;
+    return calibration;
+  }
+
+  bool load(const std::string& filename) {
+    std::ifstream ifs(filename, std::ios::binary);
+    if (!ifs) {
+      std::cerr << "File not found or failed to open : " << filename << std::endl;
+      return false;
+    }
+    std::vector<char> buf((std::istreambuf_iterator<char>(ifs)),
+                          std::istreambuf_iterator<char>());
+
+    // Header: float tsr, float tsc, int32 tdepth, int32 ntrees
+    if (buf.size() < 16) {
+      std::cerr << "Invalid pico cascade : " << filename << std::endl;
+      return false;
+    }
+    int32_t n_trees = 0;
+    memcpy(&depth, &buf[8], sizeof(int32_t));
+    memcpy(&n_trees, &buf[12], sizeof(int32_t));
+
+    if ((depth <= 0) || (depth > 16) || (n_trees <= 0)) {
+      std::cerr << "Invalid pico cascade header : " << filename << std::endl;
+      return false;
+    }
+
+    // Tree: int8 codes[4 * (2^depth - 1)], float lut[2^depth], float threshold
+    const size_t n_leaves = size_t(1) << depth;
+    const size_t tree_bytes = 4 * (n_leaves - 1) + sizeof(float) * n_leaves + sizeof(float);
+    if (buf.size() < 16 + tree_bytes * size_t(n_trees)) {
+      std::cerr << "Truncated pico cascade : " << filename << std::endl;
+      return false;
+    }
+
+    codes.resize(4 * (n_leaves - 1) * size_t(n_trees));
+    luts.resize(n_leaves * size_t(n_trees));
+    thresholds.resize(size_t(n_trees));
+    const char *p = &buf[16];
+    for (size_t t = 0; t < size_t(n_trees); t++) {
+      memcpy(&codes[4 * (n_leaves - 1) * t], p, 4 * (n_leaves - 1));
+      p += 4 * (n_leaves - 1);
+      memcpy(&luts[n_leaves * t], p, sizeof(float) * n_leaves);
+      p += sizeof(float) * n_leaves;
+      memcpy(&thresholds[t], p, sizeof(float));
+      p += sizeof(float);
+    }
+
+    return true;
+  }
+
+  bool detect(const Image<float>& inp_img, std::vector<FaceRect>* faces) override {
+    faces->clear();
+
+    const int width = int(inp_img.getWidth());
+    const int height = int(inp_img.getHeight());
+    if ((width == 0) || (height == 0)) {
+      return true;
+    }
+
+    std::vector<unsigned char> gray(size_t(width) * size_t(height));
+    ToGray(inp_img, gray.data(), size_t(width));
+
+    // Scan window sizes from min to max. Rows of every scale are scanned in
+    // parallel.
+    struct RowTask {
+      float size;
+      float row;
+    };
+    std::vector<RowTask> tasks;
+    const float max_size = float(std::min(width, height));
+    for (float s = std::max(float(min_face_size), kMinSize); s <= max_size;
+         s *= kScaleFactor) {
+      const float stride = std::max(kStrideFactor * s, 1.0f);
+      for (float r = s / 2 + 1; r <= float(height) - s / 2 - 1; r += stride) {
+        RowTask task;
+        task.size = s;
+        task.row = r;
+        tasks.push_back(task);
+      }
+    }
+
+    // Detections are collected per task and concatenated in task order, so
+    // the clustering below(which depends on the order) gives the same faces
+    // in every run.
+    std::vector<std::vector<Detection>> task_dets(tasks.size());
+    GetSharedThreadPool().parallel_for(tasks.size(), [&](size_t i) {
+      const float s = tasks[i].size;
+      const float stride = std::max(kStrideFactor * s, 1.0f);
+      for (float c = s / 2 + 1; c <= float(width) - s / 2 - 1; c += stride) {
+        float q;
+        if (classify(gray.data(), width, height, int(tasks[i].row), int(c),
+                     int(s), &q) && (q > kQualityThreshold)) {
+          Detection d;
+          d.row = tasks[i].row;
+          d.col = c;
+          d.size = s;
+          d.quality = q;
+          task_dets[i].push_back(d);
+        }
+      }
+    });
+    std::vector<Detection> dets;
+    for (const std::vector<Detection> &d : task_dets) {
+      dets.insert(dets.end(), d.begin(), d.end());
+    }
+
+    // Cluster overlapping detections.
+    std::vector<bool> assigned(dets.size(), false);
+    for (size_t i = 0; i < dets.size(); i++) {
+      if (assigned[i]) {
+        continue;
+      }
+      float r = 0.f, c = 0.f, s = 0.f, q = 0.f;
+      int n = 0;
+      for (size_t j = i; j < dets.size(); j++) {
+        if (!assigned[j] && (Overlap(dets[i], dets[j]) > 0.3f)) {
+          assigned[j] = true;
+          r += dets[j].row;
+          c += dets[j].col;
+          s += dets[j].size;
+          q += dets[j].quality;
+          n++;
+        }
+      }
+      r /= float(n);
+      c /= float(n);
+      s /= float(n);
+
+      FaceRect face;
+      face.left = c - s / 2;
+      face.top = r - s / 2;
+      face.right = c + s / 2;
+      face.bottom = r + s / 2;
+      face.confidence = q;
+      faces->push_back(face);
+    }
+
+    std::stable_sort(faces->begin(), faces->end(),
+                     [](const FaceRect &a, const FaceRect &b) {
+                       return a.confidence > b.confidence;
+                     });
+
+    return true;
+  }
+
+private:
+  // Parameters of pico's sample application.
+  const float kMinSize = 32.0f;
+  const float kScaleFactor = 1.1f;
+  const float kStrideFactor = 0.1f;
+  const float kQualityThreshold = 5.0f;
+
+  struct Detection {
+    float row, col, size, quality;
+  };
+
+  static float Overlap(const Detection &a, const Detection &b) {
+    const float overr = std::max(0.0f, std::min(a.row + a.size / 2, b.row + b.size / 2) -
+                                           std::max(a.row - a.size / 2, b.row - b.size / 2));
+    const float overc = std::max(0.0f, std::min(a.col + a.size / 2, b.col + b.size / 2) -
+                                           std::max(a.col - a.size / 2, b.col - b.size / 2));
+    return overr * overc / (a.size * a.size + b.size * b.size - overr * overc);
+  }
+
+  // Runs the cascade on the window centered at (`r`, `c`) with `s` pixels.
+  // Returns true when the window is classified as a face.
+  bool classify(const unsigned char *pixels, int width, int height, int r,
+                int c, int s, float *q) const {
+    // Positions are in 1/256 pixel unit relative to the window.
+    r = r * 256;
+    c = c * 256;
+    if (((r + 128 * s) / 256 >= height) || ((r - 128 * s) / 256 < 0) ||
+        ((c + 128 * s) / 256 >= width) || ((c - 128 * s) / 256 < 0)) {
+      return false;
+    }
+
+    const int n_leaves = 1 << depth;
+    const size_t n_trees = thresholds.size();
+    float o = 0.0f;
+    for (size_t t = 0; t < n_trees; t++) {
+      // Node `idx`(1-origin) has codes at [4 * (idx - 1), 4 * idx).
+      const int8_t *tcodes = codes.data() + 4 * size_t(n_leaves - 1) * t;
+      int idx = 1;
+      for (int j = 0; j < depth; j++) {
+        const int8_t *code = tcodes + 4 * (idx - 1);
+        const unsigned char p0 = pixels[(r + code[0] * s) / 256 * width + (c + code[1] * s) / 256];
+        const unsigned char p1 = pixels[(r + code[2] * s) / 256 * width + (c + code[3] * s) / 256];
+        idx = 2 * idx + (p0 <= p1);
+      }
+      o += luts[size_t(n_leaves) * t + size_t(idx - n_leaves)];
+
+      if (o <= thresholds[t]) {
+        return false;
+      }
+    }
+
+    *q = o - thresholds.back();
+    return true;
+  }
+
+  int32_t depth = 0;
+  std::vector<int8_t> codes;
+  std::vector<float> luts;
+  std::vector<float> thresholds;
+};
+
+} // anonymous namespace
+
+FaceDetector::~FaceDetector() {}
+
+std::unique_ptr<FaceDetector> CreateFaceDetector(
+    const std::string& name, const std::string& model_filename) {
+  if (name == "hog") {
+#ifdef USE_DLIB
+    return std::unique_ptr<FaceDetector>(new HogFaceDetector());
+#else
+    std::cerr << "\"hog\" face detector requires dlib build." << std::endl;
+    return nullptr;
+#endif
+  } else if (name == "pico") {
+    std::unique_ptr<PicoFaceDetector> detector(new PicoFaceDetector());
+    if (model_filename.empty()) {
+      std::cerr << "\"pico\" face detector requires cascade file." << std::endl;
+      return nullptr;
+    }
+    if (!detector->load(model_filename)) {
+      return nullptr;
+    }
+    return std::unique_ptr<FaceDetector>(detector.release());
+  }
+
+  std::cerr << "Unknown face detector : " << name << std::endl;
+  return nullptr;
+}
+
+} // namespace prnet
@@ -0,0 +1,71 @@
+#ifndef PRNET_INFER_FACE_DETECTOR_H_
+#define PRNET_INFER_FACE_DETECTOR_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "image.h"
+
+namespace prnet {
+
+///
+/// Detected face in pixel coordinate of the input image.
+///
+struct FaceRect {
+  float left = 0.f;
+  float top = 0.f;
+  float right = 0.f;
+  float bottom = 0.f;
+  float confidence = 0.f;
+};
+
+///
+/// Maps a detected box to the face region cropped for PRNet. Detectors are
+/// trained on different boxes, e.g. dlib's box is tight around eyebrows and
+/// mouth, so each detector has its own calibration.
+///
+///   size     = (width + height) / 2 * scale
+///   center_y = box center_y + (width + height) / 2 * shift_y
+///
+struct FaceBoxCalibration {
+  float scale = 1.f;
+  float shift_y = 0.f;
+};
+
+///
+/// Interface of face detectors.
+///
+class FaceDetector {
+public:
+  virtual ~FaceDetector();
+
+  // Detects faces in `img`(RGB). Returns false on error.
+  virtual bool detect(const Image<float>& img, std::vector<FaceRect>* faces) = 0;
+
+  // Faces smaller than `size` pixels are not detected. 0 = no limit.
+  void set_min_face_size(int size) { min_face_size = size; }
+
+  // Calibration of the boxes of this detector.
+  virtual FaceBoxCalibration box_calibration() const = 0;
+
+protected:
+  int min_face_size = 0;
+};
+
+///
+/// Creates a face detector by name.
+///
+///   "hog"  : dlib's HOG frontal face detector(dlib build only).
+///   "pico" : Built-in pixel intensity comparison based cascade(pico). Much
+///            faster than "hog" with lower recall. `model_filename` is a pico
+///            cascade file(e.g. `facefinder` in the pico repo).
+///
+/// Returns nullptr on failure.
+///
+std::unique_ptr<FaceDetector> CreateFaceDetector(
+    const std::string& name, const std::string& model_filename = "");
+
+} // namespace prnet
+
+#endif // PRNET_INFER_FACE_DETECTOR_H_
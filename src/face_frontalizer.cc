@@ -1,96 +1,235 @@
 #include "face_frontalizer.h"
+#include "thread_pool.h"
 
-#ifdef __clang__
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Weverything"
-#endif
-
-#ifdef USE_DLIB
-#include <dlib/matrix.h>
-#endif
-
-#ifdef __clang__
-#pragma clang diagnostic pop
-#endif
-
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <iostream>
 
 namespace prnet {
 
-void FrontalizeFaceMesh(Mesh *front_mesh, const FaceData &face_data) {
-#ifdef USE_DLIB
-    const int N_VTX = 43867;  // Defined by PRNet template.
-
-    assert(front_mesh->vertices.size() == N_VTX * 3);
-
-    dlib::matrix<float, N_VTX, 4> vertices_homo;
-    for (int i = 0; i < N_VTX; i++) {
-        vertices_homo(i, 0) = front_mesh->vertices[3 * size_t(i) + 0];
-        vertices_homo(i, 1) = front_mesh->vertices[3 * size_t(i) + 1];
-        vertices_homo(i, 2) = front_mesh->vertices[3 * size_t(i) + 2];
-        vertices_homo(i, 3) = 1.f;
+namespace {
+
+// Solves A x = B for 4x4 `A` and 4x3 `B`(row major) with Gauss-Jordan
+// elimination and partial pivoting. `x` is 4x3. Returns false when `A` is
+// singular.
+bool Solve4x4(double A[4][4], double B[4][3], float x[4][3]) {
+  for (int c = 0; c < 4; c++) {
+    int pivot = c;
+    for (int r = c + 1; r < 4; r++) {
+      if (std::fabs(A[r][c]) > std::fabs(A[pivot][c])) {
+        pivot = r;
+      }
     }
-
-    dlib::matrix<float, N_VTX, 3> canonical_vertices;
-    for (int i = 0; i < N_VTX; i++) {
-        canonical_vertices(i, 0) = face_data.canonical_vertices[size_t(i)][0];
-        canonical_vertices(i, 1) = face_data.canonical_vertices[size_t(i)][1];
-        canonical_vertices(i, 2) = face_data.canonical_vertices[size_t(i)][2];
+    if (std::fabs(A[pivot][c]) < 1e-12) {
+      return false;
+    }
+    if (pivot != c) {
+      for (int k = 0; k < 4; k++) std::swap(A[c][k], A[pivot][k]);
+      for (int k = 0; k < 3; k++) std::swap(B[c][k], B[pivot][k]);
     }
 
-    // c = P * v
-    // c * vt * (v * vt)^-1 = P
-    dlib::matrix<float, 4, 3> P = dlib::pinv(vertices_homo) * canonical_vertices;
-    dlib::matrix<float, N_VTX, 3> front_vertices = vertices_homo * P;
+    const double inv = 1.0 / A[c][c];
+    for (int r = 0; r < 4; r++) {
+      if (r == c) {
+        continue;
+      }
+      const double f = A[r][c] * inv;
+      for (int k = c; k < 4; k++) A[r][k] -= f * A[c][k];
+      for (int k = 0; k < 3; k++) B[r][k] -= f * B[c][k];
+    }
+  }
 
-    for (int i = 0; i < N_VTX; i++) {
-        front_mesh->vertices[3 * size_t(i) + 0] = front_vertices(i, 0);
-        front_mesh->vertices[3 * size_t(i) + 1] = front_vertices(i, 1);
-        front_mesh->vertices[3 * size_t(i) + 2] = front_vertices(i, 2);
+  for (int r = 0; r < 4; r++) {
+    for (int k = 0; k < 3; k++) {
+      x[r][k] = float(B[r][k] / A[r][r]);
     }
+  }
+  return true;
+}
 
-#if 1
-    // Centerize vertex position.
-    {
-        float bmin[3];
-        float bmax[3];
-        for (size_t i = 0; i < N_VTX; i++) {
-            float x = front_mesh->vertices[3 * i + 0];
-            float y = front_mesh->vertices[3 * i + 1];
-            float z = front_mesh->vertices[3 * i + 2];
-            if (i == 0) {
-                bmin[0] = bmax[0] = x;
-                bmin[1] = bmax[1] = y;
-                bmin[2] = bmax[2] = z;
-            } else {
-                bmin[0] = std::min(bmin[0], x);
-                bmin[1] = std::min(bmin[1], y);
-                bmin[2] = std::min(bmin[2], z);
-
-                bmax[0] = std::max(bmax[0], x);
-                bmax[1] = std::max(bmax[1], y);
-                bmax[2] = std::max(bmax[2], z);
-            }
-        }
-        float bsize[3];
-        bsize[0] = bmax[0] - bmin[0];
-        bsize[1] = bmax[1] - bmin[1];
-        bsize[2] = bmax[2] - bmin[2];
-        for (size_t i = 0; i < front_mesh->vertices.size() / 3; i++) {
-            front_mesh->vertices[3 * i + 0] -= (bmin[0] + 0.5f * bsize[0]);
-            front_mesh->vertices[3 * i + 1] -= (bmin[1] + 0.5f * bsize[1]);
-            front_mesh->vertices[3 * i + 2] -= (bmin[2] + 0.5f * bsize[2]);
+// Lanes of the partial sums in `FrontalizeFaceMesh`.
+const size_t kLanes = 8;
+
+// Terms of V^T V(except the count) and V^T C.
+const size_t kNumTerms = 21;
+
+// Adds the terms of kLanes vertices(`v`, and canonical vertices `c`), one per
+// lane of the accumulators. Each statement is an independent loop over the
+// lanes, so it maps to vector instructions as is.
+inline void AccumulateTerms(const float v[3][kLanes], const float c[3][kLanes],
+                            float acc[kNumTerms][kLanes]) {
+  const float *x = v[0];
+  const float *y = v[1];
+  const float *z = v[2];
+
+  // Upper triangle of V^T V in the order of `Sums::vtv`.
+  for (size_t l = 0; l < kLanes; l++) acc[0][l] += x[l] * x[l];
+  for (size_t l = 0; l < kLanes; l++) acc[1][l] += x[l] * y[l];
+  for (size_t l = 0; l < kLanes; l++) acc[2][l] += x[l] * z[l];
+  for (size_t l = 0; l < kLanes; l++) acc[3][l] += x[l];
+  for (size_t l = 0; l < kLanes; l++) acc[4][l] += y[l] * y[l];
+  for (size_t l = 0; l < kLanes; l++) acc[5][l] += y[l] * z[l];
+  for (size_t l = 0; l < kLanes; l++) acc[6][l] += y[l];
+  for (size_t l = 0; l < kLanes; l++) acc[7][l] += z[l] * z[l];
+  for (size_t l = 0; l < kLanes; l++) acc[8][l] += z[l];
+
+  // V^T C, a column(of C) after another.
+  for (size_t j = 0; j < 3; j++) {
+    float *a = acc[9 + 4 * j];
+    for (size_t l = 0; l < kLanes; l++) a[l] += x[l] * c[j][l];
+    a = acc[9 + 4 * j + 1];
+    for (size_t l = 0; l < kLanes; l++) a[l] += y[l] * c[j][l];
+    a = acc[9 + 4 * j + 2];
+    for (size_t l = 0; l < kLanes; l++) a[l] += z[l] * c[j][l];
+    a = acc[9 + 4 * j + 3];
+    for (size_t l = 0; l < kLanes; l++) a[l] += c[j][l];
+  }
+}
+
+} // anonymous namespace
+
+//
+// Finds an affine transform P(4x3) which maps homogeneous vertices V(Nx4) to
+// canonical vertices C(Nx3) in the least squares sense, then applies it.
+//
+//   P = (V^T V)^-1 V^T C
+//
+// V^T V(4x4, symmetric) and V^T C(4x3) are accumulated in one pass, so no
+// Nx4 matrix nor its pseudo inverse is required.
+//
+bool FrontalizeFaceMesh(Mesh *front_mesh, const FaceData &face_data) {
+  const size_t n = front_mesh->vertices.size() / 3;
+  if ((n == 0) || (n != face_data.canonical_vertices.size())) {
+    std::cerr << "# of vertices(" << n
+              << ") does not match with # of canonical vertices("
+              << face_data.canonical_vertices.size() << ")" << std::endl;
+    return false;
+  }
+
+  // Partial sums of chunks. A chunk sums its 4096 vertices in float, and the
+  // partial sums are added up in double, so float rounding errors stay within
+  // a chunk.
+  struct Sums {
+    double vtv[10] = {0};    // upper triangle of V^T V
+    double vtc[4][3] = {{0}};
+  };
+  const size_t kChunkSize = 4096;
+  const size_t n_chunks = (n + kChunkSize - 1) / kChunkSize;
+  std::vector<Sums> sums(n_chunks);
+
+  const float *vertices = front_mesh->vertices.data();
+  GetSharedThreadPool().parallel_for(n_chunks, [&](size_t chunk) {
+    const size_t begin = chunk * kChunkSize;
+    const size_t end = std::min(n, begin + kChunkSize);
+
+    // Each term has kLanes independent accumulators, and vertex i is added to
+    // lane(i % kLanes). The lanes are vectorized without reordering float
+    // additions(i.e. without -ffast-math), which a single accumulator per term
+    // would require.
+    float acc[kNumTerms][kLanes] = {{0}};
+    for (size_t i = begin; i < end; i += kLanes) {
+      // Deinterleave kLanes vertices. Lanes past the end are zero, which adds
+      // nothing to any term.
+      float v[3][kLanes] = {{0}};
+      float c[3][kLanes] = {{0}};
+      const size_t count = std::min(kLanes, end - i);
+      for (size_t l = 0; l < count; l++) {
+        const std::array<float, 3> &cv = face_data.canonical_vertices[i + l];
+        for (size_t k = 0; k < 3; k++) {
+          v[k][l] = vertices[3 * (i + l) + k];
+          c[k][l] = cv[k];
         }
+      }
+      AccumulateTerms(v, c, acc);
     }
-#endif
 
-#else
-  (void)front_mesh;
-  (void)face_data;
+    double terms[kNumTerms];
+    for (size_t t = 0; t < kNumTerms; t++) {
+      terms[t] = 0.0;
+      for (size_t l = 0; l < kLanes; l++) {
+        terms[t] += double(acc[t][l]);
+      }
+    }
 
-  std::cerr << "Face frontalization is not supported in non dlib buid at the momemnt." << std::endl;
+    Sums &s = sums[chunk];
+    for (size_t k = 0; k < 9; k++) {
+      s.vtv[k] = terms[k];
+    }
+    s.vtv[9] = double(end - begin);
+    for (size_t k = 0; k < 4; k++) {
+      for (size_t j = 0; j < 3; j++) {
+        s.vtc[k][j] = terms[9 + 4 * j + k];
+      }
+    }
+  });
+
+  double vtv[10] = {0};
+  double vtc[4][3] = {{0}};
+  for (const Sums &s : sums) {
+    for (int k = 0; k < 10; k++) vtv[k] += s.vtv[k];
+    for (int k = 0; k < 4; k++) {
+      for (int j = 0; j < 3; j++) vtc[k][j] += s.vtc[k][j];
+    }
+  }
+
+  double A[4][4] = {{vtv[0], vtv[1], vtv[2], vtv[3]},
+                    {vtv[1], vtv[4], vtv[5], vtv[6]},
+                    {vtv[2], vtv[5], vtv[7], vtv[8]},
+                    {vtv[3], vtv[6], vtv[8], vtv[9]}};
+  float P[4][3];
+  if (!Solve4x4(A, vtc, P)) {
+    std::cerr << "Failed to solve frontalization transform(degenerated mesh)."
+              << std::endl;
+    return false;
+  }
+
+  // Apply transform with bounding box.
+  std::vector<std::array<float, 6>> bboxes(n_chunks);
+  float *v = front_mesh->vertices.data();
+  GetSharedThreadPool().parallel_for(n_chunks, [&](size_t chunk) {
+    const size_t begin = chunk * kChunkSize;
+    const size_t end = std::min(n, begin + kChunkSize);
+    float bmin[3] = {1e30f, 1e30f, 1e30f};
+    float bmax[3] = {-1e30f, -1e30f, -1e30f};
+    for (size_t i = begin; i < end; i++) {
+      const float x = v[3 * i + 0];
+      const float y = v[3 * i + 1];
+      const float z = v[3 * i + 2];
+      for (int k = 0; k < 3; k++) {
+        const float f = x * P[0][k] + y * P[1][k] + z * P[2][k] + P[3][k];
+        v[3 * i + size_t(k)] = f;
+        bmin[k] = std::min(bmin[k], f);
+        bmax[k] = std::max(bmax[k], f);
+      }
+    }
+    bboxes[chunk] = {{bmin[0], bmin[1], bmin[2], bmax[0], bmax[1], bmax[2]}};
+  });
+
+  float bmin[3] = {1e30f, 1e30f, 1e30f};
+  float bmax[3] = {-1e30f, -1e30f, -1e30f};
+  for (const std::array<float, 6> &bbox : bboxes) {
+    for (int k = 0; k < 3; k++) {
+      bmin[k] = std::min(bmin[k], bbox[size_t(k)]);
+      bmax[k] = std::max(bmax[k], bbox[size_t(k) + 3]);
+    }
+  }
+
+  // Centerize vertex position.
+  const float center[3] = {0.5f * (bmin[0] + bmax[0]),
+                           0.5f * (bmin[1] + bmax[1]),
+                           0.5f * (bmin[2] + bmax[2])};
+  GetSharedThreadPool().parallel_for(n_chunks, [&](size_t chunk) {
+    const size_t begin = chunk * kChunkSize;
+    const size_t end = std::min(n, begin + kChunkSize);
+    for (size_t i = begin; i < end; i++) {
+      v[3 * i + 0] -= center[0];
+      v[3 * i + 1] -= center[1];
+      v[3 * i + 2] -= center[2];
+    }
+  });
 
-#endif
+  return true;
 }
 
 } // namespace prnet
@@ -7,7 +7,11 @@
 
 namespace prnet {
 
-void FrontalizeFaceMesh(Mesh *front_mesh, const FaceData &face_data);
+///
+/// Transforms the vertices of `front_mesh` to the frontal pose of the canonical
+/// vertices(least squares affine fit). Returns false on error.
+///
+bool FrontalizeFaceMesh(Mesh *front_mesh, const FaceData &face_data);
 
 } // namespace prnet
 
@@ -243,6 +243,11 @@ static void BuildCameraFrame(float3* origin, float3* corner, float3* u, float3*
 bool Renderer::BuildBVH() {
   std::cout << "[Build BVH] " << std::endl;
 
+  if (!mesh_.topology) {
+    std::cerr << "Mesh has no topology." << std::endl;
+    return false;
+  }
+
   nanort::BVHBuildOptions<float> build_options;  // Use default option
   build_options.cache_bbox = false;
 
@@ -253,13 +258,13 @@ bool Renderer::BuildBVH() {
   auto t_start = std::chrono::system_clock::now();
 
   nanort::TriangleMesh<float> triangle_mesh(
-      mesh_.vertices.data(), mesh_.faces.data(), sizeof(float) * 3);
+      mesh_.vertices.data(), mesh_.topology->faces.data(), sizeof(float) * 3);
   nanort::TriangleSAHPred<float> triangle_pred(
-      mesh_.vertices.data(), mesh_.faces.data(), sizeof(float) * 3);
+      mesh_.vertices.data(), mesh_.topology->faces.data(), sizeof(float) * 3);
 
-  printf("num_triangles = %lu\n", mesh_.faces.size() / 3);
+  printf("num_triangles = %lu\n", mesh_.num_faces());
 
-  bool ret = gAccel.Build(uint32_t(mesh_.faces.size() / 3), triangle_mesh, triangle_pred,
+  bool ret = gAccel.Build(uint32_t(mesh_.num_faces()), triangle_mesh, triangle_pred,
                           build_options);
   (void) ret;
   assert(ret);
@@ -289,6 +294,10 @@ bool Renderer::Render(RenderBuffer* buffer, float quat[4],
     return false;
   }
 
+  const std::vector<uint32_t> &faces = mesh_.topology->faces;
+  const std::vector<float> &uvs = mesh_.topology->uvs;
+  const std::vector<float> &normals = mesh_.normals;
+
   int width = config.width;
   int height = config.height;
 
@@ -372,7 +381,7 @@ bool Renderer::Render(RenderBuffer* buffer, float quat[4],
           }
 
           nanort::TriangleIntersector<> triangle_intersector(
-              mesh_.vertices.data(), mesh_.faces.data(), sizeof(float) * 3);
+              mesh_.vertices.data(), mesh_.topology->faces.data(), sizeof(float) * 3);
           nanort::TriangleIntersection<float> isect;
           bool hit = gAccel.Traverse(ray, triangle_intersector, &isect);
           if (hit) {
@@ -391,9 +400,9 @@ bool Renderer::Render(RenderBuffer* buffer, float quat[4],
             float3 N;
             {
               unsigned int f0, f1, f2;
-              f0 = mesh_.faces[3 * prim_id + 0];
-              f1 = mesh_.faces[3 * prim_id + 1];
-              f2 = mesh_.faces[3 * prim_id + 2];
+              f0 = faces[3 * prim_id + 0];
+              f1 = faces[3 * prim_id + 1];
+              f2 = faces[3 * prim_id + 2];
 
               float3 v0, v1, v2;
               v0[0] = mesh_.vertices[3 * f0 + 0];
@@ -405,7 +414,15 @@ bool Renderer::Render(RenderBuffer* buffer, float quat[4],
               v2[0] = mesh_.vertices[3 * f2 + 0];
               v2[1] = mesh_.vertices[3 * f2 + 1];
               v2[2] = mesh_.vertices[3 * f2 + 2];
-              CalcNormal(N, v0, v1, v2);
+              if (normals.size() == mesh_.vertices.size()) {
+                // Interpolate vertex normals.
+                float3 n0(&normals[3 * f0]);
+                float3 n1(&normals[3 * f1]);
+                float3 n2(&normals[3 * f2]);
+                N = vnormalize(Lerp3(n0, n1, n2, isect.u, isect.v));
+              } else {
+                CalcNormal(N, v0, v1, v2);
+              }
             }
 
             buffer->normal[4 * pidx + 0] = 0.5f * N[0] + 0.5f;
@@ -419,19 +436,19 @@ bool Renderer::Render(RenderBuffer* buffer, float quat[4],
             buffer->depth[4 * pidx + 3] = 1.0f;
 
             float3 UV;
-            if (mesh_.uvs.size() > 0) {
+            if (uvs.size() > 0) {
               float3 uv0, uv1, uv2;
               uint32_t v0, v1, v2;
-              v0 = mesh_.faces[3 * prim_id + 0];
-              v1 = mesh_.faces[3 * prim_id + 1];
-              v2 = mesh_.faces[3 * prim_id + 2];
-
-              uv0[0] = mesh_.uvs[2 * v0 + 0];
-              uv0[1] = mesh_.uvs[2 * v0 + 1];
-              uv1[0] = mesh_.uvs[2 * v1 + 0];
-              uv1[1] = mesh_.uvs[2 * v1 + 1];
-              uv2[0] = mesh_.uvs[2 * v2 + 0];
-              uv2[1] = mesh_.uvs[2 * v2 + 1];
+              v0 = faces[3 * prim_id + 0];
+              v1 = faces[3 * prim_id + 1];
+              v2 = faces[3 * prim_id + 2];
+
+              uv0[0] = uvs[2 * v0 + 0];
+              uv0[1] = uvs[2 * v0 + 1];
+              uv1[0] = uvs[2 * v1 + 0];
+              uv1[1] = uvs[2 * v1 + 1];
+              uv2[0] = uvs[2 * v2 + 0];
+              uv2[1] = uvs[2 * v2 + 1];
 
               UV = Lerp3(uv0, uv1, uv2, isect.u, isect.v);
 
@@ -15,9 +15,7 @@ class Renderer {
 
   /// Set mesh
   void SetMesh(const prnet::Mesh &mesh) {
-    mesh_.vertices = mesh.vertices;
-    mesh_.faces = mesh.faces;
-    mesh_.uvs = mesh.uvs;
+    mesh_ = mesh;  // topology is shared.
   }
 
   /// Set Image
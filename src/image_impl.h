@@ -9,7 +9,7 @@ void Image<T>::create(size_t w, size_t h, size_t c) {
 template <typename T>
 void Image<T>::create(size_t w, size_t h, size_t c, const T* d) {
   create(w, h, c);
-  std::copy(data.begin(), data.end(), d);
+  std::copy(d, d + w * h * c, data.begin());
 }
 
 template <typename T>
@@ -0,0 +1,432 @@
+#include "image_warp.h"
+#include "thread_pool.h"
+
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+namespace prnet {
+
+namespace {
+
+// Precomputed 1D filter taps for one axis of a separable resampling.
+// Destination sample `i` reads `count[i]` source samples starting at
+// `start[i]` with weights `weights[i * max_taps + k]`.
+struct FilterTaps {
+  std::vector<int> start;
+  std::vector<int> count;
+  std::vector<float> weights;
+  int max_taps = 0;
+};
+
+// Builds taps of the tent filter for destination samples located at
+// `origin + step * i` in the source.
+// The filter is a bilinear(radius 1) filter for magnification, and is widened
+// to the footprint of a destination sample for minification(area averaging).
+// Samples outside of the source area [-0.5, src_n - 0.5] have no taps(= 0).
+// For the others, taps outside of [0, src_n) are dropped and the weights are
+// normalized over the remaining taps(see `WarpAffine`).
+void BuildFilterTaps(const float origin, const float step, const size_t dst_n,
+                     const size_t src_n, FilterTaps *taps) {
+  const float radius = std::max(1.0f, std::fabs(step));
+  const float inv_radius = 1.0f / radius;
+  taps->max_taps = 2 * int(std::ceil(radius)) + 1;
+  taps->start.assign(dst_n, 0);
+  taps->count.assign(dst_n, 0);
+  taps->weights.assign(dst_n * size_t(taps->max_taps), 0.0f);
+
+  for (size_t i = 0; i < dst_n; i++) {
+    const float center = origin + step * float(i);
+    if (!(center >= -0.5f) || !(center <= float(src_n) - 0.5f)) {
+      continue;
+    }
+    const int t0 = int(std::floor(center - radius)) + 1;
+    const int t1 = int(std::ceil(center + radius)) - 1;
+    const int s0 = std::max(t0, 0);
+    const int s1 = std::min(t1, int(src_n) - 1);
+    if (s0 > s1) {
+      continue;
+    }
+
+    float weight_sum = 0.0f;
+    for (int t = s0; t <= s1; t++) {
+      weight_sum += std::max(0.0f, 1.0f - std::fabs(float(t) - center) * inv_radius);
+    }
+    if (weight_sum <= 0.0f) {
+      continue;
+    }
+
+    float *w = &taps->weights[i * size_t(taps->max_taps)];
+    for (int t = s0; t <= s1; t++) {
+      w[t - s0] = std::max(0.0f, 1.0f - std::fabs(float(t) - center) * inv_radius) /
+                  weight_sum;
+    }
+    taps->start[i] = s0;
+    taps->count[i] = s1 - s0 + 1;
+  }
+}
+
+// Separable resampling for axis aligned transforms(m[1] == m[3] == 0).
+void WarpSeparable(const Image<float> &src, const AffineTransform &xform,
+                   size_t dst_width, size_t dst_height, float *dst) {
+  const size_t src_width = src.getWidth();
+  const size_t src_height = src.getHeight();
+  const size_t channels = src.getChannels();
+  const size_t dst_stride = dst_width * channels;
+
+  FilterTaps xtaps, ytaps;
+  BuildFilterTaps(xform.m[2], xform.m[0], dst_width, src_width, &xtaps);
+  BuildFilterTaps(xform.m[5], xform.m[4], dst_height, src_height, &ytaps);
+
+  // Range of source columns referenced by the horizontal filter.
+  int col_begin = int(src_width), col_end = 0;
+  for (size_t x = 0; x < dst_width; x++) {
+    if (xtaps.count[x] > 0) {
+      col_begin = std::min(col_begin, xtaps.start[x]);
+      col_end = std::max(col_end, xtaps.start[x] + xtaps.count[x]);
+    }
+  }
+
+  std::fill(dst, dst + dst_height * dst_stride, 0.0f);
+  if (col_begin >= col_end) {
+    return;
+  }
+
+  const size_t span = size_t(col_end - col_begin) * channels;
+  const size_t src_stride = src_width * channels;
+  const float *src_data = src.getData() + size_t(col_begin) * channels;
+  std::vector<float> row(span);
+
+  for (size_t y = 0; y < dst_height; y++) {
+    if (ytaps.count[y] == 0) {
+      continue;
+    }
+
+    // Vertical pass over the referenced columns. Accumulates contiguous rows
+    // so the inner loop is a simple multiply-add.
+    const float *wy = &ytaps.weights[y * size_t(ytaps.max_taps)];
+    std::fill(row.begin(), row.end(), 0.0f);
+    float *r = row.data();
+    for (int k = 0; k < ytaps.count[y]; k++) {
+      const float wk = wy[k];
+      const float *s = src_data + size_t(ytaps.start[y] + k) * src_stride;
+      for (size_t i = 0; i < span; i++) {
+        r[i] += wk * s[i];
+      }
+    }
+
+    // Horizontal pass.
+    float *d = dst + y * dst_stride;
+    for (size_t x = 0; x < dst_width; x++, d += channels) {
+      const float *wx = &xtaps.weights[x * size_t(xtaps.max_taps)];
+      const float *s = r + size_t(xtaps.start[x] - col_begin) * channels;
+      for (int k = 0; k < xtaps.count[x]; k++) {
+        for (size_t c = 0; c < channels; c++) {
+          d[c] += wx[k] * s[size_t(k) * channels + c];
+        }
+      }
+    }
+  }
+}
+
+// Box filter `src` in the region [x0, x0 + w * factor) x [y0, y0 + h * factor)
+// by `factor`. Texels outside of `src` are excluded from the average.
+void BoxDownsample(const Image<float> &src, int x0, int y0, size_t w, size_t h,
+                   int factor, Image<float> *dst) {
+  const int src_width = int(src.getWidth());
+  const int src_height = int(src.getHeight());
+  const size_t channels = src.getChannels();
+  const float *src_data = src.getData();
+
+  dst->create(w, h, channels);
+  float *dst_data = dst->getData();
+
+  // Columns of the region which lie inside of `src`.
+  const int cx0 = std::max(0, x0);
+  const int cx1 = std::min(src_width, x0 + int(w) * factor);
+  if (cx0 >= cx1) {
+    std::fill(dst_data, dst_data + w * h * channels, 0.0f);
+    return;
+  }
+  const size_t span = size_t(cx1 - cx0) * channels;
+  std::vector<float> col_sum(span);
+
+  for (size_t j = 0; j < h; j++) {
+    const int sy0 = std::max(0, y0 + int(j) * factor);
+    const int sy1 = std::min(src_height, y0 + int(j + 1) * factor);
+
+    // Sum rows first(contiguous), then sum `factor` columns.
+    std::fill(col_sum.begin(), col_sum.end(), 0.0f);
+    for (int sy = sy0; sy < sy1; sy++) {
+      const float *s = src_data + (size_t(sy) * size_t(src_width) + size_t(cx0)) * channels;
+      for (size_t k = 0; k < span; k++) {
+        col_sum[k] += s[k];
+      }
+    }
+
+    for (size_t i = 0; i < w; i++) {
+      const int sx0 = std::max(cx0, x0 + int(i) * factor);
+      const int sx1 = std::min(cx1, x0 + int(i + 1) * factor);
+      const int n = std::max(0, sx1 - sx0) * std::max(0, sy1 - sy0);
+
+      float *d = dst_data + (j * w + i) * channels;
+      for (size_t c = 0; c < channels; c++) {
+        d[c] = 0.0f;
+      }
+      for (int sx = sx0; sx < sx1; sx++) {
+        const float *s = &col_sum[size_t(sx - cx0) * channels];
+        for (size_t c = 0; c < channels; c++) {
+          d[c] += s[c];
+        }
+      }
+
+      const float inv_n = (n > 0) ? (1.0f / float(n)) : 0.0f;
+      for (size_t c = 0; c < channels; c++) {
+        d[c] *= inv_n;
+      }
+    }
+  }
+}
+
+// Bilinearly samples `src`(`width` x `height` x `channels`) at (`fx`, `fy`).
+// Positions outside of the image area [-0.5, width - 0.5] x [-0.5, height -
+// 0.5] are 0. Near the border, texels outside of the image are dropped and the
+// weights are normalized over the remaining ones.
+inline void SampleBilinear(const float *src, int width, int height,
+                           size_t channels, float fx, float fy, float *d) {
+  const size_t stride = size_t(width) * channels;
+  const float flx = std::floor(fx);
+  const float fly = std::floor(fy);
+  const int x0 = int(flx);
+  const int y0 = int(fly);
+  const float dx = fx - flx;
+  const float dy = fy - fly;
+
+  const float w00 = (1.0f - dx) * (1.0f - dy);
+  const float w10 = dx * (1.0f - dy);
+  const float w01 = (1.0f - dx) * dy;
+  const float w11 = dx * dy;
+
+  if ((x0 >= 0) && (y0 >= 0) && (x0 + 1 < width) && (y0 + 1 < height)) {
+    const float *s0 = src + size_t(y0) * stride + size_t(x0) * channels;
+    const float *s1 = s0 + stride;
+    for (size_t c = 0; c < channels; c++) {
+      d[c] = w00 * s0[c] + w10 * s0[channels + c] + w01 * s1[c] +
+             w11 * s1[channels + c];
+    }
+    return;
+  }
+
+  // Border.
+  for (size_t c = 0; c < channels; c++) {
+    d[c] = 0.0f;
+  }
+  if (!(fx >= -0.5f) || !(fx <= float(width) - 0.5f) || !(fy >= -0.5f) ||
+      !(fy <= float(height) - 0.5f)) {
+    return;
+  }
+  float weight_sum = 0.0f;
+  const int xs[2] = {x0, x0 + 1};
+  const int ys[2] = {y0, y0 + 1};
+  const float ws[2][2] = {{w00, w10}, {w01, w11}};
+  for (int j = 0; j < 2; j++) {
+    if ((ys[j] < 0) || (ys[j] >= height)) {
+      continue;
+    }
+    for (int i = 0; i < 2; i++) {
+      if ((xs[i] < 0) || (xs[i] >= width)) {
+        continue;
+      }
+      const float *p = src + size_t(ys[j]) * stride + size_t(xs[i]) * channels;
+      for (size_t c = 0; c < channels; c++) {
+        d[c] += ws[j][i] * p[c];
+      }
+      weight_sum += ws[j][i];
+    }
+  }
+  if (weight_sum > 0.0f) {
+    const float inv_sum = 1.0f / weight_sum;
+    for (size_t c = 0; c < channels; c++) {
+      d[c] *= inv_sum;
+    }
+  }
+}
+
+// Bilinear sampling for arbitrary affine transforms.
+void WarpBilinear(const Image<float> &src, const AffineTransform &xform,
+                  size_t dst_width, size_t dst_height, float *dst) {
+  const int width = int(src.getWidth());
+  const int height = int(src.getHeight());
+  const size_t channels = src.getChannels();
+  const float *src_data = src.getData();
+  const float *m = xform.m;
+
+  for (size_t y = 0; y < dst_height; y++) {
+    // Source coordinate is advanced incrementally along the row.
+    float fx = m[1] * float(y) + m[2];
+    float fy = m[4] * float(y) + m[5];
+    float *d = dst + y * dst_width * channels;
+    for (size_t x = 0; x < dst_width; x++, fx += m[0], fy += m[3], d += channels) {
+      SampleBilinear(src_data, width, height, channels, fx, fy, d);
+    }
+  }
+}
+
+} // anonymous namespace
+
+AffineTransform MakeCropTransform(float center_x, float center_y, float size,
+                                  size_t dst_width, size_t dst_height) {
+  // Offset of the destination center.
+  const float cx = 0.5f * float(dst_width - 1);
+  const float cy = 0.5f * float(dst_height - 1);
+
+  AffineTransform xform;
+  xform.m[0] = size / float(dst_width);
+  xform.m[4] = size / float(dst_height);
+  xform.m[2] = center_x - xform.m[0] * cx;
+  xform.m[5] = center_y - xform.m[4] * cy;
+
+  return xform;
+}
+
+void WarpAffine(const Image<float> &src, const AffineTransform &xform,
+                size_t dst_width, size_t dst_height, float *dst) {
+  if ((src.getWidth() == 0) || (src.getHeight() == 0)) {
+    std::fill(dst, dst + dst_width * dst_height * src.getChannels(), 0.0f);
+    return;
+  }
+
+  // Exact zeros(no rotation or shear) are classified without float `==`.
+  const float *m = xform.m;
+  if ((std::fpclassify(m[1]) == FP_ZERO) &&
+      (std::fpclassify(m[3]) == FP_ZERO)) {
+    WarpSeparable(src, xform, dst_width, dst_height, dst);
+    return;
+  }
+
+  // Footprint of a destination pixel in the source.
+  const float scale_x = std::sqrt(m[0] * m[0] + m[3] * m[3]);
+  const float scale_y = std::sqrt(m[1] * m[1] + m[4] * m[4]);
+  const int factor = int(std::min(scale_x, scale_y));
+  if (factor < 2) {
+    WarpBilinear(src, xform, dst_width, dst_height, dst);
+    return;
+  }
+
+  // Strong minification: area-average the source region covered by the
+  // destination with `factor`, then bilinearly sample the reduced image.
+  float bmin[2] = {m[2], m[5]};
+  float bmax[2] = {m[2], m[5]};
+  const float corners[3][2] = {{float(dst_width - 1), 0.0f},
+                               {0.0f, float(dst_height - 1)},
+                               {float(dst_width - 1), float(dst_height - 1)}};
+  for (int i = 0; i < 3; i++) {
+    const float px = m[0] * corners[i][0] + m[1] * corners[i][1] + m[2];
+    const float py = m[3] * corners[i][0] + m[4] * corners[i][1] + m[5];
+    bmin[0] = std::min(bmin[0], px);
+    bmin[1] = std::min(bmin[1], py);
+    bmax[0] = std::max(bmax[0], px);
+    bmax[1] = std::max(bmax[1], py);
+  }
+
+  const int margin = 2 * factor;
+  const int x0 = std::max(0, int(std::floor(bmin[0])) - margin);
+  const int y0 = std::max(0, int(std::floor(bmin[1])) - margin);
+  const int x1 = std::min(int(src.getWidth()), int(std::ceil(bmax[0])) + margin);
+  const int y1 = std::min(int(src.getHeight()), int(std::ceil(bmax[1])) + margin);
+  if ((x0 >= x1) || (y0 >= y1)) {
+    std::fill(dst, dst + dst_width * dst_height * src.getChannels(), 0.0f);
+    return;
+  }
+
+  Image<float> reduced;
+  BoxDownsample(src, x0, y0, size_t((x1 - x0 + factor - 1) / factor),
+                size_t((y1 - y0 + factor - 1) / factor), factor, &reduced);
+
+  // Source pixel(sx, sy) corresponds to
+  // ((sx - x0 - 0.5 * (factor - 1)) / factor, ...) in the reduced image.
+  const float inv_factor = 1.0f / float(factor);
+  const float offset = 0.5f * float(factor - 1);
+  AffineTransform reduced_xform;
+  for (int i = 0; i < 2; i++) {
+    reduced_xform.m[0 + 3 * i] = m[0 + 3 * i] * inv_factor;
+    reduced_xform.m[1 + 3 * i] = m[1 + 3 * i] * inv_factor;
+  }
+  reduced_xform.m[2] = (m[2] - float(x0) - offset) * inv_factor;
+  reduced_xform.m[5] = (m[5] - float(y0) - offset) * inv_factor;
+
+  WarpBilinear(reduced, reduced_xform, dst_width, dst_height, dst);
+}
+
+void WarpAffine(const Image<float> &src, const AffineTransform &xform,
+                size_t dst_width, size_t dst_height, Image<float> *dst) {
+  dst->create(dst_width, dst_height, src.getChannels());
+  WarpAffine(src, xform, dst_width, dst_height, dst->getData());
+}
+
+bool RemapBilinear(const Image<float> &src, const Image<float> &pos_map,
+                   float scale, float shift_x, float shift_y,
+                   size_t dst_width, size_t dst_height, Image<float> *dst) {
+  const size_t pos_width = pos_map.getWidth();
+  const size_t pos_height = pos_map.getHeight();
+  if ((pos_width == 0) || (pos_height == 0) || (pos_map.getChannels() < 2)) {
+    std::cerr << "Invalid position map : " << pos_width << " x " << pos_height
+              << " x " << pos_map.getChannels() << std::endl;
+    return false;
+  }
+
+  const size_t channels = src.getChannels();
+  dst->create(dst_width, dst_height, channels);
+
+  // Position map coordinate of each destination column(pixel centers are
+  // aligned).
+  std::vector<int> col_x0(dst_width);
+  std::vector<float> col_dx(dst_width);
+  const float sx = float(pos_width) / float(dst_width);
+  const int max_x0 = std::max(0, int(pos_width) - 2);
+  for (size_t x = 0; x < dst_width; x++) {
+    const float fx = std::max(0.0f, std::min(float(pos_width - 1),
+                                             (float(x) + 0.5f) * sx - 0.5f));
+    col_x0[x] = std::min(int(fx), max_x0);
+    col_dx[x] = fx - float(col_x0[x]);
+  }
+  const size_t x1_offset = (pos_width > 1) ? 1 : 0;
+  const size_t y1_offset = (pos_height > 1) ? 1 : 0;
+
+  const int src_width = int(src.getWidth());
+  const int src_height = int(src.getHeight());
+  const float *src_data = src.getData();
+  const size_t pos_channels = pos_map.getChannels();
+  const float *pos_data = pos_map.getData();
+  const float sy = float(pos_height) / float(dst_height);
+
+  GetSharedThreadPool().parallel_for(dst_height, [&](size_t y) {
+    const float fy = std::max(0.0f, std::min(float(pos_height - 1),
+                                             (float(y) + 0.5f) * sy - 0.5f));
+    const size_t y0 = std::min(size_t(fy), pos_height - 1 - y1_offset);
+    const float dy = fy - float(y0);
+    const float *row0 = pos_data + y0 * pos_width * pos_channels;
+    const float *row1 = row0 + y1_offset * pos_width * pos_channels;
+
+    float *d = dst->getData() + y * dst_width * channels;
+    for (size_t x = 0; x < dst_width; x++, d += channels) {
+      // Position(2D) at the texel.
+      const size_t i0 = size_t(col_x0[x]) * pos_channels;
+      const size_t i1 = i0 + x1_offset * pos_channels;
+      const float dx = col_dx[x];
+      const float px0 = row0[i0 + 0] + dx * (row0[i1 + 0] - row0[i0 + 0]);
+      const float py0 = row0[i0 + 1] + dx * (row0[i1 + 1] - row0[i0 + 1]);
+      const float px1 = row1[i0 + 0] + dx * (row1[i1 + 0] - row1[i0 + 0]);
+      const float py1 = row1[i0 + 1] + dx * (row1[i1 + 1] - row1[i0 + 1]);
+      const float px = px0 + dy * (px1 - px0);
+      const float py = py0 + dy * (py1 - py0);
+
+      SampleBilinear(src_data, src_width, src_height, channels,
+                     scale * px + shift_x, scale * py + shift_y, d);
+    }
+  });
+
+  return true;
+}
+
+} // namespace prnet
@@ -0,0 +1,66 @@
+#ifndef PRNET_INFER_IMAGE_WARP_H_
+#define PRNET_INFER_IMAGE_WARP_H_
+
+#include "image.h"
+
+namespace prnet {
+
+///
+/// 2x3 affine transform which maps a destination pixel to source pixel
+/// coordinate. Pixel centers are located at integer coordinates.
+///
+///   src_x = m[0] * x + m[1] * y + m[2]
+///   src_y = m[3] * x + m[4] * y + m[5]
+///
+struct AffineTransform {
+  float m[6] = {1.f, 0.f, 0.f, 0.f, 1.f, 0.f};
+};
+
+///
+/// Builds a transform which maps `dst_width` x `dst_height` pixels to the
+/// axis aligned square centered at (`center_x`, `center_y`) with `size` pixels
+/// extent in the source image. Crops are axis aligned since `CropParam` maps
+/// them back with a scale and a shift only.
+///
+AffineTransform MakeCropTransform(float center_x, float center_y, float size,
+                                  size_t dst_width, size_t dst_height);
+
+///
+/// Warps `src` into `dst`(`dst_width` x `dst_height` x src channels, tightly
+/// packed).
+///
+/// Destination pixels which map outside of the source area(pixels are squares
+/// around their centers, i.e. [-0.5, width - 0.5] x [-0.5, height - 0.5]) are
+/// 0. Inside, filter taps falling outside of `src` are dropped and the weights
+/// are normalized over the remaining taps, so the border of the image is not
+/// darkened by the zeros outside.
+///
+/// Bilinear interpolation is used for magnification. For minification the
+/// source is area-averaged so that crops from large images do not alias.
+/// Axis aligned transforms take a separable path with precomputed row/column
+/// weights.
+///
+void WarpAffine(const Image<float> &src, const AffineTransform &xform,
+                size_t dst_width, size_t dst_height, float *dst);
+
+void WarpAffine(const Image<float> &src, const AffineTransform &xform,
+                size_t dst_width, size_t dst_height, Image<float> *dst);
+
+///
+/// Creates `dst`(`dst_width` x `dst_height` x src channels) by bilinearly
+/// sampling `src` at the positions in the first two channels of `pos_map`
+/// (like cv2.remap). `pos_map` is bilinearly resampled to the resolution of
+/// `dst`, and positions are transformed on the fly:
+///
+///   x = scale * pos_x + shift_x
+///   y = scale * pos_y + shift_y
+///
+/// Borders are handled as `WarpAffine`. Returns false on invalid input.
+///
+bool RemapBilinear(const Image<float> &src, const Image<float> &pos_map,
+                   float scale, float shift_x, float shift_y,
+                   size_t dst_width, size_t dst_height, Image<float> *dst);
+
+} // namespace prnet
+
+#endif // PRNET_INFER_IMAGE_WARP_H_
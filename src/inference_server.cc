@@ -0,0 +1,432 @@
+#include "inference_server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#if !defined(_WIN32)
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace prnet {
+
+void ServerResponse::set_external_buffer(unsigned char *data,
+                                         size_t capacity) {
+  external = data;
+  external_capacity = capacity;
+  size = 0;
+}
+
+void ServerResponse::reset() {
+  header = ServerResponseHeader();
+  buffer.clear();
+  size = 0;
+  overflow = false;
+}
+
+void ServerResponse::set_error(uint32_t status, const std::string &message) {
+  header.status = status;
+  header.n_faces = 0;
+  buffer.clear();
+  size = 0;
+  // The message is truncated to the external buffer.
+  append_bytes(message.data(),
+               external ? std::min(message.size(), external_capacity)
+                        : message.size());
+}
+
+bool ServerResponse::append_bytes(const void *data, size_t bytes) {
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  if (!external) {
+    buffer.insert(buffer.end(), p, p + bytes);
+  } else if (bytes > external_capacity - size) {
+    overflow = true;
+    return false;
+  } else {
+    memcpy(external + size, p, bytes);
+  }
+  size += bytes;
+  return true;
+}
+
+#if defined(_WIN32)
+
+InferenceServer::InferenceServer() {}
+InferenceServer::~InferenceServer() {}
+
+bool InferenceServer::start(const InferenceServerOptions &,
+                            const ServerHandler &) {
+  std::cerr << "Server mode is not supported on this platform." << std::endl;
+  return false;
+}
+
+void InferenceServer::run() {}
+void InferenceServer::stop() {}
+
+#else
+
+namespace {
+
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0  // SO_NOSIGPIPE is set instead(macOS).
+#endif
+
+// Reads exactly `size` bytes. Returns false on error or EOF.
+bool ReadAll(int fd, void *data, size_t size) {
+  unsigned char *p = static_cast<unsigned char *>(data);
+  while (size > 0) {
+    const ssize_t n = read(fd, p, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= size_t(n);
+  }
+  return true;
+}
+
+bool WriteAll(int fd, const void *data, size_t size) {
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  while (size > 0) {
+    // MSG_NOSIGNAL: a closed connection is an error, not SIGPIPE.
+    const ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= size_t(n);
+  }
+  return true;
+}
+
+bool WriteResponse(int fd, ServerResponse *response) {
+  response->header.payload_size = uint32_t(response->payload_size());
+  return WriteAll(fd, &response->header, sizeof(ServerResponseHeader)) &&
+         WriteAll(fd, response->payload(), response->payload_size());
+}
+
+void CloseFd(int *fd) {
+  if (*fd >= 0) {
+    close(*fd);
+    *fd = -1;
+  }
+}
+
+// Removes the socket file left by a previous server at `path`. Fails if
+// `path` is not a socket(e.g. a regular file given by mistake) or a server
+// still accepts connections on it.
+bool RemoveStaleSocket(const std::string &path, const sockaddr_un &addr) {
+  struct stat st;
+  if (lstat(path.c_str(), &st) != 0) {
+    if (errno == ENOENT) {
+      return true;
+    }
+    std::cerr << "Failed to stat " << path << " : " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  if (!S_ISSOCK(st.st_mode)) {
+    std::cerr << "Not a socket(refused to overwrite) : " << path << std::endl;
+    return false;
+  }
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    std::cerr << "Failed to create socket : " << strerror(errno) << std::endl;
+    return false;
+  }
+  const bool alive =
+      connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) ==
+      0;
+  close(fd);
+  if (alive) {
+    std::cerr << "Another server is listening on " << path << std::endl;
+    return false;
+  }
+
+  if ((unlink(path.c_str()) != 0) && (errno != ENOENT)) {
+    std::cerr << "Failed to remove " << path << " : " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Returns the listening socket, and the inode of the socket file in `st`.
+int OpenUnixSocket(const std::string &path, struct stat *st) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  if (path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Socket path too long : " << path << std::endl;
+    return -1;
+  }
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path.c_str(), path.size());
+
+  if (!RemoveStaleSocket(path, addr)) {
+    return -1;
+  }
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    std::cerr << "Failed to create socket : " << strerror(errno) << std::endl;
+    return -1;
+  }
+  if ((bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) ||
+      (listen(fd, SOMAXCONN) != 0) || (lstat(path.c_str(), st) != 0)) {
+    std::cerr << "Failed to listen on " << path << " : " << strerror(errno)
+              << std::endl;
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int OpenTcpSocket(int port) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    std::cerr << "Failed to create socket : " << strerror(errno) << std::endl;
+    return -1;
+  }
+  const int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(uint16_t(port));
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) ||
+      (listen(fd, SOMAXCONN) != 0)) {
+    std::cerr << "Failed to listen on port " << port << " : "
+              << strerror(errno) << std::endl;
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+} // namespace
+
+InferenceServer::InferenceServer() {}
+
+InferenceServer::~InferenceServer() {
+  join_finished(/* all */ true);
+  CloseFd(&wakeup_fds[0]);
+  CloseFd(&wakeup_fds[1]);
+  CloseFd(&tcp_fd);
+  if (unix_fd >= 0) {
+    CloseFd(&unix_fd);
+    // Remove the socket file only if it is still ours(not replaced).
+    struct stat st;
+    if ((lstat(options.unix_socket_path.c_str(), &st) == 0) &&
+        S_ISSOCK(st.st_mode) && (st.st_dev == unix_socket_dev) &&
+        (st.st_ino == unix_socket_ino)) {
+      unlink(options.unix_socket_path.c_str());
+    }
+  }
+}
+
+bool InferenceServer::start(const InferenceServerOptions &_options,
+                            const ServerHandler &_handler) {
+  options = _options;
+  handler = _handler;
+
+  if (options.unix_socket_path.empty() && (options.tcp_port <= 0)) {
+    std::cerr << "Neither Unix socket nor TCP port is specified." << std::endl;
+    return false;
+  }
+
+  if (pipe(wakeup_fds) != 0) {
+    std::cerr << "Failed to create pipe : " << strerror(errno) << std::endl;
+    return false;
+  }
+  fcntl(wakeup_fds[1], F_SETFL, O_NONBLOCK);
+
+  if (!options.unix_socket_path.empty()) {
+    struct stat st;
+    unix_fd = OpenUnixSocket(options.unix_socket_path, &st);
+    if (unix_fd < 0) {
+      return false;
+    }
+    unix_socket_dev = uint64_t(st.st_dev);
+    unix_socket_ino = uint64_t(st.st_ino);
+    std::cout << "Listening on " << options.unix_socket_path << std::endl;
+  }
+  if (options.tcp_port > 0) {
+    tcp_fd = OpenTcpSocket(options.tcp_port);
+    if (tcp_fd < 0) {
+      return false;
+    }
+    std::cout << "Listening on 127.0.0.1:" << options.tcp_port << std::endl;
+  }
+  return true;
+}
+
+void InferenceServer::run() {
+  for (;;) {
+    pollfd fds[3];
+    nfds_t n_fds = 0;
+    fds[n_fds].fd = wakeup_fds[0];
+    fds[n_fds++].events = POLLIN;
+    if (unix_fd >= 0) {
+      fds[n_fds].fd = unix_fd;
+      fds[n_fds++].events = POLLIN;
+    }
+    if (tcp_fd >= 0) {
+      fds[n_fds].fd = tcp_fd;
+      fds[n_fds++].events = POLLIN;
+    }
+
+    if (poll(fds, n_fds, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "poll failed : " << strerror(errno) << std::endl;
+      break;
+    }
+    if (fds[0].revents != 0) {
+      break;  // stop
+    }
+    // Reap finished connections first, so they do not count toward
+    // `max_connections`.
+    join_finished(/* all */ false);
+    for (nfds_t i = 1; i < n_fds; i++) {
+      if (fds[i].revents & POLLIN) {
+        accept_connection(fds[i].fd);
+      }
+    }
+  }
+
+  join_finished(/* all */ true);
+}
+
+void InferenceServer::stop() {
+  if (wakeup_fds[1] < 0) {
+    return;  // not started
+  }
+  // Keep errno of the interrupted code when called from a signal handler.
+  const int saved_errno = errno;
+  const char c = 0;
+  if (write(wakeup_fds[1], &c, 1) < 0) {
+    // The pipe is full, i.e. already stopped.
+  }
+  errno = saved_errno;
+}
+
+void InferenceServer::accept_connection(int listen_fd) {
+  const int fd = accept(listen_fd, nullptr, nullptr);
+  if (fd < 0) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  // Connections which finished after `join_finished` are not counted.
+  size_t n_active = 0;
+  for (const auto &connection : connections) {
+    n_active += connection->done ? 0 : 1;
+  }
+  if (n_active >= options.max_connections) {
+    std::cerr << "Too many connections. Rejected." << std::endl;
+    close(fd);
+    return;
+  }
+#if defined(SO_NOSIGPIPE)
+  const int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+  if (listen_fd == tcp_fd) {
+    // Responses are written in a few calls. Do not delay them.
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+
+  connections.emplace_back(new Connection());
+  Connection *connection = connections.back().get();
+  connection->fd = fd;
+  connection->thread = std::thread([this, connection]() { serve(connection); });
+}
+
+void InferenceServer::serve(Connection *connection) {
+  const int fd = connection->fd;
+  std::vector<unsigned char> payload;
+  ServerRequest request;
+  ServerResponse response;
+  for (;;) {
+    if (!ReadAll(fd, &request.header, sizeof(ServerRequestHeader))) {
+      break;  // closed
+    }
+
+    response.reset();
+    const ServerRequestHeader &header = request.header;
+    if ((header.magic != kServerRequestMagic) ||
+        (header.version != kServerProtocolVersion) ||
+        (header.payload_size > options.max_payload_size)) {
+      // The stream can not be parsed any more.
+      response.set_error(kServerStatusBadRequest, "Invalid request header");
+      WriteResponse(fd, &response);
+      break;
+    }
+
+    payload.resize(header.payload_size);
+    if (!ReadAll(fd, payload.data(), payload.size())) {
+      break;
+    }
+    request.payload = payload.data();
+
+    const bool keep = handler(request, &response);
+    if (!WriteResponse(fd, &response) || !keep) {
+      break;
+    }
+  }
+
+  // The socket is closed by `join_finished`, so that it is not reused while
+  // being shut down. `join_finished` runs only when `run` wakes up(e.g. on
+  // the next connection), so the client is notified of the end of the
+  // connection here.
+  shutdown(fd, SHUT_RDWR);
+  connection->done = true;
+}
+
+void InferenceServer::join_finished(bool all) {
+  std::list<std::unique_ptr<Connection>> finished;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = connections.begin(); it != connections.end();) {
+      if (all || (*it)->done) {
+        if (!(*it)->done) {
+          // Wakes up the thread blocked in reading a request. The socket is
+          // closed below after the thread is joined.
+          shutdown((*it)->fd, SHUT_RDWR);
+        }
+        finished.push_back(std::move(*it));
+        it = connections.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  for (auto &connection : finished) {
+    connection->thread.join();
+    close(connection->fd);
+  }
+}
+
+#endif
+
+} // namespace prnet
@@ -0,0 +1,197 @@
+#ifndef PRNET_INFER_INFERENCE_SERVER_H_
+#define PRNET_INFER_INFERENCE_SERVER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace prnet {
+
+// Binary protocol of the server. A client sends a request(header and payload)
+// and receives a response(header and payload), repeatedly on a connection.
+// All fields are little endian(clients are on the same host).
+
+const uint32_t kServerRequestMagic = 0x514e5250;   // "PRNQ"
+const uint32_t kServerResponseMagic = 0x524e5250;  // "PRNR"
+const uint32_t kServerProtocolVersion = 1;
+
+enum ServerRequestType : uint32_t {
+  // Payload is an encoded image file(JPEG, PNG, ...).
+  kServerRequestEncodedImage = 0,
+  // Payload is 8bit pixels(`width` x `height` x `channels`, RGB or RGBA).
+  kServerRequestRawImage = 1,
+  // Returns the triangles(3 x uint32 each) of the mesh. No payload.
+  kServerRequestTopology = 2,
+};
+
+// Bits of `outputs` of a request.
+enum ServerOutputFlags : uint32_t {
+  kServerOutputLandmarks = 1,  // n_landmarks x 3 floats per face
+  kServerOutputPosmap = 2,     // posmap_size x posmap_size x 3 floats per face
+  kServerOutputVertices = 4,   // n_vertices x 3 floats per face
+};
+
+enum ServerStatus : uint32_t {
+  kServerStatusOk = 0,
+  kServerStatusBadRequest = 1,  // Payload is the error message.
+  kServerStatusFailed = 2,      // Payload is the error message.
+};
+
+struct ServerRequestHeader {
+  uint32_t magic = kServerRequestMagic;
+  uint32_t version = kServerProtocolVersion;
+  uint32_t type = kServerRequestEncodedImage;
+  uint32_t outputs = 0;
+  uint32_t width = 0;  // raw image only
+  uint32_t height = 0;
+  uint32_t channels = 0;
+  uint32_t payload_size = 0;  // bytes
+};
+
+// Payload of an image request is the outputs of each face, in the order of
+// landmarks, position map and vertices(only requested ones). Positions are in
+// the pixel coordinate of the input image.
+struct ServerResponseHeader {
+  uint32_t magic = kServerResponseMagic;
+  uint32_t version = kServerProtocolVersion;
+  uint32_t status = kServerStatusOk;
+  // 0 with `kServerStatusOk` when no face is detected. Unlike the command
+  // line, the server does not fall back to the image center(a mesh of a
+  // non-face is not useful to clients). With `--detector none`, the image
+  // center is always cropped and this is 1.
+  uint32_t n_faces = 0;
+  uint32_t n_landmarks = 0;
+  uint32_t posmap_size = 0;
+  uint32_t n_vertices = 0;
+  uint32_t payload_size = 0;  // bytes
+};
+
+static_assert(sizeof(ServerRequestHeader) == 32, "unexpected padding");
+static_assert(sizeof(ServerResponseHeader) == 32, "unexpected padding");
+
+struct ServerRequest {
+  ServerRequestHeader header;
+  const unsigned char *payload = nullptr;  // `header.payload_size` bytes
+};
+
+///
+/// Response of a request. The payload is written to `buffer`, or to an
+/// external buffer(e.g. a shared memory slot, see `shm_ring.h`) without
+/// copies.
+///
+class ServerResponse {
+public:
+  ServerResponseHeader header;
+  std::vector<unsigned char> buffer;
+
+  // Writes the payload to `data`(`capacity` bytes) instead of `buffer`.
+  void set_external_buffer(unsigned char *data, size_t capacity);
+
+  // Clears the header and the payload.
+  void reset();
+
+  // Sets the error status and message.
+  void set_error(uint32_t status, const std::string &message);
+
+  // Appends `size` bytes to the payload. Returns false if they exceed the
+  // external buffer, which is reported by `overflowed`.
+  bool append_bytes(const void *data, size_t size);
+
+  // Appends `n` values to the payload.
+  template <typename T>
+  bool append(const T *data, size_t n) {
+    return append_bytes(data, n * sizeof(T));
+  }
+
+  const unsigned char *payload() const {
+    return external ? external : buffer.data();
+  }
+  size_t payload_size() const { return size; }
+  bool overflowed() const { return overflow; }
+
+private:
+  unsigned char *external = nullptr;
+  size_t external_capacity = 0;
+  size_t size = 0;
+  bool overflow = false;
+};
+
+// Fills the response for the request. The status of the response is already
+// `kServerStatusOk` when called. Returns false to close the connection. Shared
+// by all transports, and called concurrently.
+typedef std::function<bool(const ServerRequest &request,
+                           ServerResponse *response)>
+    ServerHandler;
+
+struct InferenceServerOptions {
+  std::string unix_socket_path;  // empty = disabled
+  int tcp_port = 0;              // on localhost. 0 = disabled
+  size_t max_connections = 16;
+  uint32_t max_payload_size = 64 * 1024 * 1024;  // bytes
+};
+
+///
+/// Serves inference requests on a Unix domain socket and/or a localhost TCP
+/// port.
+///
+/// Each connection is handled by its own thread, which calls the handler for
+/// each request. The handler is called concurrently, so it must be thread
+/// safe(e.g. run the network through a `BatchScheduler`, which also batches
+/// faces of concurrent requests). Resources such as the model are owned by the
+/// caller and stay resident while serving.
+///
+/// POSIX only. `start` fails on other platforms.
+///
+class InferenceServer {
+public:
+  InferenceServer();
+  ~InferenceServer();
+
+  InferenceServer(const InferenceServer &) = delete;
+  InferenceServer &operator=(const InferenceServer &) = delete;
+
+  // Opens the listening sockets. Returns false on error.
+  bool start(const InferenceServerOptions &options,
+             const ServerHandler &handler);
+
+  // Accepts connections until `stop` is called. Then closes the connections
+  // and waits for their threads.
+  void run();
+
+  // Makes `run` return. Async signal safe, so it can be called from a signal
+  // handler.
+  void stop();
+
+private:
+  struct Connection {
+    int fd = -1;
+    std::thread thread;
+    std::atomic<bool> done{false};
+  };
+
+  void accept_connection(int listen_fd);
+  void serve(Connection *connection);
+  void join_finished(bool all);
+
+  InferenceServerOptions options;
+  ServerHandler handler;
+
+  int unix_fd = -1;
+  int tcp_fd = -1;
+  uint64_t unix_socket_dev = 0;  // to remove only our own socket file
+  uint64_t unix_socket_ino = 0;
+  int wakeup_fds[2] = {-1, -1};  // self pipe to stop `run`
+
+  std::mutex mutex;
+  std::list<std::unique_ptr<Connection>> connections;
+};
+
+} // namespace prnet
+
+#endif // PRNET_INFER_INFERENCE_SERVER_H_
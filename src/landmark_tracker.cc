@@ -0,0 +1,303 @@
+#include "landmark_tracker.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace prnet {
+
+namespace {
+
+// Tracks whose smallest eigenvalue of the gradient matrix(per pixel) is below
+// this are in flat regions and treated as lost.
+const float kMinEigenvalue = 1e-6f;
+
+// Tracks whose mean absolute difference of the window(in linear intensity)
+// exceeds this are treated as lost(e.g. occluded).
+const float kMaxResidual = 0.08f;
+
+// Stop iterating when the update is smaller than 0.01 pixel.
+const float kEpsilon2 = 1e-4f;
+
+// Bilinear sample of one channel image. Coordinates are clamped to the edge.
+inline float Sample(const Image<float> &img, float x, float y) {
+  const int w = int(img.getWidth());
+  const int h = int(img.getHeight());
+  x = std::min(std::max(x, 0.0f), float(w - 1));
+  y = std::min(std::max(y, 0.0f), float(h - 1));
+  const int x0 = int(x);
+  const int y0 = int(y);
+  const int x1 = std::min(x0 + 1, w - 1);
+  const int y1 = std::min(y0 + 1, h - 1);
+  const float fx = x - float(x0);
+  const float fy = y - float(y0);
+  const float *d = img.getData();
+  const float v00 = d[size_t(y0) * size_t(w) + size_t(x0)];
+  const float v10 = d[size_t(y0) * size_t(w) + size_t(x1)];
+  const float v01 = d[size_t(y1) * size_t(w) + size_t(x0)];
+  const float v11 = d[size_t(y1) * size_t(w) + size_t(x1)];
+  return (v00 + fx * (v10 - v00)) +
+         fy * ((v01 + fx * (v11 - v01)) - (v00 + fx * (v10 - v00)));
+}
+
+// Builds grayscale pyramid. Each level is 2x2 box averaged from the previous
+// one, so pixel `i` of level L is centered at `2 * i + 0.5` of level L - 1.
+void BuildPyramid(const Image<float> &img, int n_levels,
+                  std::vector<Image<float>> *pyramid) {
+  const size_t width = img.getWidth();
+  const size_t height = img.getHeight();
+  const size_t channels = img.getChannels();
+
+  pyramid->resize(size_t(n_levels));
+  Image<float> &gray = (*pyramid)[0];
+  gray.create(width, height, 1);
+
+  ThreadPool &pool = GetSharedThreadPool();
+  const size_t kRowsPerTask = 32;
+  pool.parallel_for((height + kRowsPerTask - 1) / kRowsPerTask, [&](size_t t) {
+    const size_t y_end = std::min(height, (t + 1) * kRowsPerTask);
+    for (size_t y = t * kRowsPerTask; y < y_end; y++) {
+      const float *src = img.getData() + y * width * channels;
+      float *dst = gray.getData() + y * width;
+      if (channels >= 3) {
+        for (size_t x = 0; x < width; x++) {
+          dst[x] = 0.299f * src[3 * x + 0] + 0.587f * src[3 * x + 1] +
+                   0.114f * src[3 * x + 2];
+        }
+      } else {
+        for (size_t x = 0; x < width; x++) {
+          dst[x] = src[x * channels];
+        }
+      }
+    }
+  });
+
+  for (size_t l = 1; l < pyramid->size(); l++) {
+    const Image<float> &src = (*pyramid)[l - 1];
+    const size_t sw = src.getWidth();
+    const size_t w = std::max(size_t(1), sw / 2);
+    const size_t h = std::max(size_t(1), src.getHeight() / 2);
+    Image<float> &dst = (*pyramid)[l];
+    dst.create(w, h, 1);
+    for (size_t y = 0; y < h; y++) {
+      const float *s0 = src.getData() + std::min(2 * y, src.getHeight() - 1) * sw;
+      const float *s1 = src.getData() + std::min(2 * y + 1, src.getHeight() - 1) * sw;
+      float *d = dst.getData() + y * w;
+      for (size_t x = 0; x < w; x++) {
+        const size_t x0 = std::min(2 * x, sw - 1);
+        const size_t x1 = std::min(2 * x + 1, sw - 1);
+        d[x] = 0.25f * (s0[x0] + s0[x1] + s1[x0] + s1[x1]);
+      }
+    }
+  }
+}
+
+} // anonymous namespace
+
+float Similarity2D::scale() const { return std::sqrt(a * a + b * b); }
+
+bool FitSimilarity2D(const float *src, const float *dst,
+                     const unsigned char *valid, size_t n,
+                     Similarity2D *xform, float *rms_error) {
+  double sx = 0.0, sy = 0.0, dx = 0.0, dy = 0.0;
+  size_t n_valid = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (!valid[i]) {
+      continue;
+    }
+    sx += double(src[2 * i + 0]);
+    sy += double(src[2 * i + 1]);
+    dx += double(dst[2 * i + 0]);
+    dy += double(dst[2 * i + 1]);
+    n_valid++;
+  }
+  if (n_valid < 2) {
+    return false;
+  }
+  sx /= double(n_valid);
+  sy /= double(n_valid);
+  dx /= double(n_valid);
+  dy /= double(n_valid);
+
+  // Closed form solution with centered points.
+  double ss = 0.0, sa = 0.0, sb = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    if (!valid[i]) {
+      continue;
+    }
+    const double px = double(src[2 * i + 0]) - sx;
+    const double py = double(src[2 * i + 1]) - sy;
+    const double qx = double(dst[2 * i + 0]) - dx;
+    const double qy = double(dst[2 * i + 1]) - dy;
+    ss += px * px + py * py;
+    sa += px * qx + py * qy;
+    sb += px * qy - py * qx;
+  }
+  if (!(ss > 0.0)) {
+    return false;
+  }
+
+  const double a = sa / ss;
+  const double b = sb / ss;
+  xform->a = float(a);
+  xform->b = float(b);
+  xform->tx = float(dx - (a * sx - b * sy));
+  xform->ty = float(dy - (b * sx + a * sy));
+
+  if (rms_error) {
+    double err = 0.0;
+    for (size_t i = 0; i < n; i++) {
+      if (!valid[i]) {
+        continue;
+      }
+      const double px = double(src[2 * i + 0]);
+      const double py = double(src[2 * i + 1]);
+      const double ex = a * px - b * py + double(xform->tx) - double(dst[2 * i + 0]);
+      const double ey = b * px + a * py + double(xform->ty) - double(dst[2 * i + 1]);
+      err += ex * ex + ey * ey;
+    }
+    (*rms_error) = float(std::sqrt(err / double(n_valid)));
+  }
+
+  return true;
+}
+
+void TransformPositionMap(const Similarity2D &xform, Image<float> *pos_img) {
+  const size_t n = pos_img->getWidth() * pos_img->getHeight();
+  const size_t c = pos_img->getChannels();
+  const float s = xform.scale();
+  float *p = pos_img->getData();
+  for (size_t i = 0; i < n; i++) {
+    const float x = p[c * i + 0];
+    const float y = p[c * i + 1];
+    p[c * i + 0] = xform.a * x - xform.b * y + xform.tx;
+    p[c * i + 1] = xform.b * x + xform.a * y + xform.ty;
+    p[c * i + 2] *= s;
+  }
+}
+
+LandmarkTracker::LandmarkTracker(int _n_levels, int _window_radius,
+                                 int _n_iterations)
+    : n_levels(std::max(1, _n_levels)),
+      window_radius(std::max(1, _window_radius)),
+      n_iterations(std::max(1, _n_iterations)) {}
+
+void LandmarkTracker::set_frame(const Image<float> &img) {
+  BuildPyramid(img, n_levels, &prev_pyramid);
+}
+
+bool LandmarkTracker::track(const Image<float> &img, std::vector<float> *points,
+                            std::vector<unsigned char> *status) {
+  if (prev_pyramid.empty()) {
+    return false;
+  }
+
+  std::vector<Image<float>> pyramid;
+  BuildPyramid(img, n_levels, &pyramid);
+
+  const size_t n_points = points->size() / 2;
+  status->resize(n_points, 1);
+
+  const int r = window_radius;
+  const size_t window_size = size_t(2 * r + 1) * size_t(2 * r + 1);
+  const float inv_window_size = 1.0f / float(window_size);
+
+  GetSharedThreadPool().parallel_for(n_points, [&](size_t i) {
+    if (!(*status)[i]) {
+      return;
+    }
+
+    std::vector<float> tmpl(window_size), grad_x(window_size),
+        grad_y(window_size);
+
+    const float x = (*points)[2 * i + 0];
+    const float y = (*points)[2 * i + 1];
+
+    // Displacement guess at the current level.
+    float gx = 0.0f, gy = 0.0f;
+    float residual = 0.0f;
+    for (int l = n_levels - 1; l >= 0; l--) {
+      const Image<float> &prev_img = prev_pyramid[size_t(l)];
+      const Image<float> &next_img = pyramid[size_t(l)];
+      const float level_scale = 1.0f / float(1 << l);
+      const float px = (x + 0.5f) * level_scale - 0.5f;
+      const float py = (y + 0.5f) * level_scale - 0.5f;
+
+      float gxx = 0.0f, gxy = 0.0f, gyy = 0.0f;
+      size_t k = 0;
+      for (int wy = -r; wy <= r; wy++) {
+        for (int wx = -r; wx <= r; wx++, k++) {
+          const float sx = px + float(wx);
+          const float sy = py + float(wy);
+          tmpl[k] = Sample(prev_img, sx, sy);
+          grad_x[k] = 0.5f * (Sample(prev_img, sx + 1.0f, sy) -
+                              Sample(prev_img, sx - 1.0f, sy));
+          grad_y[k] = 0.5f * (Sample(prev_img, sx, sy + 1.0f) -
+                              Sample(prev_img, sx, sy - 1.0f));
+          gxx += grad_x[k] * grad_x[k];
+          gxy += grad_x[k] * grad_y[k];
+          gyy += grad_y[k] * grad_y[k];
+        }
+      }
+
+      const float min_eigen =
+          0.5f * (gxx + gyy -
+                  std::sqrt((gxx - gyy) * (gxx - gyy) + 4.0f * gxy * gxy));
+      const float det = gxx * gyy - gxy * gxy;
+      if ((min_eigen * inv_window_size < kMinEigenvalue) || !(det > 0.0f)) {
+        (*status)[i] = 0;
+        return;
+      }
+      const float inv_det = 1.0f / det;
+
+      float vx = 0.0f, vy = 0.0f;
+      for (int iter = 0; iter < n_iterations; iter++) {
+        const float qx = px + gx + vx;
+        const float qy = py + gy + vy;
+        float bx = 0.0f, by = 0.0f;
+        residual = 0.0f;
+        k = 0;
+        for (int wy = -r; wy <= r; wy++) {
+          for (int wx = -r; wx <= r; wx++, k++) {
+            const float diff =
+                tmpl[k] - Sample(next_img, qx + float(wx), qy + float(wy));
+            bx += diff * grad_x[k];
+            by += diff * grad_y[k];
+            residual += std::fabs(diff);
+          }
+        }
+        const float ex = (gyy * bx - gxy * by) * inv_det;
+        const float ey = (gxx * by - gxy * bx) * inv_det;
+        vx += ex;
+        vy += ey;
+        if (ex * ex + ey * ey < kEpsilon2) {
+          break;
+        }
+      }
+
+      gx += vx;
+      gy += vy;
+      if (l > 0) {
+        gx *= 2.0f;
+        gy *= 2.0f;
+      }
+    }
+
+    const float nx = x + gx;
+    const float ny = y + gy;
+    if ((residual * inv_window_size > kMaxResidual) || !(nx >= 0.0f) ||
+        !(ny >= 0.0f) || !(nx <= float(img.getWidth() - 1)) ||
+        !(ny <= float(img.getHeight() - 1))) {
+      (*status)[i] = 0;
+      return;
+    }
+    (*points)[2 * i + 0] = nx;
+    (*points)[2 * i + 1] = ny;
+  });
+
+  prev_pyramid.swap(pyramid);
+
+  return true;
+}
+
+} // namespace prnet
@@ -0,0 +1,74 @@
+#ifndef PRNET_INFER_LANDMARK_TRACKER_H_
+#define PRNET_INFER_LANDMARK_TRACKER_H_
+
+#include <vector>
+
+#include "image.h"
+
+namespace prnet {
+
+///
+/// 2D similarity transform(rotation, uniform scale and translation).
+///
+///   x' = a * x - b * y + tx
+///   y' = b * x + a * y + ty
+///
+struct Similarity2D {
+  float a = 1.f;
+  float b = 0.f;
+  float tx = 0.f;
+  float ty = 0.f;
+
+  float scale() const;
+};
+
+///
+/// Least squares fit of the similarity transform which maps `src` to `dst`
+/// (`n` points of x, y pairs). Points whose `valid` is 0 are ignored.
+/// RMS of the residuals in pixels is stored in `rms_error`.
+/// Returns false when less than 2 points are valid or all of them coincide.
+///
+bool FitSimilarity2D(const float *src, const float *dst,
+                     const unsigned char *valid, size_t n,
+                     Similarity2D *xform, float *rms_error);
+
+///
+/// Transforms a position map in pixel coordinate of the input image(i.e.
+/// after remapping). x and y are transformed by `xform`, and z is scaled by
+/// the scale of `xform`.
+///
+void TransformPositionMap(const Similarity2D &xform, Image<float> *pos_img);
+
+///
+/// Sparse point tracker between consecutive frames(pyramidal Lucas-Kanade,
+/// J.-Y. Bouguet, "Pyramidal Implementation of the Lucas Kanade Feature
+/// Tracker").
+///
+class LandmarkTracker {
+public:
+  // `window_radius` is the half size of the matching window in pixels at each
+  // pyramid level.
+  explicit LandmarkTracker(int n_levels = 3, int window_radius = 7,
+                           int n_iterations = 10);
+
+  // Sets the frame points are tracked from.
+  void set_frame(const Image<float> &img);
+
+  // Tracks `points`(x, y pairs in pixel coordinate of the previous frame) to
+  // `img`, then `img` becomes the previous frame. Points whose `status` is 0
+  // are skipped, and `status` is set to 0 for points which are lost.
+  // Returns false when no previous frame is set.
+  bool track(const Image<float> &img, std::vector<float> *points,
+             std::vector<unsigned char> *status);
+
+private:
+  int n_levels;
+  int window_radius;
+  int n_iterations;
+
+  std::vector<Image<float>> prev_pyramid;  // grayscale. level 0 = full res.
+};
+
+} // namespace prnet
+
+#endif // PRNET_INFER_LANDMARK_TRACKER_H_
@@ -3,6 +3,8 @@
 #pragma clang diagnostic ignored "-Weverything"
 #endif
 
+// Images are decoded concurrently. Failure strings are a global variable.
+#define STBI_NO_FAILURE_STRINGS
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -18,16 +20,39 @@
 #include "ui.h"
 #endif
 
+#include "async_writer.h"
+#include "batch_scheduler.h"
 #include "face-data.h"
 #include "face_cropper.h"
 #include "face_frontalizer.h"
+#include "image_warp.h"
+#include "inference_server.h"
+#include "landmark_tracker.h"
 #include "mesh.h"
+#include "mesh_extractor.h"
+#include "mesh_io.h"
+#include "mesh_sequence.h"
+#include "npy_writer.h"
+#include "pipeline.h"
+#include "pose_estimator.h"
+#include "rasterizer.h"
+#include "shm_ring.h"
+#include "temporal_filter.h"
 #include "tf_predictor.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <csignal>
 #include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <thread>
 
 using namespace prnet;
 
@@ -36,6 +61,18 @@ inline T clamp(T f, T fmin, T fmax) {
   return std::max(std::min(fmax, f), fmin);
 }
 
+// Converts 8bit pixels(RGB or RGBA) to the RGB image.
+static void BytesToImage(const unsigned char *data, const size_t width,
+                         const size_t height, const size_t channels,
+                         Image<float> &image) {
+  image.create(width, height, 3);
+  image.foreach ([&](size_t x, size_t y, size_t c, float &v) {
+    float p = static_cast<float>(data[(y * width + x) * channels + c]) / 255.f;
+    // TODO(LTE): Do we really need degamma?
+    v = std::pow(p, 2.2f);
+  });
+}
+
 static bool LoadImage(const std::string &filename, Image<float> &image) {
   // Load image
   int width, height, channels;
@@ -48,20 +85,14 @@ static bool LoadImage(const std::string &filename, Image<float> &image) {
 
   if (channels < 3) {
     std::cerr << "Channels must be 3 or 4 but got " << channels << std::endl;
+    stbi_image_free(data);
     return false;
   }
 
   std::cout << "Image resolution : " << width << " x " << height << std::endl;
 
-  // Cast
-  image.create(size_t(width), size_t(height), 3);
-  image.foreach ([&](size_t x, size_t y, size_t c, float &v) {
-    float p = static_cast<float>(
-            data[(y * size_t(width) + x) * size_t(channels) + c]) /
-        255.f;
-    // TODO(LTE): Do we really need degamma?
-    v = std::pow(p, 2.2f);
-  });
+  // Cast(`data` has the required channels)
+  BytesToImage(data, size_t(width), size_t(height), 3, image);
 
   // Free
   stbi_image_free(data);
@@ -69,6 +100,35 @@ static bool LoadImage(const std::string &filename, Image<float> &image) {
   return true;
 }
 
+// Decodes an image file in memory(e.g. sent to the server).
+static bool DecodeImage(const unsigned char *bytes, const size_t size,
+                        Image<float> &image) {
+  int width, height, channels;
+  unsigned char *data =
+      stbi_load_from_memory(bytes, int(size), &width, &height, &channels,
+                            /* required channels */ 3);
+  if (!data) {
+    return false;
+  }
+
+  BytesToImage(data, size_t(width), size_t(height), 3, image);
+  stbi_image_free(data);
+
+  return true;
+}
+
+// Converts `image` to 8bit(no gamma correction).
+static void ImageToBytes(const Image<float> &image, const float scale,
+                         std::vector<unsigned char> *data) {
+  const size_t width = image.getWidth();
+  const size_t channels = image.getChannels();
+  data->resize(image.getHeight() * width * channels);
+  image.foreach ([&](size_t x, size_t y, size_t c, const float &v) {
+    (*data)[(y * width + x) * channels + c] =
+        static_cast<unsigned char>(clamp(scale * v * 255.f, 0.0f, 255.0f));
+  });
+}
+
 static bool SaveImage(const std::string &filename, Image<float> &image,
                       const float scale = 1.0f) {
   const size_t height = image.getHeight();
@@ -76,11 +136,8 @@ static bool SaveImage(const std::string &filename, Image<float> &image,
   const size_t channels = image.getChannels();
 
   // Cast
-  std::vector<unsigned char> data(height * width * channels);
-  image.foreach ([&](size_t x, size_t y, size_t c, float &v) {
-    data[(y * width + x) * channels + c] =
-        static_cast<unsigned char>(clamp(scale * v * 255.f, 0.0f, 255.0f));
-  });
+  std::vector<unsigned char> data;
+  ImageToBytes(image, scale, &data);
 
   // Save
   stbi_write_jpg(filename.c_str(), int(width), int(height), int(channels),
@@ -89,223 +146,182 @@ static bool SaveImage(const std::string &filename, Image<float> &image,
   return true;
 }
 
-// --------------------------------
+// Encodes `image` as JPEG in memory(e.g. to embed the texture into .glb).
+static bool EncodeImage(const Image<float> &image, EncodedImage *encoded) {
+  std::vector<unsigned char> data;
+  ImageToBytes(image, 1.0f, &data);
+  encoded->data.clear();
+  encoded->mime_type = "image/jpeg";
+  const int ret = stbi_write_jpg_to_func(
+      [](void *context, void *bytes, int size) {
+        std::vector<unsigned char> *dst =
+            static_cast<std::vector<unsigned char> *>(context);
+        const unsigned char *src = static_cast<const unsigned char *>(bytes);
+        dst->insert(dst->end(), src, src + size);
+      },
+      &encoded->data, int(image.getWidth()), int(image.getHeight()),
+      int(image.getChannels()), data.data(), 0);
+  return ret != 0;
+}
 
-// Create texture map from 3D position map
-static bool CreateTexture(const Image<float> &image, const Image<float> &posmap,
-                          Image<float> *texture) {
-  if (image.getWidth() != 256) {
-    std::cerr << "Invalid width for Image. width must be 256 but has "
-              << image.getWidth() << std::endl;
-    return false;
+// Appends face index to the filename when an image contains multiple faces.
+// e.g. "output.obj" -> "output_1.obj"
+static std::string FaceFilename(const std::string &filename,
+                                const size_t face_id, const size_t n_faces) {
+  if (n_faces <= 1) {
+    return filename;
   }
 
-  if (image.getHeight() != 256) {
-    std::cerr << "Invalid height for Image. height must be 256 but has "
-              << image.getHeight() << std::endl;
-    return false;
+  const size_t dot = filename.find_last_of('.');
+  std::stringstream ss;
+  ss << filename.substr(0, dot) << "_" << face_id;
+  if (dot != std::string::npos) {
+    ss << filename.substr(dot);
   }
+  return ss.str();
+}
 
-  if (image.getChannels() != 3) {
-    std::cerr << "Invalid channels for Image. channels must be 3 but has "
-              << image.getChannels() << std::endl;
-    return false;
+// Appends frame index to the filename when processing an image sequence.
+// e.g. "output.obj" -> "output_00012.obj"
+static std::string FrameFilename(const std::string &filename,
+                                 const size_t frame_id, const size_t n_frames) {
+  if (n_frames <= 1) {
+    return filename;
   }
 
-  if (posmap.getWidth() != 256) {
-    std::cerr << "Invalid width for Position map. width must be 256 but has "
-              << posmap.getWidth() << std::endl;
-    return false;
+  const size_t dot = filename.find_last_of('.');
+  std::stringstream ss;
+  ss << filename.substr(0, dot) << "_" << std::setw(5) << std::setfill('0')
+     << frame_id;
+  if (dot != std::string::npos) {
+    ss << filename.substr(dot);
   }
+  return ss.str();
+}
 
-  if (posmap.getHeight() != 256) {
-    std::cerr << "Invalid height for Position map. height must be 256 but has "
-              << posmap.getHeight() << std::endl;
-    return false;
+// Removes the extension of the last path component, if any.
+// e.g. "out.d/posmap.npy" -> "out.d/posmap", "out.d/posmap" -> "out.d/posmap"
+static std::string RemoveExtension(const std::string &filename) {
+  const size_t sep = filename.find_last_of("/\\");
+  const size_t dot = filename.find_last_of('.');
+  if ((dot == std::string::npos) ||
+      ((sep != std::string::npos) && (dot < sep))) {
+    return filename;
   }
+  return filename.substr(0, dot);
+}
 
-  if (posmap.getChannels() != 3) {
-    std::cerr
-        << "Invalid channels for Position map. channels must be 3 but has "
-        << posmap.getChannels() << std::endl;
+// Reads image filenames(one per line) from a text file.
+static bool LoadImageList(const std::string &filename,
+                          std::vector<std::string> *image_filenames) {
+  std::ifstream ifs(filename);
+  if (!ifs) {
+    std::cerr << "File not found or failed to open : " << filename << std::endl;
     return false;
   }
 
-  size_t width = image.getWidth();
-  size_t height = image.getHeight();
-
-  texture->create(width, height, /* RGB */ 3);
-
-  for (size_t y = 0; y < height; y++) {
-    for (size_t x = 0; x < width; x++) {
-      // Look up 2D position from 3D position map.
-      float vx = posmap.getData()[3 * (y * width + x) + 0];
-      float vy = posmap.getData()[3 * (y * width + x) + 1];
-      // float b = image.getData()[3 * (y * width + x) + 2];
-
-      // Fetch corresponding texel color
-      // No filtering(nearest neighbor point sampling)
-      int px = int(vx);
-      int py = int(vy);
-
-      if ((px < 0) || (py < 0) || (px >= int(width)) || (py >= int(height))) {
-        // out-of-bounds
-        texture->getData()[3 * (y * width + x) + 0] = 0.0f;
-        texture->getData()[3 * (y * width + x) + 1] = 0.0f;
-        texture->getData()[3 * (y * width + x) + 2] = 0.0f;
-      } else {
-        texture->getData()[3 * (y * width + x) + 0] =
-            image.getData()[3 * (size_t(py) * width + size_t(px)) + 0];
-        texture->getData()[3 * (y * width + x) + 1] =
-            image.getData()[3 * (size_t(py) * width + size_t(px)) + 1];
-        texture->getData()[3 * (y * width + x) + 2] =
-            image.getData()[3 * (size_t(py) * width + size_t(px)) + 2];
-      }
+  std::string line;
+  while (std::getline(ifs, line)) {
+    if (!line.empty() && (line.back() == '\r')) {
+      line.pop_back();
+    }
+    if (!line.empty()) {
+      image_filenames->push_back(line);
     }
   }
 
   return true;
 }
 
-// Convert 3D position map(Image) to mesh using FaceData.
-static bool ConvertToMesh(const Image<float> &image, const FaceData &face_data,
-                          Mesh *mesh) {
-  if (image.getWidth() != 256) {
-    std::cerr << "Invalid width for Image. width must be 256 but has "
-              << image.getWidth() << std::endl;
+// --------------------------------
+
+// Create texture map(`texture_size` x `texture_size`, in UV space) from 3D
+// position map. `posmap` is the raw network output and is remapped to the
+// pixel coordinate of `image` with `scale` and `shift_x`, `shift_y` on the fly
+// (see `RemapPosition`). `image` is sampled with bilinear filtering.
+static bool CreateTexture(const Image<float> &image, const Image<float> &posmap,
+                          const float scale, const float shift_x,
+                          const float shift_y, const size_t texture_size,
+                          Image<float> *texture) {
+  if (image.getChannels() != 3) {
+    std::cerr << "Invalid channels for Image. channels must be 3 but has "
+              << image.getChannels() << std::endl;
     return false;
   }
 
-  if (image.getHeight() != 256) {
-    std::cerr << "Invalid height for Image. height must be 256 but has "
-              << image.getHeight() << std::endl;
+  if (posmap.getChannels() != 3) {
+    std::cerr
+        << "Invalid channels for Position map. channels must be 3 but has "
+        << posmap.getChannels() << std::endl;
     return false;
   }
 
-  if (image.getChannels() != 3) {
-    std::cerr << "Invalid channels for Image. channels must be 3 but has "
-              << image.getChannels() << std::endl;
+  return RemapBilinear(image, posmap, scale, shift_x, shift_y, texture_size,
+                       texture_size, texture);
+}
+
+// Masks self-occluded texels of `texture` with the depth buffer of the posed
+// mesh. `pos_img` must be remapped to the pixel coordinate of `image`.
+static bool MaskOccludedTexels(const Image<float> &image,
+                               const Image<float> &pos_img,
+                               const MeshExtractor &mesh_extractor,
+                               Image<float> *texture, Image<float> *mask) {
+  std::vector<float> vertices;
+  if (!mesh_extractor.gather(pos_img, &vertices)) {
     return false;
   }
 
-  //// DBG
-  // for (size_t i = 0; i < 10; i++) {
-  //  float x = image.getData()[3 * i + 0];
-  //  float y = image.getData()[3 * i + 1];
-  //  float z = image.getData()[3 * i + 2];
-  //
-  //  std::cout << "[" << i << "] + " << x << ", " << y << ", " << z <<
-  //  std::endl;
-  //}
-
-  float bmin[3];
-  float bmax[3];
-
-  // Look up vertex position from 3D position map(256x256x3)
-  mesh->vertices.clear();
-  mesh->uvs.clear();
-  for (size_t i = 0; i < face_data.face_indices.size(); i++) {
-    size_t idx = face_data.face_indices[i];
-
-    uint32_t px = uint32_t(idx % image.getWidth());
-    uint32_t py = uint32_t(idx / image.getHeight());
-
-    float x = image.getData()[3 * (py * image.getWidth() + px) + 0];
-    float y = image.getData()[3 * (py * image.getWidth() + px) + 1];
-    float z = image.getData()[3 * (py * image.getWidth() + px) + 2];
-
-    mesh->vertices.push_back(x);
-    mesh->vertices.push_back(y);
-    mesh->vertices.push_back(z);
-
-    if (i == 0) {
-      bmin[0] = bmax[0] = x;
-      bmin[1] = bmax[1] = y;
-      bmin[2] = bmax[2] = z;
-    } else {
-      bmin[0] = std::min(bmin[0], x);
-      bmin[1] = std::min(bmin[1], y);
-      bmin[2] = std::min(bmin[2], z);
-
-      bmax[0] = std::max(bmax[0], x);
-      bmax[1] = std::max(bmax[1], y);
-      bmax[2] = std::max(bmax[2], z);
-    }
-
-    // normalize uv
-    float u = x / float(image.getWidth());
-    float v = y / float(image.getHeight());
-
-    mesh->uvs.push_back(u);
-    mesh->uvs.push_back(v);
-  }
-
-  std::cout << "bmin " << bmin[0] << ", " << bmin[1] << ", " << bmin[2]
-            << std::endl;
-  std::cout << "bmax " << bmax[0] << ", " << bmax[1] << ", " << bmax[2]
-            << std::endl;
-
-#if 1
-  // Centerize vertex position.
-  {
-    float bsize[3];
-    bsize[0] = bmax[0] - bmin[0];
-    bsize[1] = bmax[1] - bmin[1];
-    bsize[2] = bmax[2] - bmin[2];
-    for (size_t i = 0; i < mesh->vertices.size() / 3; i++) {
-      mesh->vertices[3 * i + 0] -= (bmin[0] + 0.5f * bsize[0]);
-      mesh->vertices[3 * i + 1] -= (bmin[1] + 0.5f * bsize[1]);
-      mesh->vertices[3 * i + 2] -= (bmin[2] + 0.5f * bsize[2]);
-    }
+  const std::vector<uint32_t> &faces = mesh_extractor.get_topology()->faces;
+  DepthBuffer depth;
+  RasterizeDepth(vertices.data(), vertices.size() / 3, faces.data(),
+                 faces.size() / 3, image.getWidth(), image.getHeight(), &depth);
+
+  // Visibility is computed per position map pixel, then upsampled to the
+  // texture resolution.
+  Image<float> vis;
+  ComputeVisibility(depth, pos_img, &vis);
+  if ((vis.getWidth() != texture->getWidth()) ||
+      (vis.getHeight() != texture->getHeight())) {
+    AffineTransform xform;
+    xform.m[0] = float(vis.getWidth()) / float(texture->getWidth());
+    xform.m[2] = 0.5f * xform.m[0] - 0.5f;
+    xform.m[4] = float(vis.getHeight()) / float(texture->getHeight());
+    xform.m[5] = 0.5f * xform.m[4] - 0.5f;
+    WarpAffine(vis, xform, texture->getWidth(), texture->getHeight(), mask);
+  } else {
+    *mask = std::move(vis);
   }
-#endif
 
-  for (size_t i = 0; i < face_data.triangles.size(); i++) {
-    // It looks triangle index starts with 1, but accepts it.
-    uint32_t idx = face_data.triangles[i];
-    if (idx >= (mesh->vertices.size() / 3)) {
-      std::cerr << "??? : invalid triangle index. " << idx
-                << " is greater or equal to " << (mesh->vertices.size() / 3)
-                << std::endl;
-      exit(-1);
+  const size_t channels = texture->getChannels();
+  float *tex = texture->getData();
+  const float *m = mask->getData();
+  for (size_t i = 0; i < texture->getWidth() * texture->getHeight(); i++) {
+    for (size_t c = 0; c < channels; c++) {
+      tex[channels * i + c] *= m[i];
     }
-    mesh->faces.push_back(idx);
   }
 
   return true;
 }
 
-// Save as wavefront .obj mesh
-static bool SaveAsWObj(const std::string &filename, prnet::Mesh &mesh) {
+// Save head pose as text.
+static bool SavePose(const std::string &filename, const Pose &pose) {
   std::ofstream ofs(filename);
   if (!ofs) {
     std::cerr << "Failed to open file to write : " << filename << std::endl;
     return false;
   }
 
-  for (size_t i = 0; i < mesh.vertices.size() / 3; i++) {
-    ofs << "v " << 255.0f * mesh.vertices[3 * i + 0] << " "
-        << 255.0f * mesh.vertices[3 * i + 1] << " "
-        << 255.0f * mesh.vertices[3 * i + 2] << std::endl;
-  }
-
-  for (size_t i = 0; i < mesh.uvs.size() / 2; i++) {
-    ofs << "vt " << mesh.uvs[2 * i + 0] << " " << mesh.uvs[2 * i + 1]
-        << std::endl;
-  }
-
-  for (size_t i = 0; i < mesh.faces.size() / 3; i++) {
-    // For .obj, face index starts with 1, so add +1.
-    uint32_t f0 = mesh.faces[3 * i + 0] + 1;
-    uint32_t f1 = mesh.faces[3 * i + 1] + 1;
-    uint32_t f2 = mesh.faces[3 * i + 2] + 1;
-
-    // Assume # of v == # of vt.
-    ofs << "f " << f0 << "/" << f0 << " " << f1 << "/" << f1 << " " << f2 << "/"
-        << f2 << std::endl;
+  ofs << "yaw " << pose.yaw << std::endl;
+  ofs << "pitch " << pose.pitch << std::endl;
+  ofs << "roll " << pose.roll << std::endl;
+  ofs << "scale " << pose.scale << std::endl;
+  for (int r = 0; r < 3; r++) {
+    ofs << "rotation " << pose.rotation[r][0] << " " << pose.rotation[r][1]
+        << " " << pose.rotation[r][2] << std::endl;
   }
-
-  // TODO(LTE): Output .mtl file.
+  ofs << "translation " << pose.translation[0] << " " << pose.translation[1]
+      << " " << pose.translation[2] << std::endl;
 
   return true;
 }
@@ -337,10 +353,10 @@ static void RemapPosition(Image<float> *pos_img, const float scale,
   }
 }
 
-static void DrawLandmark(const Image<float> &cropped_img,
-                         const Image<float> &pos_img, const FaceData &face_data,
+// Draw landmark points of a face to `out_img`.
+// `pos_img` must be remapped to the pixel coordinate of `out_img`.
+static void DrawLandmark(const Image<float> &pos_img, const FaceData &face_data,
                          Image<float> *out_img, float radius = 1.f) {
-  *out_img = cropped_img;  // copy
   const size_t n_pt = face_data.uv_kpt_indices.size() / 2;
   const int ksize = int(std::ceil(radius));
   for (size_t i = 0; i < n_pt; i++) {
@@ -354,8 +370,8 @@ static void DrawLandmark(const Image<float> &cropped_img,
         if (radius < float(rx * rx + ry * ry)) {
           continue;
         }
-        if (((x + rx) < 0) || ((x + rx) >= out_img->getWidth()) ||
-            ((y + ry) < 0) || ((y + ry) >= out_img->getWidth())) {
+        if (((x + rx) < 0) || ((x + rx) >= int(out_img->getWidth())) ||
+            ((y + ry) < 0) || ((y + ry) >= int(out_img->getHeight()))) {
           continue;
         }
         out_img->fetch(size_t(x + rx), size_t(y + ry), 0) = 0.f;
@@ -372,16 +388,228 @@ static void DrawLandmark(const Image<float> &cropped_img,
 #pragma clang diagnostic ignored "-Wunreachable-code"
 #endif
 
+// Keyframe of a face for inference skipping. Position maps of the following
+// frames are propagated from it with the motion of the tracked landmarks.
+struct FaceKeyframe {
+  Image<float> pos_img;          // in pixel coordinate of the input image.
+  std::vector<float> landmarks;  // x, y pairs
+  float size = 0.f;              // diagonal of the landmark bounding box
+};
+
+static void SetKeyframe(const Image<float> &pos_img, const FaceData &face_data,
+                        FaceKeyframe *keyframe) {
+  const size_t n_pt = face_data.uv_kpt_indices.size() / 2;
+  keyframe->pos_img = pos_img;
+  keyframe->landmarks.resize(2 * n_pt);
+  float bmin[2] = {std::numeric_limits<float>::max(),
+                   std::numeric_limits<float>::max()};
+  float bmax[2] = {-std::numeric_limits<float>::max(),
+                   -std::numeric_limits<float>::max()};
+  for (size_t i = 0; i < n_pt; i++) {
+    const uint32_t x_idx = face_data.uv_kpt_indices[i];
+    const uint32_t y_idx = face_data.uv_kpt_indices[i + n_pt];
+    for (size_t c = 0; c < 2; c++) {
+      const float v = pos_img.fetch(x_idx, y_idx, c);
+      keyframe->landmarks[2 * i + c] = v;
+      bmin[c] = std::min(bmin[c], v);
+      bmax[c] = std::max(bmax[c], v);
+    }
+  }
+  keyframe->size = (n_pt > 0) ? std::hypot(bmax[0] - bmin[0], bmax[1] - bmin[1])
+                              : 0.f;
+}
+
+// Propagates position maps of `keyframes` to the current frame with the
+// similarity transform fitted to the tracked landmarks(`points` of all faces).
+// Returns false when tracking of any face is unreliable(less than half of the
+// landmarks are tracked, or RMS error of the fit exceeds `max_error` times the
+// face size), so that the network should be run instead.
+static bool PropagateKeyframes(const std::vector<FaceKeyframe> &keyframes,
+                               const std::vector<float> &points,
+                               const std::vector<unsigned char> &status,
+                               const float max_error,
+                               std::vector<Image<float>> *pos_imgs) {
+  std::vector<Similarity2D> xforms(keyframes.size());
+  size_t offset = 0;
+  for (size_t i = 0; i < keyframes.size(); i++) {
+    const FaceKeyframe &keyframe = keyframes[i];
+    const size_t n_pt = keyframe.landmarks.size() / 2;
+    const size_t n_tracked = size_t(
+        std::count(status.begin() + std::ptrdiff_t(offset),
+                   status.begin() + std::ptrdiff_t(offset + n_pt), 1));
+    if (2 * n_tracked < n_pt) {
+      return false;
+    }
+
+    float rms_error = 0.f;
+    if (!FitSimilarity2D(keyframe.landmarks.data(), &points[2 * offset],
+                         &status[offset], n_pt, &xforms[i], &rms_error)) {
+      return false;
+    }
+    if (rms_error > max_error * keyframe.size) {
+      return false;
+    }
+    offset += n_pt;
+  }
+
+  pos_imgs->resize(keyframes.size());
+  for (size_t i = 0; i < keyframes.size(); i++) {
+    (*pos_imgs)[i] = keyframes[i].pos_img;
+    TransformPositionMap(xforms[i], &(*pos_imgs)[i]);
+  }
+
+  return true;
+}
+
+// Servers to stop at SIGINT or SIGTERM.
+static InferenceServer *g_server = nullptr;
+static ShmRingServer *g_shm_server = nullptr;
+
+static void StopServer(int) {
+  if (g_server) {
+    g_server->stop();
+  }
+  if (g_shm_server) {
+    g_shm_server->stop();
+  }
+}
+
+#ifdef USE_DLIB
+static const char *kDefaultDetector = "hog";
+#else
+static const char *kDefaultDetector = "none";
+#endif
+
+// Results of a face in a frame.
+struct FaceOutput {
+  Image<float> texture;
+  Image<float> visibility;
+  bool has_texture = false;
+  bool has_visibility = false;
+  Mesh mesh;
+  float mesh_center[3] = {0.f, 0.f, 0.f};  // subtracted from `mesh`
+  Mesh front_mesh;
+  bool frontalized = false;
+  Pose pose;  // of the centerized `mesh`
+  bool has_pose = false;
+};
+
+// A frame passed through the stages of the pipeline.
+struct FrameState {
+  Image<float> inp_img;
+
+  // Detected faces and their crops(`crop_size` x `crop_size` x 3 each, only
+  // with the batch scheduler).
+  std::vector<CropParam> crop_params;
+  std::vector<float> crops;
+  bool detected = false;
+
+  // Position maps(in pixel coordinate of the input image) of all faces.
+  std::vector<Image<float>> pos_imgs;
+  std::vector<Image<float>> raw_pos_imgs;
+
+  std::vector<FaceOutput> faces;
+  Image<float> dbg_lmk_image;  // landmarks of all faces.
+};
+
 int main(int argc, char **argv) {
   cxxopts::Options options("prnet-infer", "PRNet infererence in C++");
-  options.add_options()("i,image", "Input image file",
-                        cxxopts::value<std::string>())(
+  options.add_options()("i,image", "Input image file. Specify multiple times for an image sequence",
+                        cxxopts::value<std::vector<std::string>>())(
+      "image_list", "Text file listing input images(one per line) of an image sequence",
+      cxxopts::value<std::string>())(
       "g,graph", "Input freezed graph file", cxxopts::value<std::string>())(
-      "d,data", "Data folder of PRNet repo", cxxopts::value<std::string>());
+      "d,data", "Data folder of PRNet repo", cxxopts::value<std::string>())(
+      "debug", "Save debug images(e.g. cropped face images)")(
+      "listen", "Run as a server listening on the Unix domain socket",
+      cxxopts::value<std::string>())(
+      "listen_tcp", "Run as a server listening on the localhost TCP port",
+      cxxopts::value<int>())(
+      "listen_shm", "Run as a server on the shared memory object of the name",
+      cxxopts::value<std::string>())(
+      "shm_slots", "# of request slots of the shared memory",
+      cxxopts::value<int>()->default_value("4"))(
+      "shm_replace", "Replace an existing shared memory object of the name")(
+      "min_face_size", "Minimum face size in pixels to detect",
+      cxxopts::value<int>()->default_value("0"))(
+      "detector", "Face detector(hog, pico or none)",
+      cxxopts::value<std::string>()->default_value(kDefaultDetector))(
+      "detector_model", "Model file of the face detector(pico cascade)",
+      cxxopts::value<std::string>()->default_value(""))(
+      "frontalize", "Frontalization method(affine or pose)",
+      cxxopts::value<std::string>()->default_value("affine"))(
+      "pose_samples", "# of vertices for pose estimation(0 = 68 landmarks)",
+      cxxopts::value<int>()->default_value("0"))(
+      "ransac", "# of RANSAC iterations for pose estimation(0 = disable)",
+      cxxopts::value<int>()->default_value("0"))(
+      "texture_size", "Resolution of the texture image",
+      cxxopts::value<int>()->default_value("256"))(
+      "no_visibility", "Do not mask self-occluded texels of the texture")(
+      "format", "Mesh file format(obj, ply or glb)",
+      cxxopts::value<std::string>()->default_value("obj"))(
+      "sequence", "Write meshes of an image sequence into one .prnseq file per face")(
+      "sequence_bits", "Quantization bits of .prnseq positions(1-16, 0 = float)",
+      cxxopts::value<int>()->default_value("16"))(
+      "posmap", "Write raw position maps of the network to the .npy file",
+      cxxopts::value<std::string>())(
+      "posmap_append", "Append position maps to the existing .npy file")(
+      "posmap_only", "Only write position maps(no mesh, texture and pose)")(
+      "io_threads", "# of threads to write output files(0 = write synchronously)",
+      cxxopts::value<int>()->default_value("2"))(
+      "decode_threads", "# of threads to load images",
+      cxxopts::value<int>()->default_value("2"))(
+      "detect_threads", "# of threads to detect and crop faces",
+      cxxopts::value<int>()->default_value("1"))(
+      "postprocess_threads", "# of threads to create meshes, textures and poses",
+      cxxopts::value<int>()->default_value("2"))(
+      "max_batch", "Max # of faces of frames batched into one inference",
+      cxxopts::value<int>()->default_value("1"))(
+      "max_batch_wait_ms", "Max time to wait for faces to fill a batch [ms]",
+      cxxopts::value<float>()->default_value("5"))(
+      "smooth", "Temporally smooth position maps of an image sequence(One Euro filter)")(
+      "fps", "Frame rate of the image sequence",
+      cxxopts::value<float>()->default_value("30"))(
+      "smooth_min_cutoff", "Minimum cutoff frequency of the smoothing filter [Hz]",
+      cxxopts::value<float>()->default_value("1.0"))(
+      "smooth_beta", "Speed coefficient of the smoothing filter",
+      cxxopts::value<float>()->default_value("0.05"))(
+      "keyframe_interval", "Max # of frames between network inference(1 = every frame)",
+      cxxopts::value<int>()->default_value("1"))(
+      "keyframe_threshold", "Max landmark tracking error relative to the face size",
+      cxxopts::value<float>()->default_value("0.01"));
 
   auto result = options.parse(argc, argv);
 
-  if (!result.count("image")) {
+  std::vector<std::string> image_filenames;
+  if (result.count("image")) {
+    image_filenames = result["image"].as<std::vector<std::string>>();
+  }
+  if (result.count("image_list")) {
+    if (!LoadImageList(result["image_list"].as<std::string>(),
+                       &image_filenames)) {
+      return -1;
+    }
+  }
+
+  // Server mode does not take input images.
+  const std::string listen_path =
+      result.count("listen") ? result["listen"].as<std::string>() : "";
+  const int listen_port =
+      result.count("listen_tcp") ? result["listen_tcp"].as<int>() : 0;
+  const std::string listen_shm =
+      result.count("listen_shm") ? result["listen_shm"].as<std::string>() : "";
+  const int shm_slots = result["shm_slots"].as<int>();
+  const bool shm_replace = result.count("shm_replace") > 0;
+  const bool use_socket = !listen_path.empty() || (listen_port > 0);
+  const bool server_mode = use_socket || !listen_shm.empty();
+
+  if (shm_slots < 1) {
+    std::cerr << "Invalid # of shared memory slots : " << shm_slots
+              << std::endl;
+    return -1;
+  }
+
+  if (image_filenames.empty() && !server_mode) {
     std::cerr << "Please specify input image with -i or --image option."
               << std::endl;
     return -1;
@@ -393,50 +621,170 @@ int main(int argc, char **argv) {
     return -1;
   }
 
+#ifndef USE_EMBEDDED_FACE_DATA
   if (!result.count("data")) {
     std::cerr
         << "Please specify Data folder of PRNet repo with -d or --data option."
         << std::endl;
     return -1;
   }
+#endif
 
-  std::string image_filename = result["image"].as<std::string>();
   std::string graph_filename = result["graph"].as<std::string>();
-  std::string data_dirname = result["data"].as<std::string>();
+  // Face data embedded in the executable is used when `--data` is omitted.
+  std::string data_dirname =
+      result.count("data") ? result["data"].as<std::string>() : "";
+  const bool debug = result.count("debug") > 0;
+  const int min_face_size = result["min_face_size"].as<int>();
+  const std::string detector_name = result["detector"].as<std::string>();
+  const std::string detector_model = result["detector_model"].as<std::string>();
+  const std::string frontalize_method = result["frontalize"].as<std::string>();
+  const int pose_samples = result["pose_samples"].as<int>();
+  const int ransac_iterations = result["ransac"].as<int>();
+  const int texture_size = result["texture_size"].as<int>();
+  const bool mask_occlusion = result.count("no_visibility") == 0;
+  const std::string mesh_format = result["format"].as<std::string>();
+  const bool write_sequence = result.count("sequence") > 0;
+  const int sequence_bits = result["sequence_bits"].as<int>();
+  const std::string posmap_filename =
+      result.count("posmap") ? result["posmap"].as<std::string>() : "";
+  const bool posmap_append = result.count("posmap_append") > 0;
+  const bool posmap_only = result.count("posmap_only") > 0;
+  const int io_threads = result["io_threads"].as<int>();
+  const int decode_threads = result["decode_threads"].as<int>();
+  const int detect_threads = result["detect_threads"].as<int>();
+  const int postprocess_threads = result["postprocess_threads"].as<int>();
+  const int max_batch = result["max_batch"].as<int>();
+  const float max_batch_wait_ms = result["max_batch_wait_ms"].as<float>();
+  const bool smooth = result.count("smooth") > 0;
+  const float fps = result["fps"].as<float>();
+  const float smooth_min_cutoff = result["smooth_min_cutoff"].as<float>();
+  const float smooth_beta = result["smooth_beta"].as<float>();
+  const int keyframe_interval = result["keyframe_interval"].as<int>();
+  const float keyframe_threshold = result["keyframe_threshold"].as<float>();
+
+  if (texture_size <= 0) {
+    std::cerr << "Invalid texture size : " << texture_size << std::endl;
+    return -1;
+  }
 
-  // Load image
-  std::cout << "Loading image \"" << image_filename << "\"" << std::endl;
+  if ((frontalize_method != "affine") && (frontalize_method != "pose")) {
+    std::cerr << "Unknown frontalization method : " << frontalize_method
+              << std::endl;
+    return -1;
+  }
 
-  Image<float> inp_img;
-  if (!LoadImage(image_filename, inp_img)) {
-    std::cerr << "Faile to load input image" << std::endl;
+  if (!(fps > 0.0f)) {
+    std::cerr << "Invalid frame rate : " << fps << std::endl;
+    return -1;
+  }
+
+  if ((sequence_bits < 0) || (sequence_bits > 16)) {
+    std::cerr << "Invalid # of sequence quantization bits : " << sequence_bits
+              << std::endl;
+    return -1;
+  }
+
+  if (keyframe_interval < 1) {
+    std::cerr << "Invalid keyframe interval : " << keyframe_interval
+              << std::endl;
     return -1;
   }
 
+  if (io_threads < 0) {
+    std::cerr << "Invalid # of I/O threads : " << io_threads << std::endl;
+    return -1;
+  }
+
+  if ((decode_threads < 1) || (detect_threads < 1) ||
+      (postprocess_threads < 1)) {
+    std::cerr << "# of threads of each stage must be 1 or more." << std::endl;
+    return -1;
+  }
+
+  if ((max_batch < 1) || !(max_batch_wait_ms >= 0.0f)) {
+    std::cerr << "Invalid batch size or wait time : " << max_batch << ", "
+              << max_batch_wait_ms << std::endl;
+    return -1;
+  }
+
+  if (posmap_only && posmap_filename.empty()) {
+    std::cerr << "--posmap_only requires --posmap." << std::endl;
+    return -1;
+  }
+
+  // Raw position maps(N x 256 x 256 x 3) and their remap parameters
+  // (N x 5 : frame, face, scale, shift_x and shift_y) to the input image.
+  //   x_in = scale * x + shift_x, y_in = scale * y + shift_y, z_in = scale * z
+  // With `--posmap_append`, frame indices continue from the existing rows.
+  const size_t kPosmapSize = 256;
+  NpyWriter posmap_writer, posmap_params_writer;
+  size_t posmap_first_frame = 0;
+  if (!posmap_filename.empty()) {
+    const std::string params_filename =
+        RemoveExtension(posmap_filename) + ".params.npy";
+    if (!posmap_writer.open(posmap_filename, {kPosmapSize, kPosmapSize, 3},
+                            posmap_append) ||
+        !posmap_params_writer.open(params_filename, {5}, posmap_append)) {
+      return -1;
+    }
+    if (posmap_params_writer.num_items() > 0) {
+      float last[5];
+      if (!posmap_params_writer.read(posmap_params_writer.num_items() - 1,
+                                     last)) {
+        return -1;
+      }
+      if (last[0] >= 0.0f) {
+        posmap_first_frame = size_t(last[0]) + 1;
+      }
+    }
+  }
+
+  // Texts and blocks of the topology are reused for all mesh files.
+  // Writers are not thread safe, so mesh files are written one at a time.
+  std::unique_ptr<MeshWriter> mesh_writer = CreateMeshWriter(mesh_format);
+  if (!mesh_writer) {
+    return -1;
+  }
+  std::mutex mesh_writer_mutex;
+  const std::string mesh_ext = mesh_writer->extension();
+
   // Meshing
   FaceData face_data;
-  if (!LoadFaceData(data_dirname + "/uv-data", &face_data)) {
+  if (!LoadFaceData(data_dirname.empty() ? "" : data_dirname + "/uv-data",
+                    &face_data)) {
     std::cerr << "Failed to load Face UV data" << std::endl; 
     return -1;
   }
 
-  // Crop Image.
-  Image<float> cropped_img;
-  FaceCropper cropper;
-  float crop_scale = 1.f, crop_shift_x = 0.f, crop_shift_y = 0.f;
-  bool dlib_ret = cropper.crop_dlib(inp_img, cropped_img, &crop_scale,
-                                    &crop_shift_x, &crop_shift_y);
-  if (!dlib_ret) {
-#ifdef USE_DLIB
-    std::cout << "Failed to detect face " << std::endl;
-#else
-    std::cout << "Crop image at the image center " << std::endl;
-#endif
-    // Crop center
-    cropper.crop_center(inp_img, cropped_img, &crop_scale, &crop_shift_x,
-                        &crop_shift_y);
+  MeshExtractor mesh_extractor;
+  if (!mesh_extractor.init(face_data)) {
+    std::cerr << "Invalid Face UV data" << std::endl;
+    return -1;
+  }
+
+  PoseEstimator pose_estimator;
+  if (!pose_estimator.init(face_data, size_t(std::max(0, pose_samples)))) {
+    std::cerr << "Invalid Face UV data" << std::endl;
+    return -1;
+  }
+  pose_estimator.set_ransac(ransac_iterations);
+
+  // Face detectors are not shared between threads, so each detection thread
+  // takes one of the croppers from the free list.
+  std::vector<std::unique_ptr<FaceCropper>> croppers(
+      static_cast<size_t>(detect_threads));
+  BoundedQueue<FaceCropper *> free_croppers(croppers.size());
+  for (auto &cropper : croppers) {
+    cropper.reset(new FaceCropper());
+    if (!cropper->set_detector(detector_name, detector_model)) {
+      std::cerr << "Failed to setup face detector : " << detector_name
+                << std::endl;
+      return -1;
+    }
+    cropper->set_min_face_size(min_face_size);
+    free_croppers.push(cropper.get());
   }
-  SaveImage("dbg_cropped_img.jpg", cropped_img);
 
   // Predict
   TensorflowPredictor tf_predictor;
@@ -445,59 +793,662 @@ int main(int argc, char **argv) {
   tf_predictor.load(graph_filename, "Placeholder",
                     "resfcn256/Conv2d_transpose_16/Sigmoid");
   std::cout << "Loaded model" << std::endl;
-  Image<float> raw_pos_img;
-
-  std::cout << "Start running network... " << std::endl << std::flush;
-  auto startT = std::chrono::system_clock::now();
-  tf_predictor.predict(cropped_img, raw_pos_img);
-  auto endT = std::chrono::system_clock::now();
-  std::chrono::duration<double, std::milli> ms = endT - startT;
-  std::cout << "Ran network. elapsed = " << ms.count() << " [ms] " << std::endl;
-
-  // kMaxPos comes from `MaxPos` of PosPrediction class in PRNet repo.
-  const float kMaxPos = raw_pos_img.getWidth() * 1.1f;
-  Image<float> pos_img = raw_pos_img;
-  if (dlib_ret) {
-    RemapPosition(&pos_img, kMaxPos, 0.0f, 0.0f);
-  } else {
-    // std::cout << "crop_scale = " << crop_scale << std::endl;
-    // std::cout << "crop_shift = " << crop_shift_x << ", " << crop_shift_y <<
-    // std::endl;
-    RemapPosition(&pos_img, crop_scale * kMaxPos, crop_shift_x, crop_shift_y);
+
+  // Temporal filters of faces(matched between frames by their positions).
+  FaceFilterBank filters(smooth_min_cutoff, smooth_beta);
+
+  // Keyframes for inference skipping. Landmarks of all faces are tracked
+  // together.
+  LandmarkTracker tracker;
+  std::vector<FaceKeyframe> keyframes;
+  std::vector<float> tracked_points;
+  std::vector<unsigned char> tracked_status;
+  size_t frames_since_keyframe = 0;
+  size_t n_skipped_frames = 0;
+
+#ifdef USE_GUI
+  // GUI shows the first face of the first frame.
+  Mesh gui_mesh, gui_front_mesh;
+  Image<float> gui_texture;
+  std::vector<Image<float>> debug_images;
+#endif
+
+  const size_t n_frames = image_filenames.size();
+
+  // Mesh sequences of each face(`--sequence`). Face 0 is written to
+  // "output.prnseq" and face i to "output_i.prnseq". Frames in which the face
+  // is not detected are not stored. A single image is also written as a
+  // sequence of one frame.
+  std::vector<std::unique_ptr<MeshSequenceWriter>> sequence_writers;
+  std::vector<std::unique_ptr<MeshSequenceWriter>> front_sequence_writers;
+  auto AppendToSequence =
+      [&](std::vector<std::unique_ptr<MeshSequenceWriter>> *writers,
+          const std::string &filename, size_t face_id, size_t frame,
+          const Mesh &mesh) {
+        if (writers->size() <= face_id) {
+          writers->resize(face_id + 1);
+        }
+        std::unique_ptr<MeshSequenceWriter> &writer = (*writers)[face_id];
+        if (!writer) {
+          MeshSequenceOptions sequence_options;
+          sequence_options.vertex_scale = 255.0f;
+          sequence_options.quantize = (sequence_bits > 0);
+          if (sequence_options.quantize) {
+            sequence_options.quantization_bits = sequence_bits;
+          }
+          writer.reset(new MeshSequenceWriter());
+          if (!writer->open(FaceFilename(filename, face_id, face_id + 1),
+                            *mesh.topology, mesh.num_vertices(),
+                            sequence_options)) {
+            return false;
+          }
+        }
+        return writer->append(mesh, uint32_t(frame));
+      };
+
+  // Output files are encoded and written on I/O threads, so inference does
+  // not wait for the disk. Tasks refer to the writers above, so this is
+  // destroyed(after waiting for tasks) before them. Appending to a file
+  // (sequences and position maps) is queued with `submit_ordered` to keep
+  // the frame order.
+  AsyncWriter async_writer(static_cast<uint32_t>(io_threads));
+  auto SaveImageAsync = [&async_writer](const std::string &filename,
+                                        const Image<float> &image) {
+    std::shared_ptr<Image<float>> copy(new Image<float>(image));
+    async_writer.submit([filename, copy]() { return SaveImage(filename, *copy); });
+  };
+
+  // Stages run concurrently on different frames:
+  //
+  //   decode -> detect -> predict -> temporal -> postprocess -> output
+  //
+  // `temporal`(filters and appending position maps) and `output`(queueing
+  // file writes) process frames in order. `predict` also does with keyframes
+  // (tracking state). Other stages process frames in parallel.
+  const size_t kCropSize = 256;
+  const bool use_keyframes = keyframe_interval > 1;
+  Pipeline<FrameState> pipeline;
+
+  // Faces of frames are batched when `predict` runs on multiple frames
+  // concurrently. Inference depends on the tracking of the previous frame
+  // with keyframes, so frames are not batched. The server always runs the
+  // network through the scheduler, which also serializes the requests of
+  // concurrent connections.
+  const bool use_batching =
+      server_mode || ((max_batch > 1) && !use_keyframes);
+  std::unique_ptr<BatchScheduler> batch_scheduler;
+  if (use_batching) {
+    BatchSchedulerOptions batch_options;
+    batch_options.max_batch_size = size_t(max_batch);
+    batch_options.max_wait_ms = double(max_batch_wait_ms);
+    batch_options.width = kCropSize;
+    batch_options.height = kCropSize;
+    batch_options.channels = 3;
+    batch_scheduler.reset(new BatchScheduler(&tf_predictor, batch_options));
   }
 
-  Image<float> color_img = dlib_ret ? cropped_img : inp_img;
+  const size_t crop_floats = kCropSize * kCropSize * 3;
+
+  // Crops the faces of `state`. Face `i` is written to `slot(i)`.
+  auto CropFaces = [&](size_t frame, FaceCropper *cropper,
+                       const FrameState &state,
+                       const std::function<float *(size_t)> &slot) {
+    const std::vector<CropParam> &crop_params = state.crop_params;
+    for (size_t i = 0; i < crop_params.size(); i++) {
+      float *crop = slot(i);
+      cropper->crop(state.inp_img, crop_params[i], kCropSize, kCropSize, crop);
+
+      if (debug) {
+        Image<float> cropped_img;
+        cropped_img.create(kCropSize, kCropSize, 3, crop);
+        SaveImageAsync(FaceFilename(FrameFilename("dbg_cropped_img.jpg", frame,
+                                                  n_frames),
+                                    i, crop_params.size()),
+                       cropped_img);
+      }
+    }
+  };
+
+  // Locates faces. Returns true if a face was detected.
+  //
+  // With the batch scheduler, faces are also cropped here(concurrently with
+  // other frames) into `state->crops`, which the scheduler copies into the
+  // input tensor of a batch. Otherwise they are cropped directly into the
+  // input tensor by `RunNetwork`.
+  auto DetectFaces = [&](size_t frame, FaceCropper *cropper,
+                         FrameState *state) {
+    const Image<float> &inp_img = state->inp_img;
+    std::vector<CropParam> &crop_params = state->crop_params;
+    state->detected = cropper->locate_faces(inp_img, crop_params);
+    if (!state->detected) {
+      // Crop center
+      crop_params.resize(1);
+      cropper->locate_center(inp_img, &crop_params[0]);
+    }
 
-  // Create texture image
-  Image<float> texture;
-  bool has_texture = CreateTexture(color_img, pos_img, &texture);
-  if (has_texture) {
-    SaveImage("texture.jpg", texture);  // in linear space.
+    if (batch_scheduler) {
+      state->crops.resize(crop_params.size() * crop_floats);
+      CropFaces(frame, cropper, *state, [&](size_t i) {
+        return &state->crops[i * crop_floats];
+      });
+    }
+  };
+
+  // Runs the network for the faces of `state`.
+  auto RunNetwork = [&](size_t frame, FrameState *state,
+                        std::vector<Image<float>> *outputs) {
+    const size_t n = state->crop_params.size();
+    if (batch_scheduler) {
+      const bool ok = batch_scheduler->predict(state->crops.data(), n, outputs);
+      state->crops.clear();
+      return ok;
+    }
+
+    // `predict` runs on one frame at a time without the scheduler, so the
+    // input tensor is not shared.
+    tf_predictor.allocate_input(n, kCropSize, kCropSize, 3);
+    FaceCropper *cropper = nullptr;
+    free_croppers.pop(&cropper);
+    CropFaces(frame, cropper, *state,
+              [&](size_t i) { return tf_predictor.input_data(i); });
+    free_croppers.push(std::move(cropper));
+    return tf_predictor.run(*outputs);
+  };
+
+  if (server_mode) {
+    // Requests are handled concurrently on the threads of connections.
+    auto HandleRequest = [&](const ServerRequest &request,
+                             ServerResponse *response) {
+      const ServerRequestHeader &header = request.header;
+      if (header.type == kServerRequestTopology) {
+        const std::vector<uint32_t> &faces =
+            mesh_extractor.get_topology()->faces;
+        response->header.n_vertices = uint32_t(mesh_extractor.num_vertices());
+        response->append(faces.data(), faces.size());
+        return true;
+      }
+
+      FrameState state;
+      if (header.type == kServerRequestEncodedImage) {
+        if (!DecodeImage(request.payload, header.payload_size,
+                         state.inp_img)) {
+          response->set_error(kServerStatusBadRequest,
+                               "Failed to decode image");
+          return true;
+        }
+      } else if (header.type == kServerRequestRawImage) {
+        if ((header.width == 0) || (header.height == 0) ||
+            ((header.channels != 3) && (header.channels != 4)) ||
+            (header.payload_size !=
+             size_t(header.width) * header.height * header.channels)) {
+          response->set_error(kServerStatusBadRequest, "Invalid raw image");
+          return true;
+        }
+        BytesToImage(request.payload, header.width, header.height,
+                     header.channels, state.inp_img);
+      } else {
+        response->set_error(kServerStatusBadRequest, "Unknown request type");
+        return true;
+      }
+
+      FaceCropper *cropper = nullptr;
+      free_croppers.pop(&cropper);
+      DetectFaces(0, cropper, &state);
+      free_croppers.push(std::move(cropper));
+      if (!state.detected && (detector_name != "none")) {
+        // No faces. Unlike the command line, the image center is not used
+        // (see `ServerResponseHeader::n_faces`).
+        return true;
+      }
+
+      std::vector<Image<float>> &pos_imgs = state.pos_imgs;
+      if (!RunNetwork(0, &state, &pos_imgs)) {
+        response->set_error(kServerStatusFailed, "Failed to run network");
+        return true;
+      }
+
+      const size_t n_pt = face_data.uv_kpt_indices.size() / 2;
+      response->header.n_faces = uint32_t(pos_imgs.size());
+      response->header.n_landmarks = uint32_t(n_pt);
+      response->header.n_vertices = uint32_t(mesh_extractor.num_vertices());
+      std::vector<float> values;
+      for (size_t i = 0; i < pos_imgs.size(); i++) {
+        const CropParam &crop_param = state.crop_params[i];
+        const float kMaxPos = pos_imgs[i].getWidth() * 1.1f;
+        RemapPosition(&pos_imgs[i], crop_param.scale * kMaxPos,
+                      crop_param.shift_x, crop_param.shift_y);
+        response->header.posmap_size = uint32_t(pos_imgs[i].getWidth());
+
+        if (header.outputs & kServerOutputLandmarks) {
+          values.resize(3 * n_pt);
+          for (size_t k = 0; k < n_pt; k++) {
+            const uint32_t x_idx = face_data.uv_kpt_indices[k];
+            const uint32_t y_idx = face_data.uv_kpt_indices[k + n_pt];
+            for (size_t c = 0; c < 3; c++) {
+              values[3 * k + c] = pos_imgs[i].fetch(x_idx, y_idx, c);
+            }
+          }
+          response->append(values.data(), values.size());
+        }
+        if (header.outputs & kServerOutputPosmap) {
+          response->append(pos_imgs[i].getData(),
+                           pos_imgs[i].getWidth() * pos_imgs[i].getHeight() *
+                               3);
+        }
+        if (header.outputs & kServerOutputVertices) {
+          if (!mesh_extractor.gather(pos_imgs[i], &values)) {
+            response->set_error(kServerStatusFailed, "Failed to create mesh");
+            return true;
+          }
+          response->append(values.data(), values.size());
+        }
+      }
+      return true;
+    };
+
+    InferenceServer server;
+    if (use_socket) {
+      InferenceServerOptions server_options;
+      server_options.unix_socket_path = listen_path;
+      server_options.tcp_port = listen_port;
+      if (!server.start(server_options, HandleRequest)) {
+        return -1;
+      }
+    }
+
+    ShmRingServer shm_server;
+    if (!listen_shm.empty()) {
+      ShmRingOptions shm_options;
+      shm_options.name = listen_shm;
+      shm_options.n_slots = size_t(shm_slots);
+      shm_options.replace = shm_replace;
+      if (!shm_server.start(shm_options, HandleRequest)) {
+        return -1;
+      }
+    }
+
+    g_server = &server;
+    g_shm_server = &shm_server;
+    std::signal(SIGINT, StopServer);
+    std::signal(SIGTERM, StopServer);
+    // `run` of a server not started returns immediately.
+    std::thread shm_thread([&shm_server]() { shm_server.run(); });
+    if (use_socket) {
+      server.run();
+      shm_server.stop();
+    }
+    shm_thread.join();
+    g_server = nullptr;
+    g_shm_server = nullptr;
+
+    std::cout << "Stopped server" << std::endl;
+    batch_scheduler->print_stats(std::cout);
+    return 0;
   }
 
-  // Create mesh
-  Mesh mesh;
-  if (!ConvertToMesh(pos_img, face_data, &mesh)) {
-    std::cerr << "failed to convert result image to mesh." << std::endl;
+  pipeline.add_stage(
+      "decode",
+      [&](size_t frame, FrameState *state) {
+        const std::string &image_filename = image_filenames[frame];
+        std::stringstream ss;
+        ss << "Loading image \"" << image_filename << "\"" << std::endl;
+        std::cout << ss.str();
+        if (!LoadImage(image_filename, state->inp_img)) {
+          std::cerr << "Faile to load input image" << std::endl;
+          return false;
+        }
+        return true;
+      },
+      size_t(decode_threads));
+
+  // With keyframes, whether to detect faces depends on the tracking of the
+  // previous frame, so faces are detected in `predict`.
+  pipeline.add_stage(
+      "detect",
+      [&](size_t frame, FrameState *state) {
+        if (!use_keyframes) {
+          FaceCropper *cropper = nullptr;
+          free_croppers.pop(&cropper);
+          DetectFaces(frame, cropper, state);
+          free_croppers.push(std::move(cropper));
+        }
+        return true;
+      },
+      size_t(detect_threads));
+
+  pipeline.add_stage(
+      "predict",
+      [&](size_t frame, FrameState *state) {
+        const Image<float> &inp_img = state->inp_img;
+        std::vector<Image<float>> &pos_imgs = state->pos_imgs;
+        std::vector<Image<float>> &raw_pos_imgs = state->raw_pos_imgs;
+
+        // Skip inference while landmarks are tracked well from the keyframe.
+        bool tracked = false;
+        bool propagated = false;
+        if (!keyframes.empty() &&
+            (frames_since_keyframe < size_t(keyframe_interval))) {
+          tracked = tracker.track(inp_img, &tracked_points, &tracked_status);
+          propagated =
+              tracked && PropagateKeyframes(keyframes, tracked_points,
+                                            tracked_status, keyframe_threshold,
+                                            &pos_imgs);
+        }
+
+        if (propagated) {
+          std::cout << "Propagated position maps from the keyframe"
+                    << std::endl;
+          frames_since_keyframe++;
+          n_skipped_frames++;
+        } else {
+          pos_imgs.clear();
+
+          if (use_keyframes) {
+            DetectFaces(frame, croppers[0].get(), state);
+          }
+          if (!state->detected) {
+            if (detector_name == "none") {
+              std::cout << "Crop image at the image center " << std::endl;
+            } else {
+              std::cout << "Failed to detect face " << std::endl;
+            }
+          }
+
+          const std::vector<CropParam> &crop_params = state->crop_params;
+          auto startT = std::chrono::system_clock::now();
+          if (!RunNetwork(frame, state, &raw_pos_imgs)) {
+            std::cerr << "Failed to run network." << std::endl;
+            return false;
+          }
+          auto endT = std::chrono::system_clock::now();
+          std::chrono::duration<double, std::milli> ms = endT - startT;
+          std::stringstream ss;
+          ss << "Ran network. elapsed = " << ms.count() << " [ms] "
+             << std::endl;
+          std::cout << ss.str();
+
+          for (size_t i = 0; i < crop_params.size(); i++) {
+            const CropParam &crop_param = crop_params[i];
+
+            // kMaxPos comes from `MaxPos` of PosPrediction class in PRNet repo.
+            // Position is remapped to the pixel coordinate of the input image.
+            const float kMaxPos = raw_pos_imgs[i].getWidth() * 1.1f;
+            pos_imgs.push_back(raw_pos_imgs[i]);
+            RemapPosition(&pos_imgs.back(), crop_param.scale * kMaxPos,
+                          crop_param.shift_x, crop_param.shift_y);
+          }
+
+          if (use_keyframes) {
+            // This frame becomes the new keyframe.
+            keyframes.resize(pos_imgs.size());
+            tracked_points.clear();
+            for (size_t i = 0; i < pos_imgs.size(); i++) {
+              SetKeyframe(pos_imgs[i], face_data, &keyframes[i]);
+              tracked_points.insert(tracked_points.end(),
+                                    keyframes[i].landmarks.begin(),
+                                    keyframes[i].landmarks.end());
+            }
+            tracked_status.assign(tracked_points.size() / 2, 1);
+            if (!tracked) {
+              tracker.set_frame(inp_img);
+            }
+            frames_since_keyframe = 1;
+          }
+        }
+
+        return true;
+      },
+      use_batching ? size_t(max_batch) : 1, /* in_order */ !use_batching);
+
+  pipeline.add_stage(
+      "temporal",
+      [&](size_t frame, FrameState *state) {
+        std::vector<Image<float>> &pos_imgs = state->pos_imgs;
+        const std::vector<Image<float>> &raw_pos_imgs = state->raw_pos_imgs;
+
+        // Raw position maps of frames the network ran on.
+        if (!posmap_filename.empty()) {
+          for (size_t i = 0; i < raw_pos_imgs.size(); i++) {
+            if ((raw_pos_imgs[i].getWidth() != kPosmapSize) ||
+                (raw_pos_imgs[i].getHeight() != kPosmapSize) ||
+                (raw_pos_imgs[i].getChannels() != 3)) {
+              std::cerr << "Unexpected size of the position map." << std::endl;
+              return false;
+            }
+            const CropParam &crop_param = state->crop_params[i];
+            const float kMaxPos = raw_pos_imgs[i].getWidth() * 1.1f;
+            std::shared_ptr<Image<float>> posmap(
+                new Image<float>(raw_pos_imgs[i]));
+            const std::vector<float> params = {
+                float(posmap_first_frame + frame), float(i),
+                crop_param.scale * kMaxPos,
+                crop_param.shift_x, crop_param.shift_y};
+            async_writer.submit_ordered(
+                [&posmap_writer, &posmap_params_writer, posmap, params]() {
+                  return posmap_writer.append(posmap->getData()) &&
+                         posmap_params_writer.append(params.data());
+                });
+          }
+        }
+
+        const size_t n_faces = pos_imgs.size();
+        std::cout << "# of faces : " << n_faces << std::endl;
+
+        if (smooth) {
+          filters.apply(&pos_imgs, 1.0f / fps);
+        }
+        return true;
+      },
+      1, /* in_order */ true);
+
+  pipeline.add_stage(
+      "postprocess",
+      [&](size_t, FrameState *state) {
+        if (posmap_only) {
+          return true;
+        }
+
+        const Image<float> &inp_img = state->inp_img;
+        const size_t n_faces = state->pos_imgs.size();
+        state->faces.resize(n_faces);
+
+        // Landmarks of all faces are drawn into one image.
+        state->dbg_lmk_image = inp_img;  // copy
+
+        for (size_t i = 0; i < n_faces; i++) {
+          const Image<float> &pos_img = state->pos_imgs[i];
+          FaceOutput &face = state->faces[i];
+
+          // Create texture image
+          face.has_texture = CreateTexture(inp_img, pos_img, 1.0f, 0.0f, 0.0f,
+                                           size_t(texture_size), &face.texture);
+          if (face.has_texture && mask_occlusion) {
+            face.has_visibility =
+                MaskOccludedTexels(inp_img, pos_img, mesh_extractor,
+                                   &face.texture, &face.visibility);
+          }
+
+          // Create mesh
+          if (!mesh_extractor.extract(pos_img, &face.mesh,
+                                      face.mesh_center)) {
+            std::cerr << "failed to convert result image to mesh." << std::endl;
+            return false;
+          }
+          ComputeVertexNormals(&face.mesh);
+
+          // Draw landmarks
+          DrawLandmark(pos_img, face_data, &state->dbg_lmk_image);
+
+          // Head pose
+          face.has_pose = pose_estimator.estimate(face.mesh, &face.pose);
+
+          // Frontalization
+          face.front_mesh = face.mesh;  // copies vertices only.
+          if (frontalize_method == "pose") {
+            if (face.has_pose) {
+              PoseEstimator::Frontalize(face.pose, &face.front_mesh);
+              face.frontalized = true;
+            }
+          } else {
+            face.frontalized = FrontalizeFaceMesh(&face.front_mesh, face_data);
+          }
+          if (face.frontalized) {
+            ComputeVertexNormals(&face.front_mesh);
+          }
+        }
+        return true;
+      },
+      size_t(postprocess_threads));
+
+  pipeline.add_stage(
+      "output",
+      [&](size_t frame, FrameState *state) {
+        if (posmap_only) {
+          return true;
+        }
+
+        const size_t n_faces = state->faces.size();
+        auto OutputFilename = [&](const std::string &filename, size_t face_id) {
+          return FaceFilename(FrameFilename(filename, frame, n_frames), face_id,
+                              n_faces);
+        };
+
+        for (size_t i = 0; i < n_faces; i++) {
+          FaceOutput &face = state->faces[i];
+
+          if (face.has_visibility) {
+            SaveImageAsync(OutputFilename("texture_visibility.jpg", i),
+                           face.visibility);
+          }
+          if (face.has_texture) {
+            // in linear space.
+            SaveImageAsync(OutputFilename("texture.jpg", i), face.texture);
+          }
+
+          if (face.has_pose) {
+            // Pose in the pixel coordinate of the input image, i.e. the mesh
+            // before centerization.
+            Pose pose = face.pose;
+            for (int k = 0; k < 3; k++) {
+              pose.translation[k] += face.mesh_center[k];
+            }
+            std::cout << "pose(yaw, pitch, roll) = " << pose.yaw << ", "
+                      << pose.pitch << ", " << pose.roll << " [deg]"
+                      << std::endl;
+            const std::string pose_filename = OutputFilename("pose.txt", i);
+            async_writer.submit([pose_filename, pose]() {
+              return SavePose(pose_filename, pose);
+            });
+          }
+
+          // Write meshes. The texture embedded into .glb is also encoded on
+          // the I/O thread.
+          std::shared_ptr<Mesh> mesh(new Mesh(std::move(face.mesh)));
+          std::shared_ptr<Mesh> front_mesh(
+              face.frontalized ? new Mesh(std::move(face.front_mesh)) : nullptr);
+          if (write_sequence) {
+            async_writer.submit_ordered([&, i, frame, mesh, front_mesh]() {
+              return AppendToSequence(&sequence_writers, "output.prnseq", i,
+                                      frame, *mesh) &&
+                     (!front_mesh ||
+                      AppendToSequence(&front_sequence_writers,
+                                       "output_front.prnseq", i, frame,
+                                       *front_mesh));
+            });
+          } else {
+            std::shared_ptr<Image<float>> texture(
+                (face.has_texture && (mesh_format == "glb"))
+                    ? new Image<float>(face.texture)
+                    : nullptr);
+            const std::string mesh_filename =
+                OutputFilename("output" + mesh_ext, i);
+            const std::string front_mesh_filename =
+                OutputFilename("output_front" + mesh_ext, i);
+            async_writer.submit([&mesh_writer, &mesh_writer_mutex, mesh,
+                                 front_mesh, texture, mesh_filename,
+                                 front_mesh_filename]() {
+              // Texture is embedded into .glb.
+              EncodedImage encoded_texture;
+              const bool embed_texture =
+                  texture && EncodeImage(*texture, &encoded_texture);
+              std::lock_guard<std::mutex> lock(mesh_writer_mutex);
+              bool ok = mesh_writer->write(mesh_filename, *mesh, 255.0f,
+                                           embed_texture ? &encoded_texture
+                                                         : nullptr);
+              if (front_mesh) {
+                ok &= mesh_writer->write(front_mesh_filename, *front_mesh,
+                                         255.0f, embed_texture ? &encoded_texture
+                                                               : nullptr);
+              }
+              return ok;
+            });
+          }
+
+#ifdef USE_GUI
+          if ((frame == 0) && (i == 0)) {
+            gui_mesh = *mesh;
+            if (front_mesh) {
+              gui_front_mesh = *front_mesh;
+            }
+            gui_texture = std::move(face.texture);
+          }
+#endif
+        }
+
+        SaveImageAsync(FrameFilename("landmarks.jpg", frame, n_frames),
+                       state->dbg_lmk_image);
+
+#ifdef USE_GUI
+        if ((frame == 0) && !state->raw_pos_imgs.empty()) {
+          debug_images = {state->dbg_lmk_image, state->raw_pos_imgs[0]};
+        }
+#endif
+        return true;
+      },
+      1, /* in_order */ true);
+
+  if (!pipeline.run(n_frames)) {
+    return -1;
+  }
+  std::cout << "Pipeline stages:" << std::endl;
+  pipeline.print_stats(std::cout);
+  if (batch_scheduler) {
+    batch_scheduler->print_stats(std::cout);
+  }
+
+  if (!async_writer.wait()) {
+    std::cerr << "Failed to write output files." << std::endl;
     return -1;
   }
-  SaveAsWObj("output.obj", mesh);
+  if (async_writer.num_stalls() > 0) {
+    std::cout << "Waited for output files " << async_writer.num_stalls()
+              << " times(consider increasing --io_threads)" << std::endl;
+  }
 
-  // Draw landmarks
-  Image<float> dbg_lmk_image;
-  DrawLandmark(color_img, pos_img, face_data, &dbg_lmk_image);
-  SaveImage("landmarks.jpg", dbg_lmk_image);
+  for (auto &writer : sequence_writers) {
+    if (writer && !writer->close()) {
+      return -1;
+    }
+  }
+  for (auto &writer : front_sequence_writers) {
+    if (writer && !writer->close()) {
+      return -1;
+    }
+  }
 
-  // Frontalization
-  Mesh front_mesh = mesh;  // copy
-  FrontalizeFaceMesh(&front_mesh, face_data);
-  SaveAsWObj("output_front.obj", front_mesh);
+  if (keyframe_interval > 1) {
+    std::cout << "Skipped inference in " << n_skipped_frames << " / "
+              << n_frames << " frames(skip ratio = "
+              << double(n_skipped_frames) / double(n_frames) << ")"
+              << std::endl;
+  }
 
 #ifdef USE_GUI
-  std::vector<Image<float>> debug_images = {dbg_lmk_image, raw_pos_img};
-  bool ret = RunUI(mesh, front_mesh, color_img, debug_images);
-  if (!ret) {
-    std::cerr << "failed to run GUI." << std::endl;
+  if (!posmap_only) {
+    bool ret = RunUI(gui_mesh, gui_front_mesh, gui_texture, debug_images);
+    if (!ret) {
+      std::cerr << "failed to run GUI." << std::endl;
+    }
   }
 #endif
 
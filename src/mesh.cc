@@ -0,0 +1,94 @@
+#include "mesh.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace prnet {
+
+void BuildVertexFaceAdjacency(size_t num_vertices, MeshTopology *topology) {
+  const std::vector<uint32_t> &faces = topology->faces;
+  std::vector<uint32_t> &offsets = topology->vertex_face_offsets;
+  std::vector<uint32_t> &vertex_faces = topology->vertex_faces;
+
+  // Count faces per vertex, then prefix sum.
+  offsets.assign(num_vertices + 1, 0);
+  for (size_t i = 0; i < faces.size(); i++) {
+    offsets[faces[i] + 1]++;
+  }
+  for (size_t i = 0; i < num_vertices; i++) {
+    offsets[i + 1] += offsets[i];
+  }
+
+  std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+  vertex_faces.resize(faces.size());
+  for (size_t i = 0; i < faces.size(); i++) {
+    vertex_faces[cursor[faces[i]]++] = uint32_t(i / 3);
+  }
+}
+
+bool ComputeVertexNormals(Mesh *mesh) {
+  if (!mesh->topology) {
+    std::cerr << "Mesh has no topology." << std::endl;
+    return false;
+  }
+  const MeshTopology &topology = *(mesh->topology);
+  const size_t n_vertices = mesh->num_vertices();
+  const size_t n_faces = mesh->num_faces();
+  if (topology.vertex_face_offsets.size() != n_vertices + 1) {
+    std::cerr << "Topology has no vertex -> face adjacency." << std::endl;
+    return false;
+  }
+
+  ThreadPool &pool = GetSharedThreadPool();
+  const size_t kChunkSize = 4096;
+
+  // Face normals. Length is twice the area of the face, so that summing them
+  // gives area weighted vertex normals. Orientation matches `CalcNormal` of
+  // the GUI renderer.
+  const float *v = mesh->vertices.data();
+  const uint32_t *faces = topology.faces.data();
+  std::vector<float> face_normals(3 * n_faces);
+  pool.parallel_for((n_faces + kChunkSize - 1) / kChunkSize, [&](size_t chunk) {
+    const size_t end = std::min(n_faces, (chunk + 1) * kChunkSize);
+    for (size_t f = chunk * kChunkSize; f < end; f++) {
+      const float *v0 = &v[3 * faces[3 * f + 0]];
+      const float *v1 = &v[3 * faces[3 * f + 1]];
+      const float *v2 = &v[3 * faces[3 * f + 2]];
+      const float e1[3] = {v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2]};
+      const float e2[3] = {v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2]};
+      face_normals[3 * f + 0] = e2[1] * e1[2] - e2[2] * e1[1];
+      face_normals[3 * f + 1] = e2[2] * e1[0] - e2[0] * e1[2];
+      face_normals[3 * f + 2] = e2[0] * e1[1] - e2[1] * e1[0];
+    }
+  });
+
+  // Vertex normals. Each vertex gathers normals of adjacent faces, so no
+  // atomics nor per thread accumulation buffers are required.
+  mesh->normals.resize(3 * n_vertices);
+  float *normals = mesh->normals.data();
+  const uint32_t *offsets = topology.vertex_face_offsets.data();
+  const uint32_t *vertex_faces = topology.vertex_faces.data();
+  pool.parallel_for((n_vertices + kChunkSize - 1) / kChunkSize, [&](size_t chunk) {
+    const size_t end = std::min(n_vertices, (chunk + 1) * kChunkSize);
+    for (size_t i = chunk * kChunkSize; i < end; i++) {
+      float n[3] = {0.0f, 0.0f, 0.0f};
+      for (uint32_t k = offsets[i]; k < offsets[i + 1]; k++) {
+        const float *fn = &face_normals[3 * vertex_faces[k]];
+        n[0] += fn[0];
+        n[1] += fn[1];
+        n[2] += fn[2];
+      }
+      const float len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+      const float inv_len = (len > 0.0f) ? (1.0f / len) : 0.0f;
+      normals[3 * i + 0] = n[0] * inv_len;
+      normals[3 * i + 1] = n[1] * inv_len;
+      normals[3 * i + 2] = n[2] * inv_len;
+    }
+  });
+
+  return true;
+}
+
+} // namespace prnet
@@ -1,39 +1,55 @@
 #ifndef PRNET_INFER_MESH_H_
 #define PRNET_INFER_MESH_H_
 
-#include <vector>
 #include <cstdint>
+#include <memory>
+#include <vector>
 
 namespace prnet {
 
+///
+/// Triangles and texture coordinates. PRNet meshes share the same topology
+/// (defined by `triangles.txt` and `face_ind.txt`), so it is immutable and
+/// shared between meshes.
+///
+struct MeshTopology {
+  std::vector<uint32_t> faces;  // 3 * # of faces
+  std::vector<float> uvs;       // per vertex uv. (0, 0) = top-left of texture.
+
+  // Vertex -> face adjacency(CSR). Faces around vertex `i` are
+  // vertex_faces[vertex_face_offsets[i]] ... vertex_faces[vertex_face_offsets[i + 1] - 1]
+  std::vector<uint32_t> vertex_face_offsets;  // # of vertices + 1
+  std::vector<uint32_t> vertex_faces;
+};
+
+///
+/// Builds vertex -> face adjacency of `topology`.
+///
+void BuildVertexFaceAdjacency(size_t num_vertices, MeshTopology *topology);
+
 ///
 /// Simple mesh representation.
+/// Copying a mesh copies vertices only.
 ///
 class Mesh
 {
   public:
-    Mesh() {}
-    Mesh(const Mesh &rhs) {
-      vertices = rhs.vertices;
-      faces = rhs.faces;
-      uvs = rhs.uvs;
-    }
-    Mesh &operator=(const Mesh &rhs) {
-      vertices = rhs.vertices;
-      faces = rhs.faces;
-      uvs = rhs.uvs;
-
-      return (*this);
-    }
-    ~Mesh() {}
+    size_t num_vertices() const { return vertices.size() / 3; }
+    size_t num_faces() const { return topology ? topology->faces.size() / 3 : 0; }
 
   std::vector<float> vertices;
-  std::vector<uint32_t> faces;  // 3 * # of faces
-  std::vector<float> uvs; // per vertex uv
+  std::vector<float> normals;  // per vertex normal. optional
+  std::shared_ptr<const MeshTopology> topology;
 
-}; 
+};
+
+///
+/// Computes area weighted vertex normals of `mesh` into `mesh->normals`.
+/// Requires vertex -> face adjacency in the topology.
+///
+bool ComputeVertexNormals(Mesh *mesh);
 
 
-}; 
+} // namespace prnet
 
 #endif // PRNET_INFER_MESH_H_
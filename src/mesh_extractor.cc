@@ -0,0 +1,161 @@
+#include "mesh_extractor.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace prnet {
+
+bool MeshExtractor::init(const FaceData &face_data, size_t pos_width,
+                         size_t pos_height) {
+  width = pos_width;
+  height = pos_height;
+  offsets.clear();
+  topology.reset();
+
+  const size_t n_pixels = pos_width * pos_height;
+  offsets.resize(face_data.face_indices.size());
+  for (size_t i = 0; i < face_data.face_indices.size(); i++) {
+    const uint32_t idx = face_data.face_indices[i];
+    if (idx >= n_pixels) {
+      std::cerr << "Invalid face index. " << idx << " is greater or equal to "
+                << n_pixels << std::endl;
+      offsets.clear();
+      return false;
+    }
+    offsets[i] = 3 * idx;
+  }
+
+  if ((face_data.triangles.size() % 3) != 0) {
+    std::cerr << "Invalid number of triangle indices : "
+              << face_data.triangles.size() << std::endl;
+    offsets.clear();
+    return false;
+  }
+
+  const size_t n_vertices = offsets.size();
+  for (size_t i = 0; i < face_data.triangles.size(); i++) {
+    const uint32_t idx = face_data.triangles[i];
+    if (idx >= n_vertices) {
+      std::cerr << "Invalid triangle index. " << idx
+                << " is greater or equal to " << n_vertices << std::endl;
+      offsets.clear();
+      return false;
+    }
+  }
+
+  std::shared_ptr<MeshTopology> topo(new MeshTopology());
+  topo->faces.assign(face_data.triangles.begin(), face_data.triangles.end());
+  topo->uvs.resize(2 * n_vertices);
+  for (size_t i = 0; i < n_vertices; i++) {
+    const uint32_t idx = face_data.face_indices[i];
+    // Center of the texel.
+    topo->uvs[2 * i + 0] = (float(idx % pos_width) + 0.5f) / float(pos_width);
+    topo->uvs[2 * i + 1] = (float(idx / pos_width) + 0.5f) / float(pos_height);
+  }
+  BuildVertexFaceAdjacency(n_vertices, topo.get());
+  topology = topo;
+
+  return true;
+}
+
+bool MeshExtractor::validate(const Image<float> &pos_img) const {
+  if ((pos_img.getWidth() != width) || (pos_img.getHeight() != height) ||
+      (pos_img.getChannels() != 3)) {
+    std::cerr << "Invalid position map. Must be " << width << " x " << height
+              << " x 3 but has " << pos_img.getWidth() << " x "
+              << pos_img.getHeight() << " x " << pos_img.getChannels()
+              << std::endl;
+    return false;
+  }
+
+  if (offsets.empty()) {
+    std::cerr << "MeshExtractor is not initialized." << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool MeshExtractor::gather(const Image<float> &pos_img,
+                           std::vector<float> *vertices) const {
+  if (!validate(pos_img)) {
+    return false;
+  }
+
+  const size_t n = offsets.size();
+  vertices->resize(3 * n);
+  const float *src = pos_img.getData();
+  float *dst = vertices->data();
+  for (size_t i = 0; i < n; i++) {
+    dst[3 * i + 0] = src[offsets[i] + 0];
+    dst[3 * i + 1] = src[offsets[i] + 1];
+    dst[3 * i + 2] = src[offsets[i] + 2];
+  }
+
+  return true;
+}
+
+bool MeshExtractor::extract(const Image<float> &pos_img, Mesh *mesh,
+                            float *center_out) const {
+  if (!validate(pos_img)) {
+    return false;
+  }
+
+  const size_t n = offsets.size();
+  mesh->vertices.resize(3 * n);
+  mesh->topology = topology;
+
+  const float *src = pos_img.getData();
+  const uint32_t *offs = offsets.data();
+  float *dst = mesh->vertices.data();
+
+  // Gather + bounding box.
+  float bmin[3] = {src[offs[0] + 0], src[offs[0] + 1], src[offs[0] + 2]};
+  float bmax[3] = {bmin[0], bmin[1], bmin[2]};
+  for (size_t i = 0; i < n; i++) {
+    const float x = src[offs[i] + 0];
+    const float y = src[offs[i] + 1];
+    const float z = src[offs[i] + 2];
+
+    dst[3 * i + 0] = x;
+    dst[3 * i + 1] = y;
+    dst[3 * i + 2] = z;
+
+    bmin[0] = std::min(bmin[0], x);
+    bmin[1] = std::min(bmin[1], y);
+    bmin[2] = std::min(bmin[2], z);
+    bmax[0] = std::max(bmax[0], x);
+    bmax[1] = std::max(bmax[1], y);
+    bmax[2] = std::max(bmax[2], z);
+  }
+
+  // Centerize vertex position. The center depends on every vertex, so this is
+  // a second pass, but over the contiguous(and cached) vertex buffer rather
+  // than the scattered position map. xyz are flattened into blocks of 12
+  // floats(4 vertices) so that the loop is vectorized.
+  const float center[3] = {0.5f * (bmin[0] + bmax[0]),
+                           0.5f * (bmin[1] + bmax[1]),
+                           0.5f * (bmin[2] + bmax[2])};
+  float center12[12];
+  for (size_t k = 0; k < 12; k++) {
+    center12[k] = center[k % 3];
+  }
+  size_t i = 0;
+  for (; i + 12 <= 3 * n; i += 12) {
+    for (size_t k = 0; k < 12; k++) {
+      dst[i + k] -= center12[k];
+    }
+  }
+  for (; i < 3 * n; i++) {
+    dst[i] -= center[i % 3];
+  }
+  if (center_out) {
+    center_out[0] = center[0];
+    center_out[1] = center[1];
+    center_out[2] = center[2];
+  }
+
+  return true;
+}
+
+} // namespace prnet
@@ -0,0 +1,57 @@
+#ifndef PRNET_INFER_MESH_EXTRACTOR_H_
+#define PRNET_INFER_MESH_EXTRACTOR_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "face-data.h"
+#include "image.h"
+#include "mesh.h"
+
+namespace prnet {
+
+///
+/// Converts a 3D position map to a mesh.
+///
+/// Gather offsets(position map pixel of each vertex) and the validated
+/// topology are computed once in `init`, so `extract` is a single gather
+/// pass over the position map. Extracted meshes share the topology.
+///
+class MeshExtractor {
+public:
+  // `pos_width` x `pos_height` is the resolution of position maps(256x256).
+  // Returns false when `face_data` has an invalid index.
+  bool init(const FaceData &face_data, size_t pos_width = 256,
+            size_t pos_height = 256);
+
+  // Looks up vertex positions from `pos_img`(remapped position map) and
+  // centerizes them. Vertex buffer of `mesh` is reused. The center(of the
+  // bounding box) subtracted from the vertices is stored to `center`(3 floats)
+  // if not null.
+  // uv of the mesh is a pixel of the position map, i.e. texture created from
+  // the position map(see `CreateTexture` in main.cc).
+  bool extract(const Image<float> &pos_img, Mesh *mesh,
+               float *center = nullptr) const;
+
+  // Looks up vertex positions from `pos_img` as is(e.g. posed vertices in the
+  // image coordinate). `vertices` has 3 * num_vertices() elements.
+  bool gather(const Image<float> &pos_img, std::vector<float> *vertices) const;
+
+  size_t num_vertices() const { return offsets.size(); }
+
+  const std::shared_ptr<const MeshTopology> &get_topology() const {
+    return topology;
+  }
+
+private:
+  bool validate(const Image<float> &pos_img) const;
+
+  size_t width = 0;
+  size_t height = 0;
+  std::vector<uint32_t> offsets;  // float offset of a vertex in position map.
+  std::shared_ptr<const MeshTopology> topology;
+};
+
+} // namespace prnet
+
+#endif // PRNET_INFER_MESH_EXTRACTOR_H_
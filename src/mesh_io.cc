@@ -0,0 +1,720 @@
+#include "mesh_io.h"
+#include "thread_pool.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <vector>
+
+namespace prnet {
+
+namespace {
+
+const double kPow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                         1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                         1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+const int kMaxExactPow10 = 22;
+
+const char kDigitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Checks if `s` is parsed as `v` exactly. Compares bit patterns rather than
+// floats with `==`(-Wfloat-equal). `v` is never a NaN or a zero here.
+inline bool ParsesTo(const char *s, float v) {
+  const float parsed = std::strtof(s, nullptr);
+  return memcmp(&parsed, &v, sizeof(float)) == 0;
+}
+
+// Writes decimal digits of `v` and returns the # of chars.
+inline size_t FormatUInt(uint64_t v, char *buf) {
+  char tmp[20];
+  char *p = tmp + sizeof(tmp);
+  while (v >= 100) {
+    const size_t i = size_t(v % 100) * 2;
+    v /= 100;
+    *--p = kDigitPairs[i + 1];
+    *--p = kDigitPairs[i];
+  }
+  if (v >= 10) {
+    const size_t i = size_t(v) * 2;
+    *--p = kDigitPairs[i + 1];
+    *--p = kDigitPairs[i];
+  } else {
+    *--p = char('0' + v);
+  }
+  const size_t n = size_t(tmp + sizeof(tmp) - p);
+  memcpy(buf, p, n);
+  return n;
+}
+
+// Writes `digits` * 10^`exp10` like printf's %g(without trailing zeros).
+size_t FormatDecimal(bool negative, uint64_t digits, int exp10, char *buf) {
+  while ((digits != 0) && (digits % 10 == 0)) {
+    digits /= 10;
+    exp10++;
+  }
+
+  char tmp[20];
+  const int n = int(FormatUInt(digits, tmp));
+  // Exponent of the first digit.
+  const int e = n - 1 + exp10;
+
+  char *p = buf;
+  if (negative) {
+    *p++ = '-';
+  }
+  if ((e >= -5) && (e < 9)) {
+    if (e < 0) {
+      *p++ = '0';
+      *p++ = '.';
+      for (int i = 0; i < -e - 1; i++) {
+        *p++ = '0';
+      }
+      memcpy(p, tmp, size_t(n));
+      p += n;
+    } else if (n <= e + 1) {
+      memcpy(p, tmp, size_t(n));
+      p += n;
+      for (int i = 0; i < e + 1 - n; i++) {
+        *p++ = '0';
+      }
+    } else {
+      memcpy(p, tmp, size_t(e + 1));
+      p += e + 1;
+      *p++ = '.';
+      memcpy(p, tmp + e + 1, size_t(n - e - 1));
+      p += n - e - 1;
+    }
+  } else {
+    *p++ = tmp[0];
+    if (n > 1) {
+      *p++ = '.';
+      memcpy(p, tmp + 1, size_t(n - 1));
+      p += n - 1;
+    }
+    *p++ = 'e';
+    *p++ = (e < 0) ? '-' : '+';
+    const int ae = (e < 0) ? -e : e;
+    if (ae < 10) {
+      *p++ = '0';
+    }
+    p += FormatUInt(uint64_t(ae), p);
+  }
+  *p = '\0';
+  return size_t(p - buf);
+}
+
+// Slow path with printf/strtof for values out of the range of `kPow10`.
+size_t FormatFloatSlow(float v, char *buf) {
+  for (int precision = 1; precision < 9; precision++) {
+    snprintf(buf, kMaxFloatChars + 1, "%.*g", precision, double(v));
+    if (ParsesTo(buf, v)) {
+      return strlen(buf);
+    }
+  }
+  snprintf(buf, kMaxFloatChars + 1, "%.9g", double(v));
+  return strlen(buf);
+}
+
+// Checks if the decimal `digits` * 10^`-k` is parsed as `a`. `lo` and `hi`
+// are the midpoints to the neighboring floats scaled by 10^`k`. They may be
+// off by an ulp of double, so it is decided in double unless `digits` is too
+// close to them.
+bool RoundTrips(uint64_t digits, int k, float a, double lo, double hi) {
+  const double kMargin = 4.0 * std::numeric_limits<double>::epsilon();
+  const double d = double(digits);
+  if ((d > lo * (1.0 + kMargin)) && (d < hi * (1.0 - kMargin))) {
+    return true;
+  }
+  if ((d < lo * (1.0 - kMargin)) || (d > hi * (1.0 + kMargin))) {
+    return false;
+  }
+  char buf[kMaxFloatChars + 1];
+  FormatDecimal(false, digits, -k, buf);
+  return ParsesTo(buf, a);
+}
+
+// a * 10^k. Correctly rounded since 10^|k| is exact.
+inline double Scale10(double a, int k) {
+  return (k >= 0) ? a * kPow10[k] : a / kPow10[-k];
+}
+
+inline size_t CopyString(const char *s, char *buf) {
+  const size_t n = strlen(s);
+  memcpy(buf, s, n + 1);
+  return n;
+}
+
+// Appends " a/a" or " a/a/a"(1 based vertex index).
+inline char *AppendFaceVertex(uint32_t index, bool with_normals, char *p) {
+  char tmp[20];
+  const size_t n = FormatUInt(uint64_t(index) + 1, tmp);
+  *p++ = ' ';
+  memcpy(p, tmp, n);
+  p += n;
+  *p++ = '/';
+  memcpy(p, tmp, n);
+  p += n;
+  if (with_normals) {
+    *p++ = '/';
+    memcpy(p, tmp, n);
+    p += n;
+  }
+  return p;
+}
+
+// Formats `n` lines of `prefix` followed by `dim` values in parallel.
+void FormatLines(const char *prefix, const float *values, size_t n,
+                 size_t dim, const float *scales, const float *offsets,
+                 std::vector<std::string> *chunks) {
+  const size_t kLinesPerChunk = 4096;
+  const size_t n_chunks = (n + kLinesPerChunk - 1) / kLinesPerChunk;
+  const size_t prefix_len = strlen(prefix);
+  chunks->assign(n_chunks, std::string());
+  GetSharedThreadPool().parallel_for(n_chunks, [&](size_t c) {
+    const size_t begin = c * kLinesPerChunk;
+    const size_t end = std::min(n, begin + kLinesPerChunk);
+    std::string &text = (*chunks)[c];
+    text.resize((end - begin) * (prefix_len + dim * (kMaxFloatChars + 1) + 1));
+    char *p = &text[0];
+    for (size_t i = begin; i < end; i++) {
+      memcpy(p, prefix, prefix_len);
+      p += prefix_len;
+      for (size_t k = 0; k < dim; k++) {
+        *p++ = ' ';
+        p += FormatFloat(offsets[k] + scales[k] * values[dim * i + k], p);
+      }
+      *p++ = '\n';
+    }
+    text.resize(size_t(p - &text[0]));
+  });
+}
+
+bool WriteChunks(FILE *fp, const std::vector<std::string> &chunks) {
+  for (const std::string &chunk : chunks) {
+    if (fwrite(chunk.data(), 1, chunk.size(), fp) != chunk.size()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+inline bool IsLittleEndian() {
+  const uint32_t one = 1;
+  unsigned char c;
+  memcpy(&c, &one, 1);
+  return c == 1;
+}
+
+// Writes `n` 4 byte values(float or uint32) in little endian.
+bool WriteLE32(FILE *fp, const void *data, size_t n) {
+  if (n == 0) {
+    return true;
+  }
+  if (IsLittleEndian()) {
+    return fwrite(data, 4, n, fp) == n;
+  }
+  const unsigned char *src = static_cast<const unsigned char *>(data);
+  std::vector<unsigned char> buf(4 * std::min(n, size_t(65536)));
+  for (size_t i = 0; i < n;) {
+    const size_t m = std::min(n - i, buf.size() / 4);
+    for (size_t j = 0; j < m; j++) {
+      for (size_t b = 0; b < 4; b++) {
+        buf[4 * j + b] = src[4 * (i + j) + 3 - b];
+      }
+    }
+    if (fwrite(buf.data(), 4, m, fp) != m) {
+      return false;
+    }
+    i += m;
+  }
+  return true;
+}
+
+inline void StoreLE32(uint32_t v, unsigned char *p) {
+  p[0] = static_cast<unsigned char>(v & 0xff);
+  p[1] = static_cast<unsigned char>((v >> 8) & 0xff);
+  p[2] = static_cast<unsigned char>((v >> 16) & 0xff);
+  p[3] = static_cast<unsigned char>((v >> 24) & 0xff);
+}
+
+inline std::string FloatToString(float v) {
+  char buf[kMaxFloatChars + 1];
+  FormatFloat(v, buf);
+  return buf;
+}
+
+inline size_t Align4(size_t n) { return (n + 3) & ~size_t(3); }
+
+} // anonymous namespace
+
+MeshWriter::~MeshWriter() {}
+
+std::unique_ptr<MeshWriter> CreateMeshWriter(const std::string &format) {
+  if (format == "obj") {
+    return std::unique_ptr<MeshWriter>(new ObjWriter());
+  } else if (format == "ply") {
+    return std::unique_ptr<MeshWriter>(new PlyWriter());
+  } else if (format == "glb") {
+    return std::unique_ptr<MeshWriter>(new GlbWriter());
+  }
+  std::cerr << "Unknown mesh format : " << format << std::endl;
+  return nullptr;
+}
+
+size_t FormatFloat(float v, char *buf) {
+  if (std::isnan(v)) {
+    return CopyString("nan", buf);
+  }
+  if (std::isinf(v)) {
+    return CopyString((v < 0.0f) ? "-inf" : "inf", buf);
+  }
+  if (std::fpclassify(v) == FP_ZERO) {
+    return CopyString(std::signbit(v) ? "-0" : "0", buf);
+  }
+
+  const bool negative = (v < 0.0f);
+  const float a = std::fabs(v);
+
+  uint32_t bits;
+  memcpy(&bits, &a, sizeof(float));
+  if (bits < 0x00800000u) {
+    // Denormal
+    return FormatFloatSlow(v, buf);
+  }
+
+  // Midpoints to the neighboring floats(exact in double). The lower one is
+  // closer for powers of 2.
+  const int e2 = int(bits >> 23) - 127;
+  const double ulp = std::ldexp(1.0, e2 - 23);
+  const double lo = double(a) - (((bits & 0x7fffffu) == 0) ? 0.25 : 0.5) * ulp;
+  const double hi = double(a) + 0.5 * ulp;
+
+  // Exponent of the first digit. floor(e2 * log10(2)) is off by at most one.
+  int e10 = (e2 >= 0) ? ((e2 * 78913) >> 18) : -(((-e2) * 78913 + 262143) >> 18);
+  if ((e10 + 1 > kMaxExactPow10) || (9 - 1 - e10 > kMaxExactPow10)) {
+    return FormatFloatSlow(v, buf);
+  }
+  if (Scale10(double(a), -(e10 + 1)) >= 1.0) {
+    e10++;
+  }
+
+  // Closest decimal with `precision` digits which round trips.
+  auto Candidate = [&](int precision, uint64_t *digits) {
+    // a * 10^k has `precision` digits in the integer part.
+    const int k = precision - 1 - e10;
+    const double t = Scale10(double(a), k);
+    const double tl = Scale10(lo, k);
+    const double th = Scale10(hi, k);
+    const uint64_t d0 = uint64_t(t);  // floor
+    // Try the closer one first.
+    const bool up_first = (t - double(d0)) >= 0.5;
+    const uint64_t first = up_first ? d0 + 1 : d0;
+    const uint64_t second = up_first ? d0 : d0 + 1;
+    if ((first > 0) && RoundTrips(first, k, a, tl, th)) {
+      (*digits) = first;
+      return true;
+    }
+    if ((second > 0) && RoundTrips(second, k, a, tl, th)) {
+      (*digits) = second;
+      return true;
+    }
+    return false;
+  };
+
+  // If a decimal with p digits round trips, so does the one with p + 1 digits
+  // (append 0). So the shortest one is found with binary search.
+  int shortest = 0;
+  uint64_t digits = 0;
+  int lo_precision = 1;
+  int hi_precision = 9;
+  while (lo_precision <= hi_precision) {
+    const int precision = (lo_precision + hi_precision) / 2;
+    uint64_t d;
+    if (Candidate(precision, &d)) {
+      shortest = precision;
+      digits = d;
+      hi_precision = precision - 1;
+    } else {
+      lo_precision = precision + 1;
+    }
+  }
+  if (shortest > 0) {
+    return FormatDecimal(negative, digits, e10 + 1 - shortest, buf);
+  }
+
+  return FormatFloatSlow(v, buf);
+}
+
+void ObjWriter::update_topology_text(
+    const std::shared_ptr<const MeshTopology> &topo, bool with_normals) {
+  if ((topo == topology) && (with_normals == faces_with_normals)) {
+    return;
+  }
+
+  if (topo != topology) {
+    const float scales[2] = {1.0f, -1.0f};
+    const float offsets[2] = {0.0f, 1.0f};  // .obj's uv origin is bottom-left.
+    std::vector<std::string> chunks;
+    FormatLines("vt", topo->uvs.data(), topo->uvs.size() / 2, 2, scales,
+                offsets, &chunks);
+    uv_text.clear();
+    for (const std::string &chunk : chunks) {
+      uv_text += chunk;
+    }
+  }
+
+  // For .obj, face index starts with 1. # of v == # of vt(== # of vn).
+  const std::vector<uint32_t> &faces = topo->faces;
+  face_text.resize((faces.size() / 3) * (2 + 3 * (1 + 3 * 11)) + 1);
+  char *p = &face_text[0];
+  for (size_t i = 0; i < faces.size() / 3; i++) {
+    *p++ = 'f';
+    p = AppendFaceVertex(faces[3 * i + 0], with_normals, p);
+    p = AppendFaceVertex(faces[3 * i + 1], with_normals, p);
+    p = AppendFaceVertex(faces[3 * i + 2], with_normals, p);
+    *p++ = '\n';
+  }
+  face_text.resize(size_t(p - &face_text[0]));
+
+  topology = topo;
+  faces_with_normals = with_normals;
+}
+
+bool ObjWriter::write(const std::string &filename, const Mesh &mesh,
+                      float vertex_scale, const EncodedImage *texture) {
+  (void)texture;  // .mtl is not supported yet.
+
+  const bool has_normals = (mesh.normals.size() == mesh.vertices.size());
+
+  std::vector<std::string> vertex_chunks, normal_chunks;
+  {
+    const float scales[3] = {vertex_scale, vertex_scale, vertex_scale};
+    const float offsets[3] = {0.0f, 0.0f, 0.0f};
+    FormatLines("v", mesh.vertices.data(), mesh.num_vertices(), 3, scales,
+                offsets, &vertex_chunks);
+  }
+  if (mesh.topology && has_normals) {
+    const float scales[3] = {1.0f, 1.0f, 1.0f};
+    const float offsets[3] = {0.0f, 0.0f, 0.0f};
+    FormatLines("vn", mesh.normals.data(), mesh.num_vertices(), 3, scales,
+                offsets, &normal_chunks);
+  }
+  if (mesh.topology) {
+    update_topology_text(mesh.topology, has_normals);
+  }
+
+  FILE *fp = fopen(filename.c_str(), "wb");
+  if (!fp) {
+    std::cerr << "Failed to open file to write : " << filename << std::endl;
+    return false;
+  }
+
+  bool ok = WriteChunks(fp, vertex_chunks);
+  if (ok && mesh.topology) {
+    ok = (fwrite(uv_text.data(), 1, uv_text.size(), fp) == uv_text.size()) &&
+         WriteChunks(fp, normal_chunks) &&
+         (fwrite(face_text.data(), 1, face_text.size(), fp) ==
+          face_text.size());
+  }
+  // TODO(LTE): Output .mtl file.
+
+  if ((fclose(fp) != 0) || !ok) {
+    std::cerr << "Failed to write file : " << filename << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool PlyWriter::write(const std::string &filename, const Mesh &mesh,
+                      float vertex_scale, const EncodedImage *texture) {
+  (void)texture;  // PLY has no standard way to embed a texture.
+
+  const size_t n_vertices = mesh.num_vertices();
+  const bool has_normals = (mesh.normals.size() == mesh.vertices.size());
+  const bool has_uvs =
+      mesh.topology && (mesh.topology->uvs.size() == 2 * n_vertices);
+
+  // Interleaved vertex attributes.
+  const size_t stride = 3 + (has_normals ? 3 : 0) + (has_uvs ? 2 : 0);
+  std::vector<float> vertex_block(n_vertices * stride);
+  for (size_t i = 0; i < n_vertices; i++) {
+    float *dst = &vertex_block[i * stride];
+    for (size_t k = 0; k < 3; k++) {
+      *dst++ = vertex_scale * mesh.vertices[3 * i + k];
+    }
+    if (has_normals) {
+      for (size_t k = 0; k < 3; k++) {
+        *dst++ = mesh.normals[3 * i + k];
+      }
+    }
+    if (has_uvs) {
+      // PLY's uv origin is bottom-left(as .obj).
+      *dst++ = mesh.topology->uvs[2 * i + 0];
+      *dst++ = 1.0f - mesh.topology->uvs[2 * i + 1];
+    }
+  }
+
+  const size_t n_faces = mesh.num_faces();
+  if (mesh.topology && (mesh.topology != topology)) {
+    const std::vector<uint32_t> &faces = mesh.topology->faces;
+    face_block.resize(n_faces * 13);
+    for (size_t i = 0; i < n_faces; i++) {
+      unsigned char *dst = &face_block[i * 13];
+      dst[0] = 3;
+      StoreLE32(faces[3 * i + 0], dst + 1);
+      StoreLE32(faces[3 * i + 1], dst + 5);
+      StoreLE32(faces[3 * i + 2], dst + 9);
+    }
+    topology = mesh.topology;
+  }
+
+  std::stringstream header;
+  header << "ply\n"
+         << "format binary_little_endian 1.0\n"
+         << "comment Generated by prnet-infer\n"
+         << "element vertex " << n_vertices << "\n"
+         << "property float x\nproperty float y\nproperty float z\n";
+  if (has_normals) {
+    header << "property float nx\nproperty float ny\nproperty float nz\n";
+  }
+  if (has_uvs) {
+    header << "property float s\nproperty float t\n";
+  }
+  header << "element face " << n_faces << "\n"
+         << "property list uchar uint vertex_indices\n"
+         << "end_header\n";
+  const std::string header_text = header.str();
+
+  FILE *fp = fopen(filename.c_str(), "wb");
+  if (!fp) {
+    std::cerr << "Failed to open file to write : " << filename << std::endl;
+    return false;
+  }
+
+  bool ok = (fwrite(header_text.data(), 1, header_text.size(), fp) ==
+             header_text.size()) &&
+            WriteLE32(fp, vertex_block.data(), vertex_block.size());
+  if (ok && (n_faces > 0)) {
+    ok = (fwrite(face_block.data(), 1, face_block.size(), fp) ==
+          face_block.size());
+  }
+
+  if ((fclose(fp) != 0) || !ok) {
+    std::cerr << "Failed to write file : " << filename << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool GlbWriter::write(const std::string &filename, const Mesh &mesh,
+                      float vertex_scale, const EncodedImage *texture) {
+  const size_t n_vertices = mesh.num_vertices();
+  const size_t n_faces = mesh.num_faces();
+  const bool has_normals = (mesh.normals.size() == mesh.vertices.size());
+  const bool has_uvs =
+      mesh.topology && (mesh.topology->uvs.size() == 2 * n_vertices);
+  const bool has_texture = has_uvs && texture && !texture->data.empty();
+
+  if (n_vertices == 0) {
+    std::cerr << "Empty mesh." << std::endl;
+    return false;
+  }
+
+  // +Y up(see the class comment).
+  std::vector<float> positions(mesh.vertices.size());
+  for (size_t i = 0; i < n_vertices; i++) {
+    positions[3 * i + 0] = vertex_scale * mesh.vertices[3 * i + 0];
+    positions[3 * i + 1] = -vertex_scale * mesh.vertices[3 * i + 1];
+    positions[3 * i + 2] = vertex_scale * mesh.vertices[3 * i + 2];
+  }
+  std::vector<float> normals;
+  if (has_normals) {
+    normals.resize(mesh.normals.size());
+    for (size_t i = 0; i < n_vertices; i++) {
+      normals[3 * i + 0] = mesh.normals[3 * i + 0];
+      normals[3 * i + 1] = -mesh.normals[3 * i + 1];
+      normals[3 * i + 2] = mesh.normals[3 * i + 2];
+    }
+  }
+  if ((n_faces > 0) && (mesh.topology != topology)) {
+    const std::vector<uint32_t> &src = mesh.topology->faces;
+    faces.resize(3 * n_faces);
+    for (size_t i = 0; i < n_faces; i++) {
+      faces[3 * i + 0] = src[3 * i + 0];
+      faces[3 * i + 1] = src[3 * i + 2];
+      faces[3 * i + 2] = src[3 * i + 1];
+    }
+    topology = mesh.topology;
+  }
+
+  float bmin[3] = {positions[0], positions[1], positions[2]};
+  float bmax[3] = {positions[0], positions[1], positions[2]};
+  for (size_t i = 1; i < n_vertices; i++) {
+    for (size_t k = 0; k < 3; k++) {
+      bmin[k] = std::min(bmin[k], positions[3 * i + k]);
+      bmax[k] = std::max(bmax[k], positions[3 * i + k]);
+    }
+  }
+
+  // Buffer views in the binary chunk. Each of them is 4 byte aligned.
+  struct View {
+    const void *data;
+    size_t length;
+    bool words;   // array of 4 byte values(needs byte swap on big endian)
+    int target;   // 0 = none
+  };
+  std::vector<View> views;
+  views.push_back({positions.data(), 4 * positions.size(), true, 34962});
+  const size_t position_view = 0;
+  size_t normal_view = 0, uv_view = 0, index_view = 0, image_view = 0;
+  if (has_normals) {
+    normal_view = views.size();
+    views.push_back({normals.data(), 4 * normals.size(), true, 34962});
+  }
+  if (has_uvs) {
+    // glTF's uv origin is top-left, same as ours.
+    uv_view = views.size();
+    views.push_back(
+        {mesh.topology->uvs.data(), 4 * mesh.topology->uvs.size(), true, 34962});
+  }
+  if (n_faces > 0) {
+    index_view = views.size();
+    views.push_back({faces.data(), 4 * 3 * n_faces, true, 34963});
+  }
+  if (has_texture) {
+    image_view = views.size();
+    views.push_back({texture->data.data(), texture->data.size(), false, 0});
+  }
+
+  std::vector<size_t> offsets(views.size());
+  size_t bin_length = 0;
+  for (size_t i = 0; i < views.size(); i++) {
+    offsets[i] = bin_length;
+    bin_length = Align4(bin_length + views[i].length);
+  }
+
+  std::stringstream json;
+  json << "{\"asset\":{\"version\":\"2.0\",\"generator\":\"prnet-infer\"},"
+       << "\"scene\":0,\"scenes\":[{\"nodes\":[0]}],\"nodes\":[{\"mesh\":0}],";
+
+  // Accessors
+  std::stringstream attributes, accessors;
+  size_t n_accessors = 0;
+  accessors << "{\"bufferView\":" << position_view
+            << ",\"componentType\":5126,\"count\":" << n_vertices
+            << ",\"type\":\"VEC3\",\"min\":[" << FloatToString(bmin[0]) << ","
+            << FloatToString(bmin[1]) << "," << FloatToString(bmin[2])
+            << "],\"max\":[" << FloatToString(bmax[0]) << ","
+            << FloatToString(bmax[1]) << "," << FloatToString(bmax[2]) << "]}";
+  attributes << "\"POSITION\":" << n_accessors++;
+  if (has_normals) {
+    accessors << ",{\"bufferView\":" << normal_view
+              << ",\"componentType\":5126,\"count\":" << n_vertices
+              << ",\"type\":\"VEC3\"}";
+    attributes << ",\"NORMAL\":" << n_accessors++;
+  }
+  if (has_uvs) {
+    accessors << ",{\"bufferView\":" << uv_view
+              << ",\"componentType\":5126,\"count\":" << n_vertices
+              << ",\"type\":\"VEC2\"}";
+    attributes << ",\"TEXCOORD_0\":" << n_accessors++;
+  }
+  std::stringstream primitive;
+  primitive << "{\"attributes\":{" << attributes.str() << "}";
+  if (n_faces > 0) {
+    accessors << ",{\"bufferView\":" << index_view
+              << ",\"componentType\":5125,\"count\":" << 3 * n_faces
+              << ",\"type\":\"SCALAR\"}";
+    primitive << ",\"indices\":" << n_accessors++ << ",\"mode\":4";
+  } else {
+    primitive << ",\"mode\":0";  // points
+  }
+  primitive << ",\"material\":0}";
+
+  json << "\"meshes\":[{\"primitives\":[" << primitive.str() << "]}],";
+  json << "\"materials\":[{\"pbrMetallicRoughness\":{";
+  if (has_texture) {
+    json << "\"baseColorTexture\":{\"index\":0},";
+  }
+  json << "\"metallicFactor\":0,\"roughnessFactor\":1},\"doubleSided\":true}],";
+  if (has_texture) {
+    json << "\"samplers\":[{\"magFilter\":9729,\"minFilter\":9729,"
+         << "\"wrapS\":33071,\"wrapT\":33071}],"
+         << "\"textures\":[{\"sampler\":0,\"source\":0}],"
+         << "\"images\":[{\"bufferView\":" << image_view << ",\"mimeType\":\""
+         << texture->mime_type << "\"}],";
+  }
+  json << "\"accessors\":[" << accessors.str() << "],";
+  json << "\"bufferViews\":[";
+  for (size_t i = 0; i < views.size(); i++) {
+    json << ((i > 0) ? "," : "") << "{\"buffer\":0,\"byteOffset\":" << offsets[i]
+         << ",\"byteLength\":" << views[i].length;
+    if (views[i].target) {
+      json << ",\"target\":" << views[i].target;
+    }
+    json << "}";
+  }
+  json << "],\"buffers\":[{\"byteLength\":" << bin_length << "}]}";
+
+  std::string json_text = json.str();
+  json_text.resize(Align4(json_text.size()), ' ');
+
+  // Header(12 bytes) and chunk headers(8 bytes each).
+  const size_t total_length = 12 + 8 + json_text.size() + 8 + bin_length;
+  unsigned char header[20];
+  StoreLE32(0x46546C67, header);  // "glTF"
+  StoreLE32(2, header + 4);
+  StoreLE32(uint32_t(total_length), header + 8);
+  StoreLE32(uint32_t(json_text.size()), header + 12);
+  StoreLE32(0x4E4F534A, header + 16);  // "JSON"
+  unsigned char bin_header[8];
+  StoreLE32(uint32_t(bin_length), bin_header);
+  StoreLE32(0x004E4942, bin_header + 4);  // "BIN"
+
+  FILE *fp = fopen(filename.c_str(), "wb");
+  if (!fp) {
+    std::cerr << "Failed to open file to write : " << filename << std::endl;
+    return false;
+  }
+
+  const unsigned char zeros[4] = {0, 0, 0, 0};
+  bool ok = (fwrite(header, 1, sizeof(header), fp) == sizeof(header)) &&
+            (fwrite(json_text.data(), 1, json_text.size(), fp) ==
+             json_text.size()) &&
+            (fwrite(bin_header, 1, sizeof(bin_header), fp) ==
+             sizeof(bin_header));
+  for (size_t i = 0; ok && (i < views.size()); i++) {
+    const View &view = views[i];
+    ok = view.words ? WriteLE32(fp, view.data, view.length / 4)
+                    : (fwrite(view.data, 1, view.length, fp) == view.length);
+    const size_t pad = Align4(view.length) - view.length;
+    if (ok && (pad > 0)) {
+      ok = (fwrite(zeros, 1, pad, fp) == pad);
+    }
+  }
+
+  if ((fclose(fp) != 0) || !ok) {
+    std::cerr << "Failed to write file : " << filename << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+} // namespace prnet
@@ -0,0 +1,129 @@
+#ifndef PRNET_INFER_MESH_IO_H_
+#define PRNET_INFER_MESH_IO_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mesh.h"
+
+namespace prnet {
+
+///
+/// Max # of chars `FormatFloat` writes(excluding the terminating null).
+///
+const size_t kMaxFloatChars = 16;
+
+///
+/// Formats `v` with the shortest decimal digits which round trip to `v`
+/// (i.e. `strtof` returns `v` exactly), like `std::to_chars`. `buf` must have
+/// `kMaxFloatChars + 1` chars. Returns the # of chars written(`buf` is null
+/// terminated).
+///
+size_t FormatFloat(float v, char *buf);
+
+///
+/// Encoded image(e.g. JPEG) to be embedded into a mesh file.
+///
+struct EncodedImage {
+  std::vector<unsigned char> data;
+  std::string mime_type;  // e.g. "image/jpeg"
+};
+
+///
+/// Interface of mesh file writers.
+///
+class MeshWriter {
+public:
+  virtual ~MeshWriter();
+
+  // Writes `mesh` to `filename`. Vertices are scaled by `vertex_scale`.
+  // Texture coordinates and normals(if any) are also written. `texture` is
+  // embedded if the format supports it.
+  virtual bool write(const std::string &filename, const Mesh &mesh,
+                     float vertex_scale = 1.0f,
+                     const EncodedImage *texture = nullptr) = 0;
+
+  // File extension including the dot(e.g. ".obj").
+  virtual const char *extension() const = 0;
+};
+
+///
+/// Creates a mesh writer by format name.
+///
+///   "obj" : Wavefront .obj(text).
+///   "ply" : Binary little endian PLY. Texture coordinates are stored as
+///           per vertex `s` and `t`.
+///   "glb" : Binary glTF 2.0. The texture is embedded as the base color.
+///
+/// Returns nullptr for unknown format.
+///
+std::unique_ptr<MeshWriter> CreateMeshWriter(const std::string &format);
+
+///
+/// Wavefront .obj writer.
+///
+/// Texts of texture coordinates and faces only depend on the topology, so
+/// they are formatted once and reused while meshes share the same topology.
+/// Vertices are formatted in parallel and the file is written with a few
+/// large writes.
+///
+class ObjWriter : public MeshWriter {
+public:
+  bool write(const std::string &filename, const Mesh &mesh,
+             float vertex_scale = 1.0f,
+             const EncodedImage *texture = nullptr) override;
+  const char *extension() const override { return ".obj"; }
+
+private:
+  void update_topology_text(const std::shared_ptr<const MeshTopology> &topo,
+                            bool with_normals);
+
+  std::shared_ptr<const MeshTopology> topology;
+  bool faces_with_normals = false;
+  std::string uv_text;
+  std::string face_text;
+};
+
+///
+/// Binary little endian PLY writer.
+///
+/// Vertex attributes are interleaved in one block. The face block(a count and
+/// three indices per face) is built once per topology.
+///
+class PlyWriter : public MeshWriter {
+public:
+  bool write(const std::string &filename, const Mesh &mesh,
+             float vertex_scale = 1.0f,
+             const EncodedImage *texture = nullptr) override;
+  const char *extension() const override { return ".ply"; }
+
+private:
+  std::shared_ptr<const MeshTopology> topology;
+  std::vector<unsigned char> face_block;
+};
+
+///
+/// Binary glTF 2.0(.glb) writer.
+///
+/// Our meshes are in the image coordinate(+Y down, +Z toward the camera), and
+/// glTF is +Y up. Positions and normals are written with Y negated, which
+/// also makes the frame right handed as glTF, and the winding of triangles is
+/// reversed to keep them front facing.
+///
+class GlbWriter : public MeshWriter {
+public:
+  bool write(const std::string &filename, const Mesh &mesh,
+             float vertex_scale = 1.0f,
+             const EncodedImage *texture = nullptr) override;
+  const char *extension() const override { return ".glb"; }
+
+private:
+  // Reversed triangles, cached since the topology is shared by frames.
+  std::shared_ptr<const MeshTopology> topology;
+  std::vector<uint32_t> faces;
+};
+
+} // namespace prnet
+
+#endif // PRNET_INFER_MESH_IO_H_
@@ -0,0 +1,571 @@
+#include "mesh_sequence.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+namespace prnet {
+
+namespace {
+
+const char kMagic[8] = {'P', 'R', 'N', 'S', 'E', 'Q', '\0', '\0'};
+const char kIndexMagic[8] = {'P', 'R', 'N', 'S', 'E', 'Q', 'I', 'X'};
+// 2: frame numbers in records and the index.
+const uint32_t kVersion = 2;
+const uint32_t kFlagQuantized = 1;
+
+const size_t kHeaderSize = 32;
+const size_t kRecordHeaderSize = 12;
+const size_t kIndexEntrySize = 20;
+const size_t kTrailerSize = 24;
+
+// Margin of the quantization box relative to the extent of a keyframe, so that
+// following frames can move a bit.
+const float kBoxMargin = 0.25f;
+
+enum FrameType : uint32_t {
+  kRawFrame = 0,  // float positions
+  kKeyFrame = 1,  // quantized, differences from the previous vertex
+  kDeltaFrame = 2 // quantized, differences from the previous frame
+};
+
+inline void PutU32(uint32_t v, std::vector<unsigned char> *buf) {
+  for (int i = 0; i < 4; i++) {
+    buf->push_back(static_cast<unsigned char>((v >> (8 * i)) & 0xff));
+  }
+}
+
+inline void PutU64(uint64_t v, std::vector<unsigned char> *buf) {
+  for (int i = 0; i < 8; i++) {
+    buf->push_back(static_cast<unsigned char>((v >> (8 * i)) & 0xff));
+  }
+}
+
+inline void PutF32(float v, std::vector<unsigned char> *buf) {
+  uint32_t u;
+  memcpy(&u, &v, sizeof(float));
+  PutU32(u, buf);
+}
+
+inline uint32_t GetU32(const unsigned char *p) {
+  return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) |
+         (uint32_t(p[3]) << 24);
+}
+
+inline uint64_t GetU64(const unsigned char *p) {
+  return uint64_t(GetU32(p)) | (uint64_t(GetU32(p + 4)) << 32);
+}
+
+inline float GetF32(const unsigned char *p) {
+  const uint32_t u = GetU32(p);
+  float v;
+  memcpy(&v, &u, sizeof(float));
+  return v;
+}
+
+inline void PutVarint(uint32_t v, std::vector<unsigned char> *buf) {
+  while (v >= 0x80) {
+    buf->push_back(static_cast<unsigned char>(v | 0x80));
+    v >>= 7;
+  }
+  buf->push_back(static_cast<unsigned char>(v));
+}
+
+inline bool GetVarint(const unsigned char **p, const unsigned char *end,
+                      uint32_t *v) {
+  uint32_t result = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (*p >= end) {
+      return false;
+    }
+    const uint32_t b = *(*p)++;
+    result |= (b & 0x7f) << shift;
+    if (b < 0x80) {
+      (*v) = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline uint32_t ZigZag(int32_t v) {
+  return (uint32_t(v) << 1) ^ uint32_t(v >> 31);
+}
+
+inline int32_t UnZigZag(uint32_t v) {
+  return int32_t(v >> 1) ^ -int32_t(v & 1);
+}
+
+// Codes `n` differences. A non zero difference is varint(zigzag(d)), whose
+// first byte is never 0, and a run of zeros is 0 followed by varint(length).
+void EncodeDeltas(const int32_t *deltas, size_t n,
+                  std::vector<unsigned char> *buf) {
+  for (size_t i = 0; i < n;) {
+    if (deltas[i] == 0) {
+      size_t run = 1;
+      while ((i + run < n) && (deltas[i + run] == 0)) {
+        run++;
+      }
+      buf->push_back(0);
+      PutVarint(uint32_t(run), buf);
+      i += run;
+    } else {
+      PutVarint(ZigZag(deltas[i]), buf);
+      i++;
+    }
+  }
+}
+
+// Decodes `n` differences from `*p` and advances `*p`.
+bool DecodeDeltas(const unsigned char **p, const unsigned char *end, size_t n,
+                  int32_t *deltas) {
+  for (size_t i = 0; i < n;) {
+    if (*p >= end) {
+      return false;
+    }
+    uint32_t v;
+    if (**p == 0) {
+      (*p)++;
+      if (!GetVarint(p, end, &v) || (v == 0) || (v > n - i)) {
+        return false;
+      }
+      std::fill(deltas + i, deltas + i + v, 0);
+      i += v;
+    } else {
+      if (!GetVarint(p, end, &v)) {
+        return false;
+      }
+      deltas[i++] = UnZigZag(v);
+    }
+  }
+  return true;
+}
+
+} // anonymous namespace
+
+MeshSequenceWriter::~MeshSequenceWriter() { close(); }
+
+bool MeshSequenceWriter::open(const std::string &_filename,
+                              const MeshTopology &topology,
+                              size_t num_vertices,
+                              const MeshSequenceOptions &_options) {
+  close();
+
+  if ((_options.quantization_bits < 1) || (_options.quantization_bits > 16)) {
+    std::cerr << "Invalid # of quantization bits : "
+              << _options.quantization_bits << std::endl;
+    return false;
+  }
+  const bool has_uvs = (topology.uvs.size() == 2 * num_vertices);
+
+  filename = _filename;
+  options = _options;
+  options.keyframe_interval = std::max(size_t(1), options.keyframe_interval);
+  n_vertices = num_vertices;
+  index.clear();
+  prev_q.clear();
+  frames_since_keyframe = 0;
+
+  fp = fopen(filename.c_str(), "wb");
+  if (!fp) {
+    std::cerr << "Failed to open file to write : " << filename << std::endl;
+    return false;
+  }
+
+  std::vector<unsigned char> buf(kMagic, kMagic + sizeof(kMagic));
+  PutU32(kVersion, &buf);
+  PutU32(options.quantize ? kFlagQuantized : 0, &buf);
+  PutU32(uint32_t(options.quantization_bits), &buf);
+  PutU32(uint32_t(n_vertices), &buf);
+  PutU32(uint32_t(topology.faces.size() / 3), &buf);
+  PutU32(has_uvs ? uint32_t(n_vertices) : 0, &buf);
+  buf.reserve(buf.size() + 4 * (topology.faces.size() / 3) * 3 +
+              (has_uvs ? 8 * n_vertices : 0));
+  for (size_t i = 0; i < (topology.faces.size() / 3) * 3; i++) {
+    PutU32(topology.faces[i], &buf);
+  }
+  if (has_uvs) {
+    for (float uv : topology.uvs) {
+      PutF32(uv, &buf);
+    }
+  }
+
+  if (fwrite(buf.data(), 1, buf.size(), fp) != buf.size()) {
+    std::cerr << "Failed to write file : " << filename << std::endl;
+    fclose(fp);
+    fp = nullptr;
+    return false;
+  }
+  offset = buf.size();
+
+  return true;
+}
+
+bool MeshSequenceWriter::append(const Mesh &mesh, uint32_t frame_number) {
+  if (!fp) {
+    std::cerr << "Mesh sequence is not opened." << std::endl;
+    return false;
+  }
+  if (mesh.num_vertices() != n_vertices) {
+    std::cerr << "# of vertices mismatch. " << mesh.num_vertices()
+              << " != " << n_vertices << std::endl;
+    return false;
+  }
+
+  const size_t n = 3 * n_vertices;
+  const float scale = options.vertex_scale;
+
+  payload.clear();
+  uint32_t type = kRawFrame;
+  if (!options.quantize) {
+    payload.reserve(4 * n);
+    for (size_t i = 0; i < n; i++) {
+      PutF32(scale * mesh.vertices[i], &payload);
+    }
+  } else {
+    const int32_t max_q = (1 << options.quantization_bits) - 1;
+    q.resize(n);
+
+    // Quantizes in the box of the current keyframe. Returns false if out of
+    // the box.
+    auto Quantize = [&]() {
+      bool inside = true;
+      for (size_t i = 0; i < n; i++) {
+        const size_t c = i % 3;
+        const float x = (scale * mesh.vertices[i] - origin[c]) / step[c];
+        const int32_t v = int32_t(std::floor(x + 0.5f));
+        inside &= ((v >= 0) && (v <= max_q));
+        q[i] = std::min(std::max(v, 0), max_q);
+      }
+      return inside;
+    };
+
+    bool keyframe = prev_q.empty() ||
+                    (frames_since_keyframe >= options.keyframe_interval) ||
+                    !Quantize();
+    if (keyframe) {
+      float bmin[3] = {std::numeric_limits<float>::max(),
+                       std::numeric_limits<float>::max(),
+                       std::numeric_limits<float>::max()};
+      float bmax[3] = {-std::numeric_limits<float>::max(),
+                       -std::numeric_limits<float>::max(),
+                       -std::numeric_limits<float>::max()};
+      for (size_t i = 0; i < n; i++) {
+        const float x = scale * mesh.vertices[i];
+        bmin[i % 3] = std::min(bmin[i % 3], x);
+        bmax[i % 3] = std::max(bmax[i % 3], x);
+      }
+      for (size_t c = 0; c < 3; c++) {
+        const float extent = (n > 0) ? (bmax[c] - bmin[c]) : 0.0f;
+        origin[c] = (n > 0) ? (bmin[c] - kBoxMargin * extent) : 0.0f;
+        step[c] = (extent > 0.0f)
+                      ? extent * (1.0f + 2.0f * kBoxMargin) / float(max_q)
+                      : 1.0f;
+      }
+      Quantize();
+      frames_since_keyframe = 0;
+    }
+
+    // Planar(x, y then z) differences.
+    std::vector<int32_t> deltas(n_vertices);
+    for (size_t c = 0; c < 3; c++) {
+      PutF32(origin[c], &payload);
+    }
+    for (size_t c = 0; c < 3; c++) {
+      PutF32(step[c], &payload);
+    }
+    for (size_t c = 0; c < 3; c++) {
+      for (size_t i = 0; i < n_vertices; i++) {
+        const int32_t prev = keyframe ? ((i > 0) ? q[3 * (i - 1) + c] : 0)
+                                      : prev_q[3 * i + c];
+        deltas[i] = q[3 * i + c] - prev;
+      }
+      EncodeDeltas(deltas.data(), n_vertices, &payload);
+    }
+
+    type = keyframe ? kKeyFrame : kDeltaFrame;
+    prev_q.swap(q);
+    frames_since_keyframe++;
+  }
+
+  std::vector<unsigned char> record_header;
+  PutU32(type, &record_header);
+  PutU32(uint32_t(payload.size()), &record_header);
+  PutU32(frame_number, &record_header);
+  if ((fwrite(record_header.data(), 1, record_header.size(), fp) !=
+       record_header.size()) ||
+      (fwrite(payload.data(), 1, payload.size(), fp) != payload.size())) {
+    std::cerr << "Failed to write file : " << filename << std::endl;
+    return false;
+  }
+
+  IndexEntry entry;
+  entry.offset = offset;
+  entry.size = uint32_t(payload.size());
+  entry.type = type;
+  entry.frame_number = frame_number;
+  index.push_back(entry);
+  offset += kRecordHeaderSize + payload.size();
+
+  return true;
+}
+
+bool MeshSequenceWriter::close() {
+  if (!fp) {
+    return true;
+  }
+
+  std::vector<unsigned char> buf;
+  for (const IndexEntry &entry : index) {
+    PutU64(entry.offset, &buf);
+    PutU32(entry.size, &buf);
+    PutU32(entry.type, &buf);
+    PutU32(entry.frame_number, &buf);
+  }
+  PutU64(offset, &buf);
+  PutU64(uint64_t(index.size()), &buf);
+  buf.insert(buf.end(), kIndexMagic, kIndexMagic + sizeof(kIndexMagic));
+
+  bool ok = (fwrite(buf.data(), 1, buf.size(), fp) == buf.size());
+  ok &= (fclose(fp) == 0);
+  fp = nullptr;
+  if (!ok) {
+    std::cerr << "Failed to write file : " << filename << std::endl;
+  }
+  return ok;
+}
+
+bool MeshSequenceReader::open(const std::string &filename) {
+  ifs.close();
+  ifs.clear();
+  index.clear();
+  topology.reset();
+  decoded_frame = size_t(-1);
+
+  ifs.open(filename, std::ios::binary);
+  if (!ifs) {
+    std::cerr << "File not found or failed to open : " << filename
+              << std::endl;
+    return false;
+  }
+  ifs.seekg(0, std::ios::end);
+  const uint64_t file_size = uint64_t(ifs.tellg());
+  ifs.seekg(0);
+
+  unsigned char header[kHeaderSize];
+  if (!ifs.read(reinterpret_cast<char *>(header), kHeaderSize) ||
+      (memcmp(header, kMagic, sizeof(kMagic)) != 0)) {
+    std::cerr << "Not a mesh sequence file : " << filename << std::endl;
+    return false;
+  }
+  if (GetU32(header + 8) != kVersion) {
+    std::cerr << "Unsupported mesh sequence version " << GetU32(header + 8)
+              << " : " << filename << std::endl;
+    return false;
+  }
+  quantized = (GetU32(header + 12) & kFlagQuantized) != 0;
+  n_vertices = GetU32(header + 20);
+  const size_t n_faces = GetU32(header + 24);
+  const size_t n_uvs = GetU32(header + 28);
+
+  const uint64_t topology_size = 12 * uint64_t(n_faces) + 8 * uint64_t(n_uvs);
+  if (kHeaderSize + topology_size > file_size) {
+    std::cerr << "Truncated mesh sequence file : " << filename << std::endl;
+    return false;
+  }
+  std::vector<unsigned char> buf(topology_size);
+  if (!buf.empty() &&
+      !ifs.read(reinterpret_cast<char *>(buf.data()),
+                std::streamsize(buf.size()))) {
+    return false;
+  }
+  std::shared_ptr<MeshTopology> topo(new MeshTopology());
+  topo->faces.resize(3 * n_faces);
+  for (size_t i = 0; i < 3 * n_faces; i++) {
+    topo->faces[i] = GetU32(&buf[4 * i]);
+    if (topo->faces[i] >= n_vertices) {
+      std::cerr << "Invalid face index in " << filename << std::endl;
+      return false;
+    }
+  }
+  topo->uvs.resize(2 * n_uvs);
+  for (size_t i = 0; i < 2 * n_uvs; i++) {
+    topo->uvs[i] = GetF32(&buf[12 * n_faces + 4 * i]);
+  }
+  BuildVertexFaceAdjacency(n_vertices, topo.get());
+  topology = topo;
+
+  const uint64_t data_offset = kHeaderSize + topology_size;
+
+  // Frame index at the end of the file.
+  if (file_size >= data_offset + kTrailerSize) {
+    unsigned char trailer[kTrailerSize];
+    ifs.seekg(std::streamoff(file_size - kTrailerSize));
+    if (ifs.read(reinterpret_cast<char *>(trailer), kTrailerSize) &&
+        (memcmp(trailer + 16, kIndexMagic, sizeof(kIndexMagic)) == 0)) {
+      const uint64_t index_offset = GetU64(trailer);
+      const uint64_t n_frames = GetU64(trailer + 8);
+      if ((index_offset >= data_offset) &&
+          (n_frames <= (file_size - index_offset) / kIndexEntrySize) &&
+          (index_offset + n_frames * kIndexEntrySize + kTrailerSize ==
+           file_size)) {
+        buf.resize(size_t(n_frames) * kIndexEntrySize);
+        ifs.seekg(std::streamoff(index_offset));
+        if (buf.empty() || ifs.read(reinterpret_cast<char *>(buf.data()),
+                                    std::streamsize(buf.size()))) {
+          index.resize(size_t(n_frames));
+          for (size_t i = 0; i < index.size(); i++) {
+            index[i].offset = GetU64(&buf[kIndexEntrySize * i]);
+            index[i].size = GetU32(&buf[kIndexEntrySize * i + 8]);
+            index[i].type = GetU32(&buf[kIndexEntrySize * i + 12]);
+            index[i].frame_number = GetU32(&buf[kIndexEntrySize * i + 16]);
+            if (index[i].offset + kRecordHeaderSize + index[i].size >
+                index_offset) {
+              index.clear();
+              break;
+            }
+          }
+          if (index.size() == n_frames) {
+            return true;
+          }
+        }
+      }
+    }
+    ifs.clear();
+  }
+
+  // No valid index. Scan frames.
+  std::cerr << "Frame index is missing. Scanning " << filename << std::endl;
+  uint64_t record_offset = data_offset;
+  while (record_offset + kRecordHeaderSize <= file_size) {
+    unsigned char record_header[kRecordHeaderSize];
+    ifs.seekg(std::streamoff(record_offset));
+    if (!ifs.read(reinterpret_cast<char *>(record_header),
+                  kRecordHeaderSize)) {
+      break;
+    }
+    IndexEntry entry;
+    entry.offset = record_offset;
+    entry.type = GetU32(record_header);
+    entry.size = GetU32(record_header + 4);
+    entry.frame_number = GetU32(record_header + 8);
+    if ((entry.type > kDeltaFrame) ||
+        (record_offset + kRecordHeaderSize + entry.size > file_size)) {
+      break;
+    }
+    index.push_back(entry);
+    record_offset += kRecordHeaderSize + entry.size;
+  }
+  ifs.clear();
+
+  return true;
+}
+
+bool MeshSequenceReader::read_payload(size_t frame) {
+  const IndexEntry &entry = index[frame];
+  payload.resize(entry.size);
+  ifs.seekg(std::streamoff(entry.offset + kRecordHeaderSize));
+  if (!payload.empty() && !ifs.read(reinterpret_cast<char *>(payload.data()),
+                                    std::streamsize(payload.size()))) {
+    ifs.clear();
+    std::cerr << "Failed to read frame " << frame << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool MeshSequenceReader::decode(size_t frame) {
+  const size_t n = 3 * n_vertices;
+
+  if (index[frame].type == kRawFrame) {
+    if (!read_payload(frame) || (payload.size() != 4 * n)) {
+      return false;
+    }
+    raw.resize(n);
+    for (size_t i = 0; i < n; i++) {
+      raw[i] = GetF32(&payload[4 * i]);
+    }
+    decoded_frame = frame;
+    return true;
+  }
+
+  // Decode from the keyframe, or continue from the previously decoded frame.
+  size_t keyframe = frame;
+  while ((keyframe > 0) && (index[keyframe].type != kKeyFrame)) {
+    keyframe--;
+  }
+  if (index[keyframe].type != kKeyFrame) {
+    std::cerr << "No keyframe for frame " << frame << std::endl;
+    return false;
+  }
+  size_t start = keyframe;
+  if ((decoded_frame != size_t(-1)) && (decoded_frame >= keyframe) &&
+      (decoded_frame < frame) && (index[decoded_frame].type != kRawFrame)) {
+    start = decoded_frame + 1;
+  }
+
+  std::vector<int32_t> deltas(n_vertices);
+  q.resize(n);
+  for (size_t f = start; f <= frame; f++) {
+    decoded_frame = size_t(-1);
+    const bool is_key = (index[f].type == kKeyFrame);
+    if ((!is_key && (index[f].type != kDeltaFrame)) || !read_payload(f) ||
+        (payload.size() < 24)) {
+      return false;
+    }
+    for (size_t c = 0; c < 3; c++) {
+      origin[c] = GetF32(&payload[4 * c]);
+      step[c] = GetF32(&payload[12 + 4 * c]);
+    }
+    const unsigned char *p = payload.data() + 24;
+    const unsigned char *end = payload.data() + payload.size();
+    for (size_t c = 0; c < 3; c++) {
+      if (!DecodeDeltas(&p, end, n_vertices, deltas.data())) {
+        std::cerr << "Corrupted frame " << f << std::endl;
+        return false;
+      }
+      for (size_t i = 0; i < n_vertices; i++) {
+        const int32_t prev = is_key ? ((i > 0) ? q[3 * (i - 1) + c] : 0)
+                                    : q[3 * i + c];
+        q[3 * i + c] = prev + deltas[i];
+      }
+    }
+    if (p != end) {
+      std::cerr << "Corrupted frame " << f << std::endl;
+      return false;
+    }
+    decoded_frame = f;
+  }
+
+  return true;
+}
+
+bool MeshSequenceReader::read(size_t frame, Mesh *mesh) {
+  if (frame >= index.size()) {
+    std::cerr << "Frame " << frame << " is out of range(" << index.size()
+              << ")" << std::endl;
+    return false;
+  }
+
+  if ((decoded_frame != frame) && !decode(frame)) {
+    return false;
+  }
+
+  const size_t n = 3 * n_vertices;
+  mesh->vertices.resize(n);
+  if (index[frame].type == kRawFrame) {
+    std::copy(raw.begin(), raw.end(), mesh->vertices.begin());
+  } else {
+    for (size_t i = 0; i < n; i++) {
+      mesh->vertices[i] = origin[i % 3] + step[i % 3] * float(q[i]);
+    }
+  }
+  mesh->normals.clear();
+  mesh->topology = topology;
+
+  return true;
+}
+
+} // namespace prnet
@@ -0,0 +1,134 @@
+#ifndef PRNET_INFER_MESH_SEQUENCE_H_
+#define PRNET_INFER_MESH_SEQUENCE_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mesh.h"
+
+namespace prnet {
+
+///
+/// Mesh sequence file(.prnseq) for image sequences.
+///
+/// The topology(faces and uvs) is stored once, followed by vertex positions
+/// of each frame and an index of the frames at the end of the file. Each frame
+/// records its frame number in the image sequence, since frames without the
+/// face are not stored.
+///
+/// When quantized, positions of a keyframe are quantized in its bounding box
+/// (with a margin) and the following frames are stored as differences of the
+/// quantized positions from the previous frame. Differences are zigzag varint
+/// coded with run length coding of zeros. A new keyframe starts every
+/// `keyframe_interval` frames or when the mesh moves out of the box.
+///
+/// All values are little endian.
+///
+struct MeshSequenceOptions {
+  bool quantize = true;
+  int quantization_bits = 16;  // 1 - 16
+  size_t keyframe_interval = 30;
+  float vertex_scale = 1.0f;   // Vertices are scaled on writing.
+};
+
+class MeshSequenceWriter {
+public:
+  MeshSequenceWriter() {}
+  ~MeshSequenceWriter();
+
+  MeshSequenceWriter(const MeshSequenceWriter &) = delete;
+  MeshSequenceWriter &operator=(const MeshSequenceWriter &) = delete;
+
+  // Creates `filename` and writes the topology.
+  bool open(const std::string &filename, const MeshTopology &topology,
+            size_t num_vertices,
+            const MeshSequenceOptions &options = MeshSequenceOptions());
+
+  // Appends a frame. `mesh` must have the same # of vertices. `frame_number`
+  // is the index of the frame in the image sequence.
+  bool append(const Mesh &mesh, uint32_t frame_number);
+
+  // Writes the frame index and closes the file. Also called by the
+  // destructor.
+  bool close();
+
+  size_t num_frames() const { return index.size(); }
+
+private:
+  struct IndexEntry {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t type;
+    uint32_t frame_number;
+  };
+
+  FILE *fp = nullptr;
+  std::string filename;
+  MeshSequenceOptions options;
+  size_t n_vertices = 0;
+  uint64_t offset = 0;
+  std::vector<IndexEntry> index;
+
+  // Quantization of the current keyframe and the previous frame.
+  float origin[3] = {0.f, 0.f, 0.f};
+  float step[3] = {1.f, 1.f, 1.f};
+  size_t frames_since_keyframe = 0;
+  std::vector<int32_t> prev_q;
+
+  std::vector<int32_t> q;
+  std::vector<unsigned char> payload;
+};
+
+class MeshSequenceReader {
+public:
+  // Opens `filename` and reads the topology and the frame index. If the index
+  // is missing(e.g. the writer was not closed), frames are scanned.
+  bool open(const std::string &filename);
+
+  size_t num_frames() const { return index.size(); }
+  size_t num_vertices() const { return n_vertices; }
+  std::shared_ptr<const MeshTopology> get_topology() const { return topology; }
+
+  // Index of frame `frame` in the image sequence.
+  uint32_t frame_number(size_t frame) const {
+    return index[frame].frame_number;
+  }
+
+  // Reads frame `frame` into `mesh`(vertices and the topology). Frames after a
+  // keyframe are decoded from the keyframe, and consecutive reads decode only
+  // one frame.
+  bool read(size_t frame, Mesh *mesh);
+
+private:
+  struct IndexEntry {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t type;
+    uint32_t frame_number;
+  };
+
+  bool read_payload(size_t frame);
+  bool decode(size_t frame);
+
+  std::ifstream ifs;
+  size_t n_vertices = 0;
+  bool quantized = false;
+  std::shared_ptr<MeshTopology> topology;
+  std::vector<IndexEntry> index;
+
+  // Decoded state.
+  size_t decoded_frame = size_t(-1);
+  float origin[3] = {0.f, 0.f, 0.f};
+  float step[3] = {1.f, 1.f, 1.f};
+  std::vector<int32_t> q;
+  std::vector<float> raw;
+  std::vector<unsigned char> payload;
+};
+
+} // namespace prnet
+
+#endif // PRNET_INFER_MESH_SEQUENCE_H_
@@ -0,0 +1,279 @@
+#include "npy_writer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+namespace prnet {
+
+namespace {
+
+const char kNpyMagic[6] = {'\x93', 'N', 'U', 'M', 'P', 'Y'};
+
+// Header size of a new file(magic, version, header length and the padded
+// dict). Leaves enough room for the # of items to grow.
+const size_t kHeaderSize = 128;
+
+// fseek with 64 bit offset. Files of many position maps exceed 2GB.
+inline bool Seek(FILE *fp, uint64_t offset, int whence = SEEK_SET) {
+#if defined(_WIN32)
+  return _fseeki64(fp, int64_t(offset), whence) == 0;
+#else
+  return fseeko(fp, off_t(offset), whence) == 0;
+#endif
+}
+
+inline uint64_t Tell(FILE *fp) {
+#if defined(_WIN32)
+  return uint64_t(_ftelli64(fp));
+#else
+  return uint64_t(ftello(fp));
+#endif
+}
+
+inline bool IsLittleEndian() {
+  const uint32_t one = 1;
+  unsigned char c;
+  memcpy(&c, &one, 1);
+  return c == 1;
+}
+
+inline const char *FloatDescr() { return IsLittleEndian() ? "<f4" : ">f4"; }
+
+// Parses the header dict of an existing .npy file. Only the keys written by
+// numpy(`descr`, `fortran_order` and `shape`) are recognized.
+bool ParseHeaderDict(const std::string &dict, std::string *descr,
+                     bool *fortran_order, std::vector<size_t> *shape) {
+  size_t pos = dict.find("'descr'");
+  if (pos == std::string::npos) {
+    return false;
+  }
+  pos = dict.find('\'', dict.find(':', pos));
+  if (pos == std::string::npos) {
+    return false;
+  }
+  const size_t end = dict.find('\'', pos + 1);
+  if (end == std::string::npos) {
+    return false;
+  }
+  (*descr) = dict.substr(pos + 1, end - pos - 1);
+
+  pos = dict.find("'fortran_order'");
+  if (pos == std::string::npos) {
+    return false;
+  }
+  pos = dict.find(':', pos);
+  if (pos == std::string::npos) {
+    return false;
+  }
+  pos = dict.find_first_not_of(' ', pos + 1);
+  (*fortran_order) = (pos != std::string::npos) &&
+                     (dict.compare(pos, 4, "True") == 0);
+
+  pos = dict.find("'shape'");
+  if (pos == std::string::npos) {
+    return false;
+  }
+  pos = dict.find('(', pos);
+  const size_t shape_end = dict.find(')', pos);
+  if ((pos == std::string::npos) || (shape_end == std::string::npos)) {
+    return false;
+  }
+  shape->clear();
+  const char *p = dict.c_str() + pos + 1;
+  const char *p_end = dict.c_str() + shape_end;
+  while (p < p_end) {
+    char *next;
+    const unsigned long long v = strtoull(p, &next, 10);
+    if (next == p) {
+      p++;  // ',' or ' '
+      continue;
+    }
+    shape->push_back(size_t(v));
+    p = next;
+  }
+  return true;
+}
+
+} // anonymous namespace
+
+NpyWriter::~NpyWriter() { close(); }
+
+bool NpyWriter::write_header() {
+  std::stringstream ss;
+  ss << "{'descr': '" << FloatDescr() << "', 'fortran_order': False, "
+     << "'shape': (" << n_items;
+  if (item_shape.empty()) {
+    ss << ",";
+  }
+  for (size_t dim : item_shape) {
+    ss << ", " << dim;
+  }
+  ss << "), }";
+  std::string dict = ss.str();
+
+  // Existing files may have been written with version 2.0(4 byte length).
+  unsigned char prefix[12];
+  if (!Seek(fp, 0) || fread(prefix, 1, 8, fp) != 8) {
+    return false;
+  }
+  const size_t prefix_size = (prefix[6] >= 2) ? 12 : 10;
+  if (dict.size() + 1 > header_size - prefix_size) {
+    std::cerr << "No room in the header of " << filename << std::endl;
+    return false;
+  }
+  dict.resize(header_size - prefix_size - 1, ' ');
+  dict.push_back('\n');
+
+  if (!Seek(fp, prefix_size) ||
+      (fwrite(dict.data(), 1, dict.size(), fp) != dict.size()) ||
+      (fflush(fp) != 0)) {
+    std::cerr << "Failed to write file : " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool NpyWriter::open(const std::string &_filename,
+                     const std::vector<size_t> &_item_shape, bool append) {
+  close();
+
+  filename = _filename;
+  item_shape = _item_shape;
+  item_floats = 1;
+  for (size_t dim : item_shape) {
+    item_floats *= dim;
+  }
+  n_items = 0;
+
+  if (append) {
+    fp = fopen(filename.c_str(), "r+b");
+  }
+
+  if (fp) {
+    unsigned char prefix[12];
+    if ((fread(prefix, 1, 10, fp) != 10) ||
+        (memcmp(prefix, kNpyMagic, sizeof(kNpyMagic)) != 0) ||
+        (prefix[6] < 1) || (prefix[6] > 3)) {
+      std::cerr << "Not a .npy file : " << filename << std::endl;
+      close();
+      return false;
+    }
+    size_t dict_size = size_t(prefix[8]) | (size_t(prefix[9]) << 8);
+    size_t prefix_size = 10;
+    if (prefix[6] >= 2) {
+      if (fread(prefix + 10, 1, 2, fp) != 2) {
+        close();
+        return false;
+      }
+      dict_size |= (size_t(prefix[10]) << 16) | (size_t(prefix[11]) << 24);
+      prefix_size = 12;
+    }
+    std::string dict(dict_size, '\0');
+    if (fread(&dict[0], 1, dict_size, fp) != dict_size) {
+      std::cerr << "Truncated .npy file : " << filename << std::endl;
+      close();
+      return false;
+    }
+    header_size = prefix_size + dict_size;
+
+    std::string descr;
+    bool fortran_order;
+    std::vector<size_t> shape;
+    if (!ParseHeaderDict(dict, &descr, &fortran_order, &shape) ||
+        (descr != FloatDescr()) || fortran_order || shape.empty() ||
+        (std::vector<size_t>(shape.begin() + 1, shape.end()) != item_shape)) {
+      std::cerr << "Array type or shape mismatch in " << filename << std::endl;
+      close();
+      return false;
+    }
+
+    // Items after the # of items in the header(e.g. the writer was killed
+    // before updating the header) are overwritten.
+    Seek(fp, 0, SEEK_END);
+    const uint64_t data_size = Tell(fp) - header_size;
+    n_items = std::min(shape[0],
+                       size_t(data_size / (sizeof(float) * item_floats)));
+  } else {
+    fp = fopen(filename.c_str(), "w+b");
+    if (!fp) {
+      std::cerr << "Failed to open file to write : " << filename << std::endl;
+      return false;
+    }
+    header_size = kHeaderSize;
+    unsigned char prefix[10];
+    memcpy(prefix, kNpyMagic, sizeof(kNpyMagic));
+    prefix[6] = 1;  // version 1.0
+    prefix[7] = 0;
+    prefix[8] = static_cast<unsigned char>((header_size - 10) & 0xff);
+    prefix[9] = static_cast<unsigned char>((header_size - 10) >> 8);
+    if (fwrite(prefix, 1, sizeof(prefix), fp) != sizeof(prefix)) {
+      std::cerr << "Failed to write file : " << filename << std::endl;
+      close();
+      return false;
+    }
+  }
+
+  if (!write_header()) {
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+bool NpyWriter::append(const float *data, size_t count) {
+  if (!fp) {
+    std::cerr << ".npy file is not opened." << std::endl;
+    return false;
+  }
+
+  const size_t n = count * item_floats;
+  const uint64_t offset =
+      header_size + uint64_t(sizeof(float)) * item_floats * n_items;
+  if (!Seek(fp, offset) ||
+      (fwrite(data, sizeof(float), n, fp) != n)) {
+    std::cerr << "Failed to write file : " << filename << std::endl;
+    return false;
+  }
+  n_items += count;
+
+  // Data is flushed before the header, so the header never refers to
+  // unwritten items.
+  if (fflush(fp) != 0) {
+    std::cerr << "Failed to write file : " << filename << std::endl;
+    return false;
+  }
+  return write_header();
+}
+
+bool NpyWriter::read(size_t index, float *data) {
+  if (!fp || (index >= n_items)) {
+    std::cerr << "Item " << index << " is out of range of " << filename
+              << std::endl;
+    return false;
+  }
+
+  const uint64_t offset =
+      header_size + uint64_t(sizeof(float)) * item_floats * index;
+  if (!Seek(fp, offset) ||
+      (fread(data, sizeof(float), item_floats, fp) != item_floats)) {
+    std::cerr << "Failed to read file : " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool NpyWriter::close() {
+  if (!fp) {
+    return true;
+  }
+  const bool ok = (fclose(fp) == 0);
+  fp = nullptr;
+  return ok;
+}
+
+} // namespace prnet
@@ -0,0 +1,58 @@
+#ifndef PRNET_INFER_NPY_WRITER_H_
+#define PRNET_INFER_NPY_WRITER_H_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace prnet {
+
+///
+/// Appendable NumPy .npy file of float32 items.
+///
+/// The array has the shape (N, item_shape...) in C order. The header is padded
+/// to a fixed size and rewritten after every append, so the file is a valid
+/// .npy at any time and can be memory mapped while it grows, e.g.
+/// `numpy.load(filename, mmap_mode='r')`. Data starts at a 64 byte aligned
+/// offset.
+///
+class NpyWriter {
+public:
+  NpyWriter() {}
+  ~NpyWriter();
+
+  NpyWriter(const NpyWriter &) = delete;
+  NpyWriter &operator=(const NpyWriter &) = delete;
+
+  // Creates `filename`. If `append` is true and `filename` exists, items are
+  // appended to it. The existing file must be a float32 C order array with
+  // the same `item_shape`.
+  bool open(const std::string &filename, const std::vector<size_t> &item_shape,
+            bool append = false);
+
+  // Appends `n_items` items(`n_items` x item size floats).
+  bool append(const float *data, size_t n_items = 1);
+
+  // Reads item `index`(item size floats), e.g. the last one of an existing
+  // file to continue from it.
+  bool read(size_t index, float *data);
+
+  bool close();
+
+  size_t num_items() const { return n_items; }
+  size_t item_size() const { return item_floats; }
+
+private:
+  bool write_header();
+
+  FILE *fp = nullptr;
+  std::string filename;
+  std::vector<size_t> item_shape;
+  size_t item_floats = 0;
+  size_t n_items = 0;
+  size_t header_size = 0;
+};
+
+} // namespace prnet
+
+#endif // PRNET_INFER_NPY_WRITER_H_
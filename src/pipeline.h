@@ -0,0 +1,286 @@
+#ifndef PRNET_INFER_PIPELINE_H_
+#define PRNET_INFER_PIPELINE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace prnet {
+
+///
+/// Blocking FIFO queue with a fixed capacity.
+///
+template <typename T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t _capacity)
+      : capacity(std::max(size_t(1), _capacity)) {}
+
+  // Blocks while the queue is full. Returns false if the queue is closed.
+  bool push(T &&item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_full.wait(lock,
+                  [this]() { return closed || (items.size() < capacity); });
+    if (closed) {
+      return false;
+    }
+    items.push_back(std::move(item));
+    not_empty.notify_one();
+    return true;
+  }
+
+  // Blocks while the queue is empty. Returns false if the queue is closed and
+  // empty.
+  bool pop(T *item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait(lock, [this]() { return closed || !items.empty(); });
+    if (items.empty()) {
+      return false;
+    }
+    (*item) = std::move(items.front());
+    items.pop_front();
+    not_full.notify_one();
+    return true;
+  }
+
+  // Wakes up all waiters. Remaining items can still be popped.
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    not_full.notify_all();
+    not_empty.notify_all();
+  }
+
+private:
+  const size_t capacity;
+  std::deque<T> items;
+  bool closed = false;
+  std::mutex mutex;
+  std::condition_variable not_full;
+  std::condition_variable not_empty;
+};
+
+///
+/// Runs items through stages connected with bounded queues. Each stage has its
+/// own worker threads, so stages overlap and the throughput approaches the one
+/// of the slowest stage.
+///
+/// A stage processes items concurrently with its workers(in any order), or one
+/// by one in the input order(`in_order`, for stages with state such as
+/// tracking and writing files). The # of items in flight is bounded, so the
+/// memory use is also bounded.
+///
+template <typename T>
+class Pipeline {
+public:
+  // Processes the `index`th item. Returns false on error, which stops the
+  // pipeline.
+  typedef std::function<bool(size_t index, T *item)> StageFunc;
+
+  explicit Pipeline(size_t _queue_capacity = 2)
+      : queue_capacity(std::max(size_t(1), _queue_capacity)) {}
+
+  Pipeline(const Pipeline &) = delete;
+  Pipeline &operator=(const Pipeline &) = delete;
+
+  // Appends a stage. `n_workers` is ignored(1) for an `in_order` stage.
+  void add_stage(const std::string &name, const StageFunc &func,
+                 size_t n_workers = 1, bool in_order = false) {
+    std::unique_ptr<Stage> stage(new Stage(queue_capacity));
+    stage->name = name;
+    stage->func = func;
+    stage->in_order = in_order;
+    stage->n_workers = in_order ? 1 : std::max(size_t(1), n_workers);
+    stages.push_back(std::move(stage));
+  }
+
+  // Runs `n_items` items(default constructed) through all stages and waits
+  // for them. Returns false if any stage failed.
+  bool run(size_t n_items) {
+    if (stages.empty()) {
+      return true;
+    }
+
+    failed = false;
+    n_in_flight = 0;
+    max_in_flight = 0;
+    for (auto &stage : stages) {
+      stage->next_index = 0;
+      stage->n_active = stage->n_workers;
+      stage->n_items = 0;
+      stage->busy_ns = 0;
+      max_in_flight += stage->n_workers + queue_capacity;
+    }
+
+    std::vector<std::thread> workers;
+    for (size_t s = 0; s < stages.size(); s++) {
+      for (size_t w = 0; w < stages[s]->n_workers; w++) {
+        workers.emplace_back([this, s]() { worker_loop(s); });
+      }
+    }
+
+    // Feed items.
+    for (size_t i = 0; i < n_items; i++) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        slot_available.wait(
+            lock, [this]() { return failed || (n_in_flight < max_in_flight); });
+        if (failed) {
+          break;
+        }
+        n_in_flight++;
+      }
+      Entry entry(i, std::unique_ptr<T>(new T()));
+      if (!stages[0]->queue.push(std::move(entry))) {
+        break;
+      }
+    }
+    stages[0]->queue.close();
+
+    for (auto &t : workers) {
+      t.join();
+    }
+
+    return !failed;
+  }
+
+  // Prints the # of items and the average busy time per item of each stage.
+  void print_stats(std::ostream &os) const {
+    for (const auto &stage : stages) {
+      const size_t n = stage->n_items;
+      const double ms =
+          (n > 0) ? double(stage->busy_ns) * 1e-6 / double(n) : 0.0;
+      os << "  " << std::left << std::setw(12) << stage->name << std::right
+         << " : " << n << " items, " << std::fixed
+         << std::setprecision(2) << ms << " [ms/item], " << stage->n_workers
+         << (stage->in_order ? " thread(in order)" : " thread(s)")
+         << std::defaultfloat << std::endl;
+    }
+  }
+
+private:
+  typedef std::pair<size_t, std::unique_ptr<T>> Entry;
+
+  struct Stage {
+    explicit Stage(size_t capacity) : queue(capacity) {}
+
+    std::string name;
+    StageFunc func;
+    size_t n_workers = 1;
+    bool in_order = false;
+
+    BoundedQueue<Entry> queue;
+    std::map<size_t, Entry> reorder;  // out of order items(`in_order`)
+    size_t next_index = 0;
+    std::atomic<size_t> n_active{0};
+
+    std::atomic<size_t> n_items{0};
+    std::atomic<uint64_t> busy_ns{0};
+  };
+
+  void abort() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      failed = true;
+      slot_available.notify_all();
+    }
+    for (auto &stage : stages) {
+      stage->queue.close();
+    }
+  }
+
+  bool is_failed() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return failed;
+  }
+
+  // Runs the stage function and passes the item to the next stage.
+  bool process(size_t s, Entry &entry) {
+    Stage &stage = *stages[s];
+    if (is_failed()) {
+      return false;
+    }
+    auto start = std::chrono::steady_clock::now();
+    const bool ok = stage.func(entry.first, entry.second.get());
+    auto end = std::chrono::steady_clock::now();
+    stage.busy_ns += uint64_t(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count());
+    stage.n_items++;
+    if (!ok) {
+      abort();
+      return false;
+    }
+
+    if (s + 1 < stages.size()) {
+      return stages[s + 1]->queue.push(std::move(entry));
+    }
+
+    // Finished the last stage.
+    entry.second.reset();
+    std::lock_guard<std::mutex> lock(mutex);
+    n_in_flight--;
+    slot_available.notify_one();
+    return true;
+  }
+
+  void worker_loop(size_t s) {
+    Stage &stage = *stages[s];
+    Entry entry;
+    while (stage.queue.pop(&entry)) {
+      if (!stage.in_order) {
+        if (!process(s, entry)) {
+          break;
+        }
+        continue;
+      }
+
+      // Process buffered items in the input order.
+      stage.reorder[entry.first] = std::move(entry);
+      bool ok = true;
+      while (ok && !stage.reorder.empty() &&
+             (stage.reorder.begin()->first == stage.next_index)) {
+        Entry next = std::move(stage.reorder.begin()->second);
+        stage.reorder.erase(stage.reorder.begin());
+        stage.next_index++;
+        ok = process(s, next);
+      }
+      if (!ok) {
+        break;
+      }
+    }
+    if (stage.in_order) {
+      stage.reorder.clear();  // items left by an error
+    }
+
+    // The last worker of the stage closes the queue of the next stage.
+    if ((--stage.n_active == 0) && (s + 1 < stages.size())) {
+      stages[s + 1]->queue.close();
+    }
+  }
+
+  const size_t queue_capacity;
+  std::vector<std::unique_ptr<Stage>> stages;
+
+  std::mutex mutex;
+  std::condition_variable slot_available;
+  bool failed = false;
+  size_t n_in_flight = 0;
+  size_t max_in_flight = 0;
+};
+
+} // namespace prnet
+
+#endif // PRNET_INFER_PIPELINE_H_
@@ -0,0 +1,356 @@
+#include "pose_estimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+namespace prnet {
+
+namespace {
+
+const double kPi = 3.14159265358979323846;
+
+// Eigen decomposition of a symmetric 4x4 matrix with cyclic Jacobi rotations.
+// Returns the eigen vector of the largest eigen value.
+void LargestEigenVector4(double A[4][4], double v[4]) {
+  double V[4][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}};
+
+  for (int sweep = 0; sweep < 32; sweep++) {
+    double off = 0.0;
+    for (int p = 0; p < 4; p++) {
+      for (int q = p + 1; q < 4; q++) {
+        off += A[p][q] * A[p][q];
+      }
+    }
+    if (off < 1e-30) {
+      break;
+    }
+
+    for (int p = 0; p < 4; p++) {
+      for (int q = p + 1; q < 4; q++) {
+        if (std::fabs(A[p][q]) < 1e-300) {
+          continue;
+        }
+        const double theta = (A[q][q] - A[p][p]) / (2.0 * A[p][q]);
+        const double t = ((theta >= 0.0) ? 1.0 : -1.0) /
+                         (std::fabs(theta) + std::sqrt(theta * theta + 1.0));
+        const double c = 1.0 / std::sqrt(t * t + 1.0);
+        const double s = t * c;
+
+        for (int k = 0; k < 4; k++) {
+          const double akp = A[k][p];
+          const double akq = A[k][q];
+          A[k][p] = c * akp - s * akq;
+          A[k][q] = s * akp + c * akq;
+        }
+        for (int k = 0; k < 4; k++) {
+          const double apk = A[p][k];
+          const double aqk = A[q][k];
+          A[p][k] = c * apk - s * aqk;
+          A[q][k] = s * apk + c * aqk;
+        }
+        for (int k = 0; k < 4; k++) {
+          const double vkp = V[k][p];
+          const double vkq = V[k][q];
+          V[k][p] = c * vkp - s * vkq;
+          V[k][q] = s * vkp + c * vkq;
+        }
+      }
+    }
+  }
+
+  int largest = 0;
+  for (int k = 1; k < 4; k++) {
+    if (A[k][k] > A[largest][largest]) {
+      largest = k;
+    }
+  }
+  for (int k = 0; k < 4; k++) {
+    v[k] = V[k][largest];
+  }
+}
+
+// Fits `dst` = scale * R * `src` + t to the points in `ids`.
+// Returns false for degenerated point sets.
+bool FitSimilarity(const float *src, const float *dst,
+                   const std::vector<size_t> &ids, Pose *pose) {
+  const size_t n = ids.size();
+  if (n < 3) {
+    return false;
+  }
+
+  double ms[3] = {0, 0, 0}, md[3] = {0, 0, 0};
+  for (size_t i : ids) {
+    for (int k = 0; k < 3; k++) {
+      ms[k] += double(src[3 * i + size_t(k)]);
+      md[k] += double(dst[3 * i + size_t(k)]);
+    }
+  }
+  for (int k = 0; k < 3; k++) {
+    ms[k] /= double(n);
+    md[k] /= double(n);
+  }
+
+  // S = sum a b^T, a = src - ms, b = dst - md
+  double S[3][3] = {{0}};
+  double src_var = 0.0;
+  for (size_t i : ids) {
+    double a[3], b[3];
+    for (int k = 0; k < 3; k++) {
+      a[k] = double(src[3 * i + size_t(k)]) - ms[k];
+      b[k] = double(dst[3 * i + size_t(k)]) - md[k];
+    }
+    for (int r = 0; r < 3; r++) {
+      for (int c = 0; c < 3; c++) {
+        S[r][c] += a[r] * b[c];
+      }
+    }
+    src_var += a[0] * a[0] + a[1] * a[1] + a[2] * a[2];
+  }
+  if (src_var < 1e-12) {
+    return false;
+  }
+
+  // Horn, "Closed-form solution of absolute orientation using unit
+  // quaternions", 1987.
+  double N[4][4] = {
+      {S[0][0] + S[1][1] + S[2][2], S[1][2] - S[2][1], S[2][0] - S[0][2],
+       S[0][1] - S[1][0]},
+      {S[1][2] - S[2][1], S[0][0] - S[1][1] - S[2][2], S[0][1] + S[1][0],
+       S[2][0] + S[0][2]},
+      {S[2][0] - S[0][2], S[0][1] + S[1][0], -S[0][0] + S[1][1] - S[2][2],
+       S[1][2] + S[2][1]},
+      {S[0][1] - S[1][0], S[2][0] + S[0][2], S[1][2] + S[2][1],
+       -S[0][0] - S[1][1] + S[2][2]}};
+  double q[4];
+  LargestEigenVector4(N, q);
+
+  const double w = q[0], x = q[1], y = q[2], z = q[3];
+  const double R[3][3] = {
+      {w * w + x * x - y * y - z * z, 2 * (x * y - w * z), 2 * (x * z + w * y)},
+      {2 * (x * y + w * z), w * w - x * x + y * y - z * z, 2 * (y * z - w * x)},
+      {2 * (x * z - w * y), 2 * (y * z + w * x), w * w - x * x - y * y + z * z}};
+
+  // scale = tr(R S^T) / var(src)
+  double dot = 0.0;
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 3; c++) {
+      dot += R[r][c] * S[c][r];
+    }
+  }
+  const double scale = dot / src_var;
+
+  pose->scale = float(scale);
+  for (int r = 0; r < 3; r++) {
+    double t = md[r];
+    for (int c = 0; c < 3; c++) {
+      pose->rotation[r][c] = float(R[r][c]);
+      t -= scale * R[r][c] * ms[c];
+    }
+    pose->translation[r] = float(t);
+  }
+  pose->num_inliers = n;
+
+  return true;
+}
+
+float Residual(const Pose &pose, const float *src, const float *dst) {
+  float d2 = 0.0f;
+  for (int r = 0; r < 3; r++) {
+    float p = pose.translation[r];
+    for (int c = 0; c < 3; c++) {
+      p += pose.scale * pose.rotation[r][c] * src[c];
+    }
+    d2 += (p - dst[r]) * (p - dst[r]);
+  }
+  return std::sqrt(d2);
+}
+
+void ComputeEulerAngles(Pose *pose) {
+  const float (&R)[3][3] = pose->rotation;
+  const float rad2deg = float(180.0 / kPi);
+  pose->yaw = std::asin(std::max(-1.0f, std::min(1.0f, -R[2][0]))) * rad2deg;
+  pose->pitch = std::atan2(R[2][1], R[2][2]) * rad2deg;
+  pose->roll = std::atan2(R[1][0], R[0][0]) * rad2deg;
+}
+
+} // anonymous namespace
+
+bool PoseEstimator::init(const FaceData &face_data, size_t num_samples,
+                         size_t pos_width) {
+  vertex_ids.clear();
+  canonical.clear();
+
+  const size_t n_vertices = face_data.face_indices.size();
+  if ((n_vertices == 0) || (face_data.canonical_vertices.size() != n_vertices)) {
+    std::cerr << "# of face indices(" << n_vertices
+              << ") does not match with # of canonical vertices("
+              << face_data.canonical_vertices.size() << ")" << std::endl;
+    return false;
+  }
+
+  if (num_samples > 0) {
+    num_samples = std::min(num_samples, n_vertices);
+    for (size_t i = 0; i < num_samples; i++) {
+      vertex_ids.push_back(uint32_t(i * n_vertices / num_samples));
+    }
+  } else {
+    // Landmark pixel -> nearest vertex in the position map.
+    const size_t n_pt = face_data.uv_kpt_indices.size() / 2;
+    for (size_t i = 0; i < n_pt; i++) {
+      const int64_t kx = face_data.uv_kpt_indices[i];
+      const int64_t ky = face_data.uv_kpt_indices[i + n_pt];
+      int64_t best_d2 = -1;
+      uint32_t best = 0;
+      for (size_t v = 0; v < n_vertices; v++) {
+        const int64_t px = int64_t(face_data.face_indices[v] % pos_width);
+        const int64_t py = int64_t(face_data.face_indices[v] / pos_width);
+        const int64_t d2 = (px - kx) * (px - kx) + (py - ky) * (py - ky);
+        if ((best_d2 < 0) || (d2 < best_d2)) {
+          best_d2 = d2;
+          best = uint32_t(v);
+        }
+        if (d2 == 0) {
+          break;
+        }
+      }
+      vertex_ids.push_back(best);
+    }
+  }
+
+  if (vertex_ids.size() < 3) {
+    std::cerr << "Pose estimation requires 3 or more points." << std::endl;
+    vertex_ids.clear();
+    return false;
+  }
+
+  for (uint32_t id : vertex_ids) {
+    canonical.insert(canonical.end(), face_data.canonical_vertices[id].begin(),
+                     face_data.canonical_vertices[id].end());
+  }
+
+  return true;
+}
+
+bool PoseEstimator::estimate(const Mesh &mesh, Pose *pose) const {
+  const size_t n = vertex_ids.size();
+  if (n == 0) {
+    std::cerr << "PoseEstimator is not initialized." << std::endl;
+    return false;
+  }
+
+  std::vector<float> points(3 * n);
+  for (size_t i = 0; i < n; i++) {
+    const size_t id = vertex_ids[i];
+    if (3 * id + 2 >= mesh.vertices.size()) {
+      std::cerr << "Mesh does not have vertex " << id << std::endl;
+      return false;
+    }
+    points[3 * i + 0] = mesh.vertices[3 * id + 0];
+    points[3 * i + 1] = mesh.vertices[3 * id + 1];
+    points[3 * i + 2] = mesh.vertices[3 * id + 2];
+  }
+
+  std::vector<size_t> all_ids(n);
+  for (size_t i = 0; i < n; i++) {
+    all_ids[i] = i;
+  }
+
+  if (!FitSimilarity(canonical.data(), points.data(), all_ids, pose)) {
+    std::cerr << "Failed to fit pose(degenerated points)." << std::endl;
+    return false;
+  }
+
+  if (ransac_iterations > 0) {
+    // Inlier threshold relative to the size of the face.
+    float mean[3] = {0, 0, 0};
+    for (size_t i = 0; i < n; i++) {
+      for (int k = 0; k < 3; k++) mean[k] += points[3 * i + size_t(k)] / float(n);
+    }
+    float radius2 = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+      for (int k = 0; k < 3; k++) {
+        const float d = points[3 * i + size_t(k)] - mean[k];
+        radius2 += d * d / float(n);
+      }
+    }
+    const float threshold = ransac_threshold * std::sqrt(radius2);
+
+    std::mt19937 rng(0);  // deterministic
+    std::uniform_int_distribution<size_t> dist(0, n - 1);
+    std::vector<size_t> best_inliers;
+    std::vector<size_t> sample(3), inliers;
+    for (int it = 0; it < ransac_iterations; it++) {
+      sample[0] = dist(rng);
+      sample[1] = dist(rng);
+      sample[2] = dist(rng);
+      if ((sample[0] == sample[1]) || (sample[1] == sample[2]) ||
+          (sample[0] == sample[2])) {
+        continue;
+      }
+
+      Pose candidate;
+      if (!FitSimilarity(canonical.data(), points.data(), sample, &candidate)) {
+        continue;
+      }
+
+      inliers.clear();
+      for (size_t i = 0; i < n; i++) {
+        if (Residual(candidate, &canonical[3 * i], &points[3 * i]) < threshold) {
+          inliers.push_back(i);
+        }
+      }
+      if (inliers.size() > best_inliers.size()) {
+        best_inliers.swap(inliers);
+      }
+    }
+
+    // Refit with inliers.
+    if (best_inliers.size() >= 3) {
+      Pose refined;
+      if (FitSimilarity(canonical.data(), points.data(), best_inliers,
+                        &refined)) {
+        *pose = refined;
+      }
+    }
+  }
+
+  ComputeEulerAngles(pose);
+
+  return true;
+}
+
+void PoseEstimator::Frontalize(const Pose &pose, Mesh *mesh) {
+  // x_canonical = R^T (x_mesh - t) / scale
+  const float inv_scale = (std::fabs(pose.scale) > 0.0f) ? 1.0f / pose.scale : 0.0f;
+  float *v = mesh->vertices.data();
+  const size_t n = mesh->vertices.size() / 3;
+  float bmin[3] = {1e30f, 1e30f, 1e30f};
+  float bmax[3] = {-1e30f, -1e30f, -1e30f};
+  for (size_t i = 0; i < n; i++) {
+    const float d[3] = {v[3 * i + 0] - pose.translation[0],
+                        v[3 * i + 1] - pose.translation[1],
+                        v[3 * i + 2] - pose.translation[2]};
+    for (int k = 0; k < 3; k++) {
+      const float f = inv_scale * (pose.rotation[0][k] * d[0] +
+                                   pose.rotation[1][k] * d[1] +
+                                   pose.rotation[2][k] * d[2]);
+      v[3 * i + size_t(k)] = f;
+      bmin[k] = std::min(bmin[k], f);
+      bmax[k] = std::max(bmax[k], f);
+    }
+  }
+
+  // Centerize vertex position(same as `FrontalizeFaceMesh`).
+  const float center[3] = {0.5f * (bmin[0] + bmax[0]),
+                           0.5f * (bmin[1] + bmax[1]),
+                           0.5f * (bmin[2] + bmax[2])};
+  for (size_t i = 0; i < n; i++) {
+    v[3 * i + 0] -= center[0];
+    v[3 * i + 1] -= center[1];
+    v[3 * i + 2] -= center[2];
+  }
+}
+
+} // namespace prnet
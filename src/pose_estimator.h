@@ -0,0 +1,66 @@
+#ifndef PRNET_INFER_POSE_ESTIMATOR_H_
+#define PRNET_INFER_POSE_ESTIMATOR_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "face-data.h"
+#include "mesh.h"
+
+namespace prnet {
+
+///
+/// Head pose. Similarity transform from the canonical(frontal) face to a mesh.
+///
+///   x_mesh = scale * R * x_canonical + t
+///
+struct Pose {
+  float scale = 1.0f;
+  float rotation[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+  float translation[3] = {0, 0, 0};
+
+  // Euler angles in degree. R = Rz(roll) * Ry(yaw) * Rx(pitch)
+  float yaw = 0.0f;
+  float pitch = 0.0f;
+  float roll = 0.0f;
+
+  size_t num_inliers = 0;
+};
+
+///
+/// Estimates head pose from a sparse set of vertices(68 landmarks by default)
+/// with a closed form similarity fit(Horn's quaternion method), optionally
+/// with RANSAC.
+///
+class PoseEstimator {
+public:
+  // Uses landmark vertices of `face_data`. When `num_samples` > 0, evenly
+  // spaced `num_samples` vertices are used instead.
+  // `pos_width` is the width of position maps. Returns false on invalid data.
+  bool init(const FaceData &face_data, size_t num_samples = 0,
+            size_t pos_width = 256);
+
+  // Enables RANSAC with `iterations` trials(0 = disable). A point is an inlier
+  // when its residual is less than `threshold` times the RMS radius of the
+  // points.
+  void set_ransac(int iterations, float threshold = 0.05f) {
+    ransac_iterations = iterations;
+    ransac_threshold = threshold;
+  }
+
+  bool estimate(const Mesh &mesh, Pose *pose) const;
+
+  // Transforms the vertices of `mesh` to the canonical frame with the inverse
+  // of `pose`(rigid frontalization), then centerizes them.
+  static void Frontalize(const Pose &pose, Mesh *mesh);
+
+private:
+  std::vector<uint32_t> vertex_ids;  // vertices used for estimation
+  std::vector<float> canonical;      // 3 * vertex_ids.size()
+  int ransac_iterations = 0;
+  float ransac_threshold = 0.05f;
+};
+
+} // namespace prnet
+
+#endif // PRNET_INFER_POSE_ESTIMATOR_H_
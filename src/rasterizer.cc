@@ -0,0 +1,154 @@
+#include "rasterizer.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace prnet {
+
+float DepthBuffer::fetch(int x, int y) const {
+  x -= x0;
+  y -= y0;
+  if ((x < 0) || (y < 0) || (x >= int(width)) || (y >= int(height))) {
+    return -std::numeric_limits<float>::infinity();
+  }
+  return depth[size_t(y) * width + size_t(x)];
+}
+
+namespace {
+
+// Rasterizes triangles clipped to pixels [rx0, rx1] x [ry0, ry1] of the image.
+void RasterizeRows(const float *vertices, const uint32_t *faces,
+                   size_t n_faces, int rx0, int rx1, int ry0, int ry1,
+                   DepthBuffer *buffer) {
+  float *depth = buffer->depth.data();
+  const size_t bw = buffer->width;
+  for (size_t f = 0; f < n_faces; f++) {
+    const float *v0 = &vertices[3 * faces[3 * f + 0]];
+    const float *v1 = &vertices[3 * faces[3 * f + 1]];
+    const float *v2 = &vertices[3 * faces[3 * f + 2]];
+
+    // Barycentric weights are linear in (x, y): w = a * x + b * y + c.
+    const float area = (v1[0] - v0[0]) * (v2[1] - v0[1]) -
+                       (v2[0] - v0[0]) * (v1[1] - v0[1]);
+    if (std::fabs(area) < 1e-12f) {
+      continue;
+    }
+
+    const int x0 = std::max(rx0, int(std::ceil(std::min(v0[0], std::min(v1[0], v2[0])))));
+    const int y0 = std::max(ry0, int(std::ceil(std::min(v0[1], std::min(v1[1], v2[1])))));
+    const int x1 = std::min(rx1, int(std::floor(std::max(v0[0], std::max(v1[0], v2[0])))));
+    const int y1 = std::min(ry1, int(std::floor(std::max(v0[1], std::max(v1[1], v2[1])))));
+    if ((x0 > x1) || (y0 > y1)) {
+      continue;
+    }
+
+    const float inv_area = 1.0f / area;
+    const float a0 = (v1[1] - v2[1]) * inv_area;
+    const float b0 = (v2[0] - v1[0]) * inv_area;
+    const float c0 = (v1[0] * v2[1] - v2[0] * v1[1]) * inv_area;
+    const float a1 = (v2[1] - v0[1]) * inv_area;
+    const float b1 = (v0[0] - v2[0]) * inv_area;
+    const float c1 = (v2[0] * v0[1] - v0[0] * v2[1]) * inv_area;
+    // z = az * x + bz * y + cz
+    const float az = a0 * (v0[2] - v2[2]) + a1 * (v1[2] - v2[2]);
+    const float bz = b0 * (v0[2] - v2[2]) + b1 * (v1[2] - v2[2]);
+    const float cz = c0 * (v0[2] - v2[2]) + c1 * (v1[2] - v2[2]) + v2[2];
+
+    for (int y = y0; y <= y1; y++) {
+      const float py = float(y);
+      float w0 = a0 * float(x0) + b0 * py + c0;
+      float w1 = a1 * float(x0) + b1 * py + c1;
+      float z = az * float(x0) + bz * py + cz;
+      float *row = depth + size_t(y - buffer->y0) * bw - buffer->x0;
+      for (int x = x0; x <= x1; x++, w0 += a0, w1 += a1, z += az) {
+        if ((w0 >= 0.0f) && (w1 >= 0.0f) && (w0 + w1 <= 1.0f)) {
+          row[x] = std::max(row[x], z);
+        }
+      }
+    }
+  }
+}
+
+} // anonymous namespace
+
+void RasterizeDepth(const float *vertices, size_t n_vertices,
+                    const uint32_t *faces, size_t n_faces, size_t image_width,
+                    size_t image_height, DepthBuffer *buffer) {
+  const float kEmpty = -std::numeric_limits<float>::infinity();
+
+  // Region = bounding box of vertices clipped to the image.
+  float bmin[2] = {std::numeric_limits<float>::max(),
+                   std::numeric_limits<float>::max()};
+  float bmax[2] = {-std::numeric_limits<float>::max(),
+                   -std::numeric_limits<float>::max()};
+  for (size_t i = 0; i < n_vertices; i++) {
+    bmin[0] = std::min(bmin[0], vertices[3 * i + 0]);
+    bmin[1] = std::min(bmin[1], vertices[3 * i + 1]);
+    bmax[0] = std::max(bmax[0], vertices[3 * i + 0]);
+    bmax[1] = std::max(bmax[1], vertices[3 * i + 1]);
+  }
+  const int rx0 = std::max(0, int(std::ceil(bmin[0])));
+  const int ry0 = std::max(0, int(std::ceil(bmin[1])));
+  const int rx1 = std::min(int(image_width) - 1, int(std::floor(bmax[0])));
+  const int ry1 = std::min(int(image_height) - 1, int(std::floor(bmax[1])));
+
+  buffer->x0 = rx0;
+  buffer->y0 = ry0;
+  buffer->width = (rx1 >= rx0) ? size_t(rx1 - rx0 + 1) : 0;
+  buffer->height = (ry1 >= ry0) ? size_t(ry1 - ry0 + 1) : 0;
+  buffer->depth.assign(buffer->width * buffer->height, kEmpty);
+  if (buffer->depth.empty()) {
+    return;
+  }
+
+  // Rows are split into bands rasterized in parallel. Each band clips all
+  // triangles to its rows, so no synchronization is required.
+  ThreadPool &pool = GetSharedThreadPool();
+  const size_t n_bands = std::min(buffer->height, pool.size());
+  pool.parallel_for(n_bands, [&](size_t band) {
+    const int band_y0 = ry0 + int(buffer->height * band / n_bands);
+    const int band_y1 = ry0 + int(buffer->height * (band + 1) / n_bands) - 1;
+    RasterizeRows(vertices, faces, n_faces, rx0, rx1, band_y0, band_y1, buffer);
+  });
+}
+
+void ComputeVisibility(const DepthBuffer &buffer, const Image<float> &pos_img,
+                       Image<float> *mask, float tolerance) {
+  const size_t width = pos_img.getWidth();
+  const size_t height = pos_img.getHeight();
+  const size_t channels = pos_img.getChannels();
+  mask->create(width, height, 1);
+
+  const float tol = std::max(1e-6f, tolerance * float(std::max(buffer.width, buffer.height)));
+  const float inv_tol = 1.0f / tol;
+
+  const float *src = pos_img.getData();
+  float *dst = mask->getData();
+  for (size_t i = 0; i < width * height; i++) {
+    const float x = src[channels * i + 0];
+    const float y = src[channels * i + 1];
+    const float z = src[channels * i + 2];
+
+    // Nearest pixel. The point may fall just outside of rasterized pixels on
+    // silhouettes, so the 2x2 footprint is used for empty pixels.
+    const int ix = int(std::floor(x));
+    const int iy = int(std::floor(y));
+    float d = buffer.fetch(int(std::floor(x + 0.5f)), int(std::floor(y + 0.5f)));
+    if (!(d > -std::numeric_limits<float>::infinity())) {
+      d = std::max(std::max(buffer.fetch(ix, iy), buffer.fetch(ix + 1, iy)),
+                   std::max(buffer.fetch(ix, iy + 1), buffer.fetch(ix + 1, iy + 1)));
+    }
+    if (!(d > -std::numeric_limits<float>::infinity())) {
+      dst[i] = 1.0f;  // not covered by the mesh.
+      continue;
+    }
+
+    // 1 within `tol` behind the surface, then fades to 0 at 2 * `tol`.
+    const float behind = d - z;
+    dst[i] = std::max(0.0f, std::min(1.0f, 2.0f - behind * inv_tol));
+  }
+}
+
+} // namespace prnet
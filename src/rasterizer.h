@@ -0,0 +1,47 @@
+#ifndef PRNET_INFER_RASTERIZER_H_
+#define PRNET_INFER_RASTERIZER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "image.h"
+
+namespace prnet {
+
+///
+/// Depth buffer covering a region of an image.
+/// Larger depth is closer to the camera(same as PRNet).
+///
+struct DepthBuffer {
+  int x0 = 0;  // region in the image
+  int y0 = 0;
+  size_t width = 0;
+  size_t height = 0;
+  std::vector<float> depth;  // -inf = empty
+
+  // Returns -inf outside of the region.
+  float fetch(int x, int y) const;
+};
+
+///
+/// Rasterizes triangles into a depth buffer. `vertices`(3 * `n_vertices`) are
+/// in the pixel coordinate of an image(`image_width` x `image_height`), with
+/// the depth in z. Pixel centers are located at integer coordinates.
+/// The buffer covers the bounding box of the vertices clipped to the image.
+///
+void RasterizeDepth(const float *vertices, size_t n_vertices,
+                    const uint32_t *faces, size_t n_faces, size_t image_width,
+                    size_t image_height, DepthBuffer *buffer);
+
+///
+/// Computes visibility of each pixel of a position map(remapped to the image
+/// coordinate) with `buffer`. `mask`(same resolution as `pos_img`, 1 channel)
+/// is 1 for visible points and fades to 0 for points behind the surface by
+/// more than `tolerance` times the size of the depth buffer region.
+///
+void ComputeVisibility(const DepthBuffer &buffer, const Image<float> &pos_img,
+                       Image<float> *mask, float tolerance = 0.02f);
+
+} // namespace prnet
+
+#endif // PRNET_INFER_RASTERIZER_H_
@@ -0,0 +1,468 @@
+#include "shm_ring.h"
+
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+namespace prnet {
+
+namespace {
+
+const size_t kSlotAlignment = 64;
+
+inline size_t Align(size_t size) {
+  return (size + kSlotAlignment - 1) / kSlotAlignment * kSlotAlignment;
+}
+
+// Names of shared memory objects start with '/'.
+inline std::string ObjectName(const std::string &name) {
+  return (!name.empty() && (name[0] == '/')) ? name : "/" + name;
+}
+
+// Sleeps while `*word` is `value`, at most `timeout_ms`. May return early.
+// Futex is not private, so processes sharing the memory wake each other.
+void WaitWhile(std::atomic<uint32_t> *word, uint32_t value, int timeout_ms) {
+#if defined(__linux__)
+  timespec ts;
+  ts.tv_sec = timeout_ms / 1000;
+  ts.tv_nsec = long(timeout_ms % 1000) * 1000000;
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT, value,
+          &ts, nullptr, 0);
+#else
+  // Polling
+  (void)timeout_ms;
+  if (word->load(std::memory_order_acquire) == value) {
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+#endif
+}
+
+void WakeAll(std::atomic<uint32_t> *word) {
+#if defined(__linux__)
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE, INT_MAX,
+          nullptr, nullptr, 0);
+#else
+  (void)word;
+#endif
+}
+
+// Waits until `*word` becomes `desired`. Returns false on timeout.
+bool WaitFor(std::atomic<uint32_t> *word, uint32_t desired, int timeout_ms) {
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  for (;;) {
+    const uint32_t value = word->load(std::memory_order_acquire);
+    if (value == desired) {
+      return true;
+    }
+    const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    if (remaining.count() <= 0) {
+      return false;
+    }
+    WaitWhile(word, value, int(remaining.count()));
+  }
+}
+
+// Wakes clients waiting for a free slot.
+void NotifyReleased(ShmRingHeader *header) {
+  header->n_released.fetch_add(1, std::memory_order_release);
+  WakeAll(&header->n_released);
+}
+
+#if !defined(_WIN32)
+inline uint32_t CurrentPid() { return uint32_t(getpid()); }
+
+inline bool IsDeadProcess(uint32_t pid) {
+  // EPERM means the process exists(of another user).
+  return (kill(pid_t(pid), 0) != 0) && (errno == ESRCH);
+}
+#else
+inline uint32_t CurrentPid() { return 0; }
+inline bool IsDeadProcess(uint32_t) { return false; }
+#endif
+
+} // namespace
+
+ShmRing::~ShmRing() { close(); }
+
+ShmSlotHeader *ShmRing::slot(size_t i) const {
+  return reinterpret_cast<ShmSlotHeader *>(base + sizeof(ShmRingHeader) +
+                                           i * stride);
+}
+
+unsigned char *ShmRing::input(size_t i) const {
+  return reinterpret_cast<unsigned char *>(slot(i)) + sizeof(ShmSlotHeader);
+}
+
+unsigned char *ShmRing::output(size_t i) const {
+  return input(i) + Align(input_bytes);
+}
+
+#if defined(_WIN32)
+
+bool ShmRing::create(const ShmRingOptions &) {
+  std::cerr << "Shared memory transport is not supported on this platform."
+            << std::endl;
+  return false;
+}
+
+bool ShmRing::open(const std::string &) {
+  std::cerr << "Shared memory transport is not supported on this platform."
+            << std::endl;
+  return false;
+}
+
+void ShmRing::close() {}
+
+#else
+
+bool ShmRing::create(const ShmRingOptions &options) {
+  close();
+  if ((options.n_slots == 0) || (options.input_capacity == 0) ||
+      (options.output_capacity == 0)) {
+    std::cerr << "Invalid shared memory ring options." << std::endl;
+    return false;
+  }
+
+  const size_t slot_stride = sizeof(ShmSlotHeader) +
+                             Align(options.input_capacity) +
+                             Align(options.output_capacity);
+  const size_t total = sizeof(ShmRingHeader) + options.n_slots * slot_stride;
+
+  // An existing object may be used by a running server, so it is only
+  // replaced on request.
+  const std::string object_name = ObjectName(options.name);
+  if (options.replace) {
+    shm_unlink(object_name.c_str());
+  }
+  const int fd =
+      shm_open(object_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    std::cerr << "Failed to create shared memory " << object_name << " : "
+              << strerror(errno) << std::endl;
+    if (errno == EEXIST) {
+      std::cerr << "Another server may be using it. Remove it(or use "
+                   "--shm_replace) if it is left by a crashed server."
+                << std::endl;
+    }
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0) {
+    object_dev = uint64_t(st.st_dev);
+    object_ino = uint64_t(st.st_ino);
+  }
+  if (ftruncate(fd, off_t(total)) != 0) {
+    std::cerr << "Failed to allocate shared memory : " << strerror(errno)
+              << std::endl;
+    ::close(fd);
+    shm_unlink(object_name.c_str());
+    return false;
+  }
+  void *addr = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    std::cerr << "Failed to map shared memory : " << strerror(errno)
+              << std::endl;
+    shm_unlink(object_name.c_str());
+    return false;
+  }
+
+  name = object_name;
+  owner = true;
+  base = static_cast<unsigned char *>(addr);
+  size = total;
+  slot_count = options.n_slots;
+  input_bytes = options.input_capacity;
+  output_bytes = options.output_capacity;
+  stride = slot_stride;
+
+  // Pages are zero filled, i.e. all slots are free.
+  header = new (base) ShmRingHeader();
+  header->n_released.store(0);
+  header->n_slots = uint32_t(slot_count);
+  header->input_capacity = input_bytes;
+  header->output_capacity = output_bytes;
+  header->slot_stride = stride;
+  for (size_t i = 0; i < slot_count; i++) {
+    ShmSlotHeader *s = new (slot(i)) ShmSlotHeader();
+    s->state.store(kShmSlotFree);
+    s->owner_pid.store(0);
+  }
+  header->version = kShmRingVersion;
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = kShmRingMagic;
+
+  return true;
+}
+
+bool ShmRing::open(const std::string &_name) {
+  close();
+  const std::string object_name = ObjectName(_name);
+  const int fd = shm_open(object_name.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    std::cerr << "Failed to open shared memory " << object_name << " : "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+  struct stat st;
+  if ((fstat(fd, &st) != 0) || (size_t(st.st_size) < sizeof(ShmRingHeader))) {
+    std::cerr << "Invalid shared memory : " << object_name << std::endl;
+    ::close(fd);
+    return false;
+  }
+  const size_t total = size_t(st.st_size);
+  void *addr = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    std::cerr << "Failed to map shared memory : " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+
+  name = object_name;
+  owner = false;
+  base = static_cast<unsigned char *>(addr);
+  size = total;
+  header = reinterpret_cast<ShmRingHeader *>(base);
+
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if ((header->magic != kShmRingMagic) ||
+      (header->version != kShmRingVersion)) {
+    std::cerr << "Invalid shared memory(or not ready) : " << object_name
+              << std::endl;
+    close();
+    return false;
+  }
+
+  // Read the geometry once, and check it in 64 bit without overflow.
+  const uint64_t n_slots = header->n_slots;
+  const uint64_t in_capacity = header->input_capacity;
+  const uint64_t out_capacity = header->output_capacity;
+  const uint64_t slot_stride = header->slot_stride;
+  const uint64_t kMaxCapacity = uint64_t(1) << 40;
+  const uint64_t available = uint64_t(total) - sizeof(ShmRingHeader);
+  if ((n_slots == 0) || (in_capacity > kMaxCapacity) ||
+      (out_capacity > kMaxCapacity) ||
+      (slot_stride < sizeof(ShmSlotHeader) + Align(size_t(in_capacity)) +
+                         Align(size_t(out_capacity))) ||
+      (slot_stride > available / n_slots)) {
+    std::cerr << "Invalid shared memory : " << object_name << std::endl;
+    close();
+    return false;
+  }
+  slot_count = size_t(n_slots);
+  input_bytes = size_t(in_capacity);
+  output_bytes = size_t(out_capacity);
+  stride = size_t(slot_stride);
+
+  return true;
+}
+
+void ShmRing::close() {
+  if (base) {
+    munmap(base, size);
+    if (owner) {
+      // Unlink only our own object, not the one of a server which replaced
+      // it.
+      const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+      struct stat st;
+      if (fd >= 0) {
+        if ((fstat(fd, &st) == 0) && (uint64_t(st.st_dev) == object_dev) &&
+            (uint64_t(st.st_ino) == object_ino)) {
+          shm_unlink(name.c_str());
+        }
+        ::close(fd);
+      }
+    }
+  }
+  base = nullptr;
+  header = nullptr;
+  size = 0;
+  owner = false;
+  slot_count = 0;
+  input_bytes = 0;
+  output_bytes = 0;
+  stride = 0;
+}
+
+#endif
+
+ShmRingServer::~ShmRingServer() { ring.close(); }
+
+bool ShmRingServer::start(const ShmRingOptions &options,
+                          const ServerHandler &_handler) {
+  handler = _handler;
+  quit = false;
+  if (!ring.create(options)) {
+    return false;
+  }
+  std::cout << "Serving on shared memory " << ObjectName(options.name) << "("
+            << options.n_slots << " slots)" << std::endl;
+  return true;
+}
+
+void ShmRingServer::run() {
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < ring.num_slots(); i++) {
+    threads.emplace_back([this, i]() { serve(i); });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+}
+
+void ShmRingServer::stop() {
+  // Slot threads wake up periodically to see the flag.
+  quit = true;
+}
+
+bool ShmRingServer::reclaim(size_t i) {
+  // Only the thread of the slot reclaims it, and a client clears the pid
+  // before freeing the slot, so a recorded pid belongs to the current owner.
+  // The pid is 0 until the client stores it after claiming.
+  ShmSlotHeader *slot = ring.slot(i);
+  const uint32_t state = slot->state.load(std::memory_order_acquire);
+  const uint32_t pid = slot->owner_pid.load(std::memory_order_acquire);
+  if (((state != kShmSlotClaimed) && (state != kShmSlotDone)) || (pid == 0) ||
+      !IsDeadProcess(pid)) {
+    return false;
+  }
+
+  uint32_t expected = state;
+  slot->owner_pid.store(0, std::memory_order_relaxed);
+  if (!slot->state.compare_exchange_strong(expected, kShmSlotFree,
+                                           std::memory_order_release)) {
+    return false;
+  }
+  std::cerr << "Freed shared memory slot " << i << " of dead process " << pid
+            << std::endl;
+  NotifyReleased(ring.get_header());
+  return true;
+}
+
+void ShmRingServer::serve(size_t i) {
+  ShmSlotHeader *slot = ring.slot(i);
+  ServerRequest request;
+  ServerResponse response;
+  auto last_check = std::chrono::steady_clock::now();
+  while (!quit) {
+    const uint32_t state = slot->state.load(std::memory_order_acquire);
+    if (state != kShmSlotRequest) {
+      // Look for a dead owner every 100ms while the slot is held.
+      const auto now = std::chrono::steady_clock::now();
+      if ((state != kShmSlotFree) &&
+          (now - last_check > std::chrono::milliseconds(100))) {
+        last_check = now;
+        if (reclaim(i)) {
+          continue;
+        }
+      }
+      WaitWhile(&slot->state, state, /* timeout_ms */ 100);
+      continue;
+    }
+
+    request.header = slot->request;
+    request.payload = ring.input(i);
+    response.reset();
+    response.set_external_buffer(ring.output(i), ring.output_capacity());
+
+    const ServerRequestHeader &header = request.header;
+    if ((header.magic != kServerRequestMagic) ||
+        (header.version != kServerProtocolVersion) ||
+        (header.payload_size > ring.input_capacity())) {
+      response.set_error(kServerStatusBadRequest, "Invalid request header");
+    } else {
+      handler(request, &response);
+      if (response.overflowed()) {
+        response.set_error(kServerStatusFailed,
+                           "Outputs exceed the output area");
+      }
+    }
+
+    response.header.payload_size = uint32_t(response.payload_size());
+    slot->response = response.header;
+    slot->state.store(kShmSlotDone, std::memory_order_release);
+    WakeAll(&slot->state);
+  }
+}
+
+bool ShmRingClient::open(const std::string &name) { return ring.open(name); }
+
+int ShmRingClient::acquire(int timeout_ms) {
+  const size_t n_slots = ring.num_slots();
+  if (n_slots == 0) {
+    return -1;
+  }
+
+  ShmRingHeader *header = ring.get_header();
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  for (;;) {
+    const uint32_t n_released =
+        header->n_released.load(std::memory_order_acquire);
+    const size_t start = next_slot++;
+    for (size_t k = 0; k < n_slots; k++) {
+      const size_t i = (start + k) % n_slots;
+      uint32_t expected = kShmSlotFree;
+      ShmSlotHeader *s = ring.slot(i);
+      if (s->state.compare_exchange_strong(expected, kShmSlotClaimed,
+                                           std::memory_order_acquire)) {
+        s->owner_pid.store(CurrentPid(), std::memory_order_release);
+        return int(i);
+      }
+    }
+
+    const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    if (remaining.count() <= 0) {
+      return -1;
+    }
+    WaitWhile(&header->n_released, n_released, int(remaining.count()));
+  }
+}
+
+bool ShmRingClient::submit(int slot, const ServerRequestHeader &request) {
+  ShmSlotHeader *s = ring.slot(size_t(slot));
+  if ((request.payload_size > ring.input_capacity()) ||
+      (s->state.load(std::memory_order_relaxed) != kShmSlotClaimed)) {
+    return false;
+  }
+  s->request = request;
+  s->state.store(kShmSlotRequest, std::memory_order_release);
+  WakeAll(&s->state);
+  return true;
+}
+
+bool ShmRingClient::wait(int slot, int timeout_ms) {
+  return WaitFor(&ring.slot(size_t(slot))->state, kShmSlotDone, timeout_ms);
+}
+
+void ShmRingClient::release(int slot) {
+  ShmSlotHeader *s = ring.slot(size_t(slot));
+  while (s->state.load(std::memory_order_acquire) == kShmSlotRequest) {
+    WaitWhile(&s->state, kShmSlotRequest, 100);
+  }
+  s->owner_pid.store(0, std::memory_order_relaxed);
+  s->state.store(kShmSlotFree, std::memory_order_release);
+  NotifyReleased(ring.get_header());
+}
+
+} // namespace prnet
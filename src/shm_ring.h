@@ -0,0 +1,208 @@
+#ifndef PRNET_INFER_SHM_RING_H_
+#define PRNET_INFER_SHM_RING_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "inference_server.h"
+
+namespace prnet {
+
+// Shared memory transport for clients on the same host. The shared memory
+// object(`shm_open`) is a header followed by `n_slots` slots. A slot is a
+// control block, an input area and an output area:
+//
+//   client : claims a free slot, writes the image into the input area and
+//            submits the request.
+//   server : reads the image in place and writes outputs(the same payload
+//            as the socket protocol) into the output area.
+//   client : reads outputs in place and releases the slot.
+//
+// Images and outputs are not copied through the kernel. State changes of a
+// slot are notified with futex on Linux, and by polling elsewhere.
+//
+// A slot records the pid of the client which claimed it. The server frees a
+// slot claimed(or not released) by a process which no longer exists, so a
+// crashed client does not leak the slot. Clients must be in the same pid
+// namespace as the server. A slot may still leak if the pid of the crashed
+// client is reused by another process.
+
+const uint32_t kShmRingMagic = 0x534e5250;  // "PRNS"
+const uint32_t kShmRingVersion = 1;
+
+enum ShmSlotState : uint32_t {
+  kShmSlotFree = 0,
+  kShmSlotClaimed = 1,  // by a client, writing the request
+  kShmSlotRequest = 2,  // submitted, processed by the server
+  kShmSlotDone = 3,     // response is ready
+};
+
+struct ShmRingHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t n_slots;
+  std::atomic<uint32_t> n_released;  // notifies clients waiting for a slot
+  uint64_t input_capacity;   // bytes of an input area
+  uint64_t output_capacity;  // bytes of an output area
+  uint64_t slot_stride;      // bytes from a slot to the next one
+  uint64_t padding[3];
+};
+
+struct ShmSlotHeader {
+  std::atomic<uint32_t> state;
+  std::atomic<uint32_t> owner_pid;  // of the client, 0 while free
+  ServerRequestHeader request;    // `payload_size` bytes in the input area
+  ServerResponseHeader response;  // `payload_size` bytes in the output area
+  uint64_t padding[7];
+};
+
+static_assert(sizeof(ShmRingHeader) == 64, "unexpected padding");
+static_assert(sizeof(ShmSlotHeader) == 128, "unexpected padding");
+
+struct ShmRingOptions {
+  std::string name;  // of the shared memory object, e.g. "/prnet"
+  size_t n_slots = 4;
+  size_t input_capacity = 3840 * 2160 * 4;  // 4K RGBA
+  size_t output_capacity = 16 * 1024 * 1024;
+  bool replace = false;  // replace an existing object of the name
+};
+
+///
+/// Mapping of the shared memory object.
+///
+class ShmRing {
+public:
+  ShmRing() {}
+  ~ShmRing();
+
+  ShmRing(const ShmRing &) = delete;
+  ShmRing &operator=(const ShmRing &) = delete;
+
+  // Creates the shared memory object(server). Fails if an object of the same
+  // name exists, unless `options.replace` is set.
+  bool create(const ShmRingOptions &options);
+
+  // Maps the existing shared memory object(client).
+  bool open(const std::string &name);
+
+  void close();
+
+  size_t num_slots() const { return slot_count; }
+  size_t input_capacity() const { return input_bytes; }
+  size_t output_capacity() const { return output_bytes; }
+
+  ShmRingHeader *get_header() const { return header; }
+  ShmSlotHeader *slot(size_t i) const;
+  unsigned char *input(size_t i) const;
+  unsigned char *output(size_t i) const;
+
+private:
+  std::string name;
+  bool owner = false;  // unlinks the object at close
+  unsigned char *base = nullptr;
+  size_t size = 0;
+  ShmRingHeader *header = nullptr;
+  uint64_t object_dev = 0;  // to unlink only our own object
+  uint64_t object_ino = 0;
+
+  // Geometry of the slots. Copied from the header at `create` or `open`,
+  // since clients can write to the header in the shared memory.
+  size_t slot_count = 0;
+  size_t input_bytes = 0;
+  size_t output_bytes = 0;
+  size_t stride = 0;
+};
+
+///
+/// Serves requests of the shared memory slots. A thread per slot waits for
+/// its requests and calls the handler, so requests of multiple slots are
+/// processed(and batched) concurrently.
+///
+/// POSIX only. `start` fails on other platforms.
+///
+class ShmRingServer {
+public:
+  ShmRingServer() {}
+  ~ShmRingServer();
+
+  ShmRingServer(const ShmRingServer &) = delete;
+  ShmRingServer &operator=(const ShmRingServer &) = delete;
+
+  // Creates the shared memory object. Returns false on error.
+  bool start(const ShmRingOptions &options, const ServerHandler &handler);
+
+  // Serves requests until `stop` is called.
+  void run();
+
+  // Makes `run` return. Async signal safe.
+  void stop();
+
+private:
+  void serve(size_t slot);
+
+  // Frees the slot if the client holding it no longer exists.
+  bool reclaim(size_t slot);
+
+  ShmRing ring;
+  ServerHandler handler;
+  std::atomic<bool> quit{false};
+};
+
+///
+/// Client of `ShmRingServer`.
+///
+///   int slot = client.acquire();
+///   memcpy(client.input(slot), pixels, size);  // or decode into it
+///   ServerRequestHeader request;
+///   ...
+///   client.submit(slot, request);
+///   if (client.wait(slot, timeout_ms)) {
+///     const ServerResponseHeader &response = client.response(slot);
+///     const float *outputs = ...(client.output(slot));
+///   }
+///   client.release(slot);
+///
+/// Thread safe(slots are claimed atomically), and multiple processes can
+/// share the slots.
+///
+class ShmRingClient {
+public:
+  // Maps the shared memory object created by the server.
+  bool open(const std::string &name);
+
+  // Claims a free slot. Returns -1 if no slot became free in `timeout_ms`.
+  int acquire(int timeout_ms = 1000);
+
+  unsigned char *input(int slot) const { return ring.input(size_t(slot)); }
+  const unsigned char *output(int slot) const {
+    return ring.output(size_t(slot));
+  }
+  size_t input_capacity() const { return ring.input_capacity(); }
+  size_t output_capacity() const { return ring.output_capacity(); }
+
+  // Submits the request. The input area must not be modified until `wait`
+  // returns true.
+  bool submit(int slot, const ServerRequestHeader &request);
+
+  // Waits for the response. Returns false on timeout.
+  bool wait(int slot, int timeout_ms = 1000);
+
+  const ServerResponseHeader &response(int slot) const {
+    return ring.slot(size_t(slot))->response;
+  }
+
+  // Frees the slot after reading outputs. Blocks until the server finishes
+  // the request if `wait` timed out.
+  void release(int slot);
+
+private:
+  ShmRing ring;
+  std::atomic<size_t> next_slot{0};  // where `acquire` starts searching
+};
+
+} // namespace prnet
+
+#endif // PRNET_INFER_SHM_RING_H_
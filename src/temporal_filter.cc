@@ -0,0 +1,141 @@
+#include "temporal_filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace prnet {
+
+namespace {
+
+const float kPi = 3.14159265358979323846f;
+
+// Smoothing factor of the exponential filter with `cutoff` Hz.
+inline float Alpha(float cutoff, float dt) {
+  const float tau = 1.0f / (2.0f * kPi * cutoff);
+  return 1.0f / (1.0f + tau / dt);
+}
+
+// Center and size of the bounding box of a position map, from a sparse grid
+// of its positions(enough to match faces between frames).
+void PositionMapExtent(const Image<float> &pos_img, float center[2],
+                       float *size) {
+  const size_t kStride = 16;
+  const size_t width = pos_img.getWidth();
+  const size_t height = pos_img.getHeight();
+  const size_t channels = pos_img.getChannels();
+  float bmin[2] = {std::numeric_limits<float>::max(),
+                   std::numeric_limits<float>::max()};
+  float bmax[2] = {-std::numeric_limits<float>::max(),
+                   -std::numeric_limits<float>::max()};
+  for (size_t y = kStride / 2; y < height; y += kStride) {
+    for (size_t x = kStride / 2; x < width; x += kStride) {
+      const float *p = &pos_img.getData()[(y * width + x) * channels];
+      for (size_t c = 0; c < 2; c++) {
+        bmin[c] = std::min(bmin[c], p[c]);
+        bmax[c] = std::max(bmax[c], p[c]);
+      }
+    }
+  }
+  if ((bmin[0] > bmax[0]) || (bmin[1] > bmax[1])) {
+    center[0] = center[1] = 0.0f;
+    *size = 0.0f;
+    return;
+  }
+  center[0] = 0.5f * (bmin[0] + bmax[0]);
+  center[1] = 0.5f * (bmin[1] + bmax[1]);
+  *size = std::max(bmax[0] - bmin[0], bmax[1] - bmin[1]);
+}
+
+} // anonymous namespace
+
+void PositionMapFilter::apply(Image<float> *pos_img, float dt) {
+  const size_t n = pos_img->getWidth() * pos_img->getHeight() *
+                   pos_img->getChannels();
+  float *x = pos_img->getData();
+
+  if ((prev.size() != n) || !(dt > 0.0f)) {
+    prev.assign(x, x + n);
+    prev_speed.assign(n, 0.0f);
+    return;
+  }
+
+  // alpha(cutoff) = 1 / (1 + 1 / (2 pi cutoff dt))
+  //              = cutoff / (cutoff + k),  k = 1 / (2 pi dt)
+  // No branch nor transcendental function in the loop, so it is vectorized.
+  const float k = 1.0f / (2.0f * kPi * dt);
+  const float inv_dt = 1.0f / dt;
+  const float alpha_d = Alpha(d_cutoff, dt);
+  const float min_cutoff_ = min_cutoff;
+  const float beta_ = beta;
+  float *p = prev.data();
+  float *s = prev_speed.data();
+  for (size_t i = 0; i < n; i++) {
+    const float speed = s[i] + alpha_d * ((x[i] - p[i]) * inv_dt - s[i]);
+    const float cutoff = min_cutoff_ + beta_ * std::fabs(speed);
+    const float alpha = cutoff / (cutoff + k);
+    const float y = p[i] + alpha * (x[i] - p[i]);
+    s[i] = speed;
+    p[i] = y;
+    x[i] = y;
+  }
+}
+
+void FaceFilterBank::apply(std::vector<Image<float>> *pos_imgs, float dt) {
+  const size_t n_faces = pos_imgs->size();
+  std::vector<Track> current(n_faces);
+  for (size_t i = 0; i < n_faces; i++) {
+    PositionMapExtent((*pos_imgs)[i], current[i].center, &current[i].size);
+  }
+
+  // Greedily match the closest pairs of faces of the previous and the
+  // current frame.
+  struct Pair {
+    float distance;  // relative to the face size
+    size_t prev, cur;
+  };
+  std::vector<Pair> pairs;
+  for (size_t j = 0; j < tracks.size(); j++) {
+    for (size_t i = 0; i < n_faces; i++) {
+      const float size = std::max(tracks[j].size, current[i].size);
+      if (!(size > 0.0f)) {
+        continue;
+      }
+      const float dx = current[i].center[0] - tracks[j].center[0];
+      const float dy = current[i].center[1] - tracks[j].center[1];
+      const float distance = std::sqrt(dx * dx + dy * dy) / size;
+      if (distance <= max_center_jump) {
+        Pair pair;
+        pair.distance = distance;
+        pair.prev = j;
+        pair.cur = i;
+        pairs.push_back(pair);
+      }
+    }
+  }
+  std::stable_sort(pairs.begin(), pairs.end(),
+                   [](const Pair &a, const Pair &b) {
+                     return a.distance < b.distance;
+                   });
+
+  std::vector<bool> prev_matched(tracks.size(), false);
+  std::vector<bool> cur_matched(n_faces, false);
+  for (const Pair &pair : pairs) {
+    if (prev_matched[pair.prev] || cur_matched[pair.cur]) {
+      continue;
+    }
+    prev_matched[pair.prev] = true;
+    cur_matched[pair.cur] = true;
+    current[pair.cur].filter = std::move(tracks[pair.prev].filter);
+  }
+
+  for (size_t i = 0; i < n_faces; i++) {
+    if (!cur_matched[i]) {
+      current[i].filter = PositionMapFilter(min_cutoff, beta);
+    }
+    current[i].filter.apply(&(*pos_imgs)[i], dt);
+  }
+  tracks.swap(current);
+}
+
+} // namespace prnet
@@ -0,0 +1,84 @@
+#ifndef PRNET_INFER_TEMPORAL_FILTER_H_
+#define PRNET_INFER_TEMPORAL_FILTER_H_
+
+#include <vector>
+
+#include "image.h"
+
+namespace prnet {
+
+///
+/// One Euro filter applied to every element of a position map.
+/// G. Casiez et al., "1 Euro Filter: A Simple Speed-based Low-pass Filter for
+/// Noisy Input in Interactive Systems", CHI 2012.
+///
+/// Slow motion is smoothed strongly(cutoff `min_cutoff`) to remove jitter, and
+/// the cutoff is raised with speed(by `beta`) to keep the lag small for fast
+/// motion. State is two values per element(previous value and speed).
+///
+class PositionMapFilter {
+public:
+  // `min_cutoff` and `d_cutoff` are in Hz. `beta` is in 1 / (units of the
+  // position map), i.e. 1 / pixel for remapped position maps.
+  explicit PositionMapFilter(float _min_cutoff = 1.0f, float _beta = 0.05f,
+                             float _d_cutoff = 1.0f)
+      : min_cutoff(_min_cutoff), beta(_beta), d_cutoff(_d_cutoff) {}
+
+  // Forgets the previous frame(e.g. for a new face or a scene cut).
+  void reset() {
+    prev.clear();
+    prev_speed.clear();
+  }
+
+  // Filters `pos_img` in place. `dt` is the time from the previous frame in
+  // seconds. The first frame after `reset` is passed through.
+  void apply(Image<float> *pos_img, float dt);
+
+private:
+  float min_cutoff;
+  float beta;
+  float d_cutoff;
+
+  std::vector<float> prev;
+  std::vector<float> prev_speed;
+};
+
+///
+/// `PositionMapFilter`s of the faces of an image sequence.
+///
+/// The detection order of faces may change between frames, so each face is
+/// matched to the closest face of the previous frame(distance of the centers
+/// relative to the face size). A face without a match within
+/// `max_center_jump` x the face size(a new face, or one which jumped, e.g. at a
+/// scene cut) starts a new filter, and filters of faces which disappeared are
+/// dropped.
+///
+class FaceFilterBank {
+public:
+  explicit FaceFilterBank(float _min_cutoff = 1.0f, float _beta = 0.05f,
+                          float _max_center_jump = 0.5f)
+      : min_cutoff(_min_cutoff), beta(_beta),
+        max_center_jump(_max_center_jump) {}
+
+  void reset() { tracks.clear(); }
+
+  // Filters the position maps(in pixel coordinate of the input image) of all
+  // faces of a frame in place.
+  void apply(std::vector<Image<float>> *pos_imgs, float dt);
+
+private:
+  struct Track {
+    PositionMapFilter filter;
+    float center[2];
+    float size;
+  };
+
+  float min_cutoff;
+  float beta;
+  float max_center_jump;
+  std::vector<Track> tracks;  // of the faces of the previous frame
+};
+
+} // namespace prnet
+
+#endif // PRNET_INFER_TEMPORAL_FILTER_H_
@@ -146,28 +146,39 @@ public:
     return true;
   }
 
-  bool predict(const Image<float>& inp_img, Image<float>& out_img) {
+  void allocate_input(size_t batch_size, size_t width, size_t height,
+                      size_t channels) {
+    inp_batch = batch_size;
+    inp_width = width;
+    inp_height = height;
+    inp_channels = channels;
+    input_buffer.resize(batch_size * height * width * channels);
+  }
+
+  float* input_data(size_t batch_idx) {
+    return input_buffer.data() + batch_idx * inp_height * inp_width * inp_channels;
+  }
+
+  bool run(std::vector<Image<float>>& out_imgs) {
+
+    if (inp_batch == 0) {
+      out_imgs.clear();
+      return true;
+    }
 
     std::vector<TF_Output> inputs;
     std::vector<TF_Tensor*> input_values;
 
-    // Setup input tensor.
-
-    size_t inp_width = inp_img.getWidth();
-    size_t inp_height = inp_img.getHeight();
-    size_t inp_channels = inp_img.getChannels();
+    // Setup input tensor. `input_buffer` is passed to TensorFlow without copy.
 
-    std::cout << "input height x width x channels = " << inp_height << " x " << inp_width << " x " << inp_channels << std::endl;
+    std::cout << "input batch x height x width x channels = " << inp_batch << " x " << inp_height << " x " << inp_width << " x " << inp_channels << std::endl;
 
-    int64_t input_dims[4] = {1, int64_t(inp_height), int64_t(inp_width), int64_t(inp_channels)};
-    size_t input_len = 1 * inp_height * inp_width * inp_channels * sizeof(float);
+    int64_t input_dims[4] = {int64_t(inp_batch), int64_t(inp_height), int64_t(inp_width), int64_t(inp_channels)};
+    size_t image_len = inp_height * inp_width * inp_channels;
+    size_t input_len = inp_batch * image_len * sizeof(float);
 
-    std::vector<float> input_buffer;
-    input_buffer.resize(input_len / sizeof(float));
-    memcpy(input_buffer.data(), inp_img.getData(), input_len);
-    
     // Must provide deallocator otherwise null pointer exception will happen when deleting tensor.
-    TF_Tensor *input_tensor = TF_NewTensor(TF_FLOAT, input_dims, 4, reinterpret_cast<void *>(const_cast<float *>(input_buffer.data())), input_len, nonfree_dealloc_tensor, /* dealloc_arg */nullptr);
+    TF_Tensor *input_tensor = TF_NewTensor(TF_FLOAT, input_dims, 4, reinterpret_cast<void *>(input_buffer.data()), input_len, nonfree_dealloc_tensor, /* dealloc_arg */nullptr);
     input_values.push_back(input_tensor);
     
     TF_Operation* input_op = TF_GraphOperationByName(graph, input_layer.c_str());
@@ -197,19 +208,22 @@ public:
       /* run_metadata */ nullptr,
       /* status */ status);
 
+    TF_DeleteTensor(input_tensor);
+
     if (TF_GetCode(status) != TF_OK) {
       std::cerr << "Failed to run session : " << TF_Message(status) << std::endl;
+      return false;
     }
 
-    float *output_ptr = static_cast<float *>(TF_TensorData(output_values[0]));
+    const float *output_ptr = static_cast<float *>(TF_TensorData(output_values[0]));
 
-    // Copy to output image
-    out_img.create(inp_width, inp_height, inp_channels);
-    out_img.foreach([&](int x, int y, int c, float& v) {
-      v = output_ptr[inp_channels * (y * inp_width + x) + c];
-    });
+    // Copy to output images
+    out_imgs.resize(inp_batch);
+    for (size_t b = 0; b < inp_batch; b++) {
+      out_imgs[b].create(inp_width, inp_height, inp_channels);
+      memcpy(out_imgs[b].getData(), output_ptr + b * image_len, image_len * sizeof(float));
+    }
 
-    TF_DeleteTensor(input_tensor);
     // TF_SessionRun will allocate TF_Tensor through TF_Run_Helper() called within TF_SessionRun().
     // So delete output tensor here.
     TF_DeleteTensor(output_values[0]); 
@@ -224,6 +238,10 @@ private:
   TF_Graph *graph = nullptr;
   TF_Tensor *input_tensor = nullptr;
   std::string input_layer, output_layer;
+
+  // Input tensor data. [batch][height][width][channels]
+  std::vector<float> input_buffer;
+  size_t inp_batch = 0, inp_width = 0, inp_height = 0, inp_channels = 0;
 };
 
 // PImpl pattern
@@ -242,7 +260,28 @@ bool TensorflowPredictor::load(const std::string& graph_filename,
 }
 bool TensorflowPredictor::predict(const Image<float>& inp_img,
                                   Image<float>& out_img) {
-  return impl->predict(inp_img, out_img);
+  impl->allocate_input(1, inp_img.getWidth(), inp_img.getHeight(),
+                       inp_img.getChannels());
+  memcpy(impl->input_data(0), inp_img.getData(),
+         inp_img.getWidth() * inp_img.getHeight() * inp_img.getChannels() *
+             sizeof(float));
+
+  std::vector<Image<float>> out_imgs;
+  if (!impl->run(out_imgs)) {
+    return false;
+  }
+  out_img = std::move(out_imgs[0]);
+  return true;
+}
+void TensorflowPredictor::allocate_input(size_t batch_size, size_t width,
+                                         size_t height, size_t channels) {
+  impl->allocate_input(batch_size, width, height, channels);
+}
+float* TensorflowPredictor::input_data(size_t batch_idx) {
+  return impl->input_data(batch_idx);
+}
+bool TensorflowPredictor::run(std::vector<Image<float>>& out_imgs) {
+  return impl->run(out_imgs);
 }
 
 } // namespace prnet
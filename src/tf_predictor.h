@@ -2,6 +2,7 @@
 #define TF_PREDICTOR_180602
 
 #include <string>
+#include <vector>
 
 #include "image.h"
 
@@ -16,6 +17,15 @@ public:
             const std::string& out_layer);
   bool predict(const Image<float>& inp_img, Image<float>& out_img);
 
+  // Allocates the input tensor(`batch_size` x `height` x `width` x
+  // `channels`) so that callers can write input pixels directly into it.
+  void allocate_input(size_t batch_size, size_t width, size_t height,
+                      size_t channels);
+  // Returns the slot of `batch_idx`th image in the input tensor.
+  float* input_data(size_t batch_idx);
+  // Runs the network with the input tensor filled through `input_data`.
+  bool run(std::vector<Image<float>>& out_imgs);
+
 private:
   class Impl;
   std::unique_ptr<Impl> impl;
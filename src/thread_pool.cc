@@ -0,0 +1,113 @@
+#include "thread_pool.h"
+
+#include <atomic>
+#include <memory>
+
+namespace prnet {
+
+namespace {
+
+// Shared between `parallel_for` and its helper tasks. Helper tasks may start
+// after `parallel_for` returned, so it is reference counted.
+struct ParallelForState {
+  std::atomic<size_t> next{0};
+  size_t done = 0;  // guarded by `mutex`
+  size_t n = 0;
+  const std::function<void(size_t)> *func = nullptr;
+  std::mutex mutex;
+  std::condition_variable cond;
+
+  // Runs indices until all of them are claimed.
+  void run() {
+    size_t i = 0;
+    while ((i = next++) < n) {
+      (*func)(i);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (++done == n) {
+        cond.notify_all();
+      }
+    }
+  }
+};
+
+} // anonymous namespace
+
+ThreadPool::ThreadPool(uint32_t n_threads) {
+  for (uint32_t t = 0; t < std::max(1U, n_threads); t++) {
+    workers.emplace_back(std::thread([this]() { worker_loop(); }));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quit = true;
+  }
+  cond.notify_all();
+  for (auto &t : workers) {
+    t.join();
+  }
+}
+
+void ThreadPool::enqueue(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.push_back(std::move(task));
+  }
+  cond.notify_one();
+}
+
+void ThreadPool::parallel_for(size_t n,
+                              const std::function<void(size_t)> &func) {
+  if (n == 0) {
+    return;
+  }
+  if (n == 1) {
+    func(0);
+    return;
+  }
+
+  std::shared_ptr<ParallelForState> state(new ParallelForState());
+  state->n = n;
+  state->func = &func;
+
+  const size_t n_helpers = std::min(n - 1, workers.size());
+  for (size_t t = 0; t < n_helpers; t++) {
+    enqueue([state]() { state->run(); });
+  }
+
+  state->run();
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->cond.wait(lock, [&state]() { return state->done == state->n; });
+}
+
+void ThreadPool::worker_loop() {
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cond.wait(lock, [this]() { return quit || !tasks.empty(); });
+      if (quit && tasks.empty()) {
+        return;
+      }
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+    task();
+  }
+}
+
+ThreadPool &GetSharedThreadPool() {
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wexit-time-destructors"
+#endif
+  static ThreadPool pool;
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+  return pool;
+}
+
+} // namespace prnet
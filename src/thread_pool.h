@@ -0,0 +1,53 @@
+#ifndef PRNET_INFER_THREAD_POOL_H_
+#define PRNET_INFER_THREAD_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "image.h"  // DEFAULT_HW_CONCURRENCY
+
+namespace prnet {
+
+///
+/// Simple fixed size thread pool.
+///
+class ThreadPool {
+public:
+  explicit ThreadPool(uint32_t n_threads = DEFAULT_HW_CONCURRENCY);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t size() const { return workers.size(); }
+
+  // Queues a task. Tasks are run in FIFO order.
+  void enqueue(std::function<void()> task);
+
+  // Runs `func(i)` for i in [0, n) and waits for all of them.
+  // The calling thread also runs `func`, so it is safe to call from a task of
+  // this pool.
+  void parallel_for(size_t n, const std::function<void(size_t)> &func);
+
+private:
+  void worker_loop();
+
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable cond;
+  bool quit = false;
+};
+
+///
+/// Thread pool shared within the process.
+///
+ThreadPool &GetSharedThreadPool();
+
+} // namespace prnet
+
+#endif // PRNET_INFER_THREAD_POOL_H_
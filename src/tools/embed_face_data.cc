@@ -0,0 +1,137 @@
+//
+// Converts PRNet face data(`Data/uv-data`) to C++ source so that it can be
+// embedded into the executable(`WITH_EMBEDDED_FACE_DATA` CMake option).
+//
+// Usage: prnet-embed-face-data <uv-data dir> <output dir>
+//
+// Writes `face_data_embedded.h` and `face_data_embedded.cc` to the output dir.
+//
+
+#include "face-data.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace {
+
+// Shortest decimal representation which round trips to `v`, as a C++ float
+// literal.
+bool FormatFloat(float v, char *buf, size_t len) {
+  if (!(v == v) || (v > 3.4e38f) || (v < -3.4e38f)) {
+    return false;
+  }
+  for (int precision = 1; precision <= 9; precision++) {
+    snprintf(buf, len, "%.*g", precision, double(v));
+    if (std::strtof(buf, nullptr) == v) {
+      break;
+    }
+  }
+  if (!std::strpbrk(buf, ".e")) {
+    strncat(buf, ".0", len - strlen(buf) - 1);
+  }
+  strncat(buf, "f", len - strlen(buf) - 1);
+  return true;
+}
+
+void WriteIndices(std::ofstream &ofs, const char *name,
+                  const prnet::FaceDataArray<uint32_t> &values) {
+  ofs << "const uint32_t " << name << "[" << values.size() << "] = {\n";
+  for (size_t i = 0; i < values.size(); i++) {
+    ofs << ((i % 12) == 0 ? "  " : " ") << values[i] << ",";
+    if (((i % 12) == 11) || (i + 1 == values.size())) {
+      ofs << "\n";
+    }
+  }
+  ofs << "};\n\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " <uv-data dir> <output dir>"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const std::string data_dir = argv[1];
+  const std::string out_dir = argv[2];
+
+  prnet::FaceData face_data;
+  if (!prnet::LoadFaceData(data_dir, &face_data,
+                           out_dir + "/face_data_embedded.bin")) {
+    std::cerr << "Failed to load face data from " << data_dir << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  {
+    const std::string filename = out_dir + "/face_data_embedded.h";
+    std::ofstream ofs(filename);
+    if (!ofs) {
+      std::cerr << "Failed to open " << filename << std::endl;
+      return EXIT_FAILURE;
+    }
+    ofs << "// Generated by prnet-embed-face-data. Do not edit.\n"
+        << "#ifndef PRNET_INFER_FACE_DATA_EMBEDDED_H_\n"
+        << "#define PRNET_INFER_FACE_DATA_EMBEDDED_H_\n\n"
+        << "#include <array>\n#include <cstddef>\n#include <cstdint>\n\n"
+        << "namespace prnet {\nnamespace embedded_face_data {\n\n"
+        << "constexpr size_t kNumUVKptIndices = "
+        << face_data.uv_kpt_indices.size() << ";\n"
+        << "constexpr size_t kNumVertices = " << face_data.face_indices.size()
+        << ";\n"
+        << "constexpr size_t kNumTriangles = "
+        << face_data.triangles.size() / 3 << ";\n\n"
+        << "extern const uint32_t kUVKptIndices[kNumUVKptIndices];\n"
+        << "extern const uint32_t kFaceIndices[kNumVertices];\n"
+        << "extern const uint32_t kTriangles[3 * kNumTriangles];\n"
+        << "extern const std::array<float, 3> kCanonicalVertices[kNumVertices];\n\n"
+        << "} // namespace embedded_face_data\n} // namespace prnet\n\n"
+        << "#endif // PRNET_INFER_FACE_DATA_EMBEDDED_H_\n";
+    if (!ofs) {
+      std::cerr << "Failed to write " << filename << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  {
+    const std::string filename = out_dir + "/face_data_embedded.cc";
+    std::ofstream ofs(filename);
+    if (!ofs) {
+      std::cerr << "Failed to open " << filename << std::endl;
+      return EXIT_FAILURE;
+    }
+    ofs << "// Generated by prnet-embed-face-data. Do not edit.\n"
+        << "#include \"face_data_embedded.h\"\n\n"
+        << "namespace prnet {\nnamespace embedded_face_data {\n\n";
+    WriteIndices(ofs, "kUVKptIndices", face_data.uv_kpt_indices);
+    WriteIndices(ofs, "kFaceIndices", face_data.face_indices);
+    WriteIndices(ofs, "kTriangles", face_data.triangles);
+
+    ofs << "const std::array<float, 3> kCanonicalVertices["
+        << face_data.canonical_vertices.size() << "] = {\n";
+    char buf[3][32];
+    for (const std::array<float, 3> &v : face_data.canonical_vertices) {
+      for (size_t k = 0; k < 3; k++) {
+        if (!FormatFloat(v[k], buf[k], sizeof(buf[k]))) {
+          std::cerr << "Invalid canonical vertex value : " << v[k]
+                    << std::endl;
+          return EXIT_FAILURE;
+        }
+      }
+      ofs << "  {{" << buf[0] << ", " << buf[1] << ", " << buf[2] << "}},\n";
+    }
+    ofs << "};\n\n"
+        << "} // namespace embedded_face_data\n} // namespace prnet\n";
+    if (!ofs) {
+      std::cerr << "Failed to write " << filename << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -423,7 +423,7 @@ static int CreateHDRTextureGL(const Image<float> &image, int prev_id = -1) {
 }
 
 bool RunUI(const Mesh &mesh, const Mesh &front_mesh,
-           const Image<float> &input_image,
+           const Image<float> &texture_image,
            const std::vector<Image<float>> &debug_images) {
   // Setup window
   glfwSetErrorCallback(error_callback);
@@ -476,7 +476,7 @@ bool RunUI(const Mesh &mesh, const Mesh &front_mesh,
 
   // Setup renderer.
   gRenderer.SetMesh(mesh);
-  gRenderer.SetImage(input_image);
+  gRenderer.SetImage(texture_image);
   gRenderer.BuildBVH();
 
   // Launch render thread
@@ -494,9 +494,7 @@ bool RunUI(const Mesh &mesh, const Mesh &front_mesh,
 
   // Main loop
   double mouse_x = 0, mouse_y = 0;
-#ifdef USE_DLIB
   bool use_front_mesh = false;
-#endif
   while (!glfwWindowShouldClose(window)) {
     glfwPollEvents();
     ImGui_ImplGlfwGL2_NewFrame();
@@ -571,7 +569,6 @@ bool RunUI(const Mesh &mesh, const Mesh &front_mesh,
         RequestRender();
       }
 
-#ifdef USE_DLIB
       if (ImGui::Checkbox("frontalized mesh", &use_front_mesh)) {
         // Switch mesh
         if (use_front_mesh) {
@@ -583,9 +580,6 @@ bool RunUI(const Mesh &mesh, const Mesh &front_mesh,
         }
         RequestRender();
       }
-#else
-      (void)front_mesh;
-#endif
 
     }
     ImGui::End();
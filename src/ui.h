@@ -7,7 +7,7 @@
 namespace prnet {
 
 bool RunUI(const Mesh &mesh, const Mesh &front_mesh,
-           const Image<float> &input_image,
+           const Image<float> &texture_image,
            const std::vector<Image<float>> &debug_images);
 
 };
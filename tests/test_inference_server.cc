@@ -0,0 +1,302 @@
+#include "inference_server.h"
+#include "test_util.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+using namespace prnet;
+
+const char kSocketPath[] = "test_inference_server.sock";
+
+// Outputs flag which makes the handler close the connection.
+const uint32_t kCloseOutputs = 0x80000000u;
+
+// Echoes the payload reversed. `n_faces` is the # of payload bytes.
+bool EchoHandler(const ServerRequest &request, ServerResponse *response) {
+  const uint32_t size = request.header.payload_size;
+  std::vector<unsigned char> reversed(request.payload, request.payload + size);
+  std::reverse(reversed.begin(), reversed.end());
+  response->header.n_faces = size;
+  response->header.n_landmarks = request.header.type;
+  response->append(reversed.data(), reversed.size());
+  return (request.header.outputs & kCloseOutputs) == 0;
+}
+
+bool FileExists(const std::string &path) {
+  struct stat st;
+  return lstat(path.c_str(), &st) == 0;
+}
+
+int Connect(const std::string &path) {
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path.c_str(), path.size());
+  if (connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) !=
+      0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Writes `size` bytes in chunks of `chunk` bytes, so the server has to
+// reassemble the frames.
+bool WriteChunked(int fd, const void *data, size_t size, size_t chunk) {
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  while (size > 0) {
+    const ssize_t n = write(fd, p, std::min(size, chunk));
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= size_t(n);
+  }
+  return true;
+}
+
+bool ReadAll(int fd, void *data, size_t size) {
+  unsigned char *p = static_cast<unsigned char *>(data);
+  while (size > 0) {
+    const ssize_t n = read(fd, p, size);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= size_t(n);
+  }
+  return true;
+}
+
+bool ReadResponse(int fd, ServerResponseHeader *header,
+                  std::vector<unsigned char> *payload) {
+  if (!ReadAll(fd, header, sizeof(ServerResponseHeader))) {
+    return false;
+  }
+  payload->resize(header->payload_size);
+  return ReadAll(fd, payload->data(), payload->size());
+}
+
+// The connection is closed by the server.
+bool IsClosed(int fd) {
+  char c;
+  return read(fd, &c, 1) == 0;
+}
+
+void TestRequests(size_t chunk) {
+  const int fd = Connect(kSocketPath);
+  PRNET_CHECK(fd >= 0);
+  if (fd < 0) {
+    return;
+  }
+
+  // Several requests on a connection, including an empty payload.
+  for (size_t size : {size_t(1000), size_t(0), size_t(70000), size_t(3)}) {
+    std::vector<unsigned char> payload(size);
+    for (size_t i = 0; i < size; i++) {
+      payload[i] = static_cast<unsigned char>(i * 7 + size);
+    }
+    ServerRequestHeader request;
+    request.type = kServerRequestRawImage;
+    request.payload_size = uint32_t(size);
+    PRNET_CHECK(WriteChunked(fd, &request, sizeof(request), chunk));
+    PRNET_CHECK(WriteChunked(fd, payload.data(), payload.size(), chunk));
+
+    ServerResponseHeader response;
+    std::vector<unsigned char> response_payload;
+    PRNET_CHECK(ReadResponse(fd, &response, &response_payload));
+    PRNET_CHECK_EQ(response.magic, kServerResponseMagic);
+    PRNET_CHECK_EQ(response.version, kServerProtocolVersion);
+    PRNET_CHECK_EQ(response.status, uint32_t(kServerStatusOk));
+    PRNET_CHECK_EQ(response.n_faces, uint32_t(size));
+    PRNET_CHECK_EQ(response.n_landmarks, uint32_t(kServerRequestRawImage));
+    PRNET_CHECK_EQ(response.payload_size, uint32_t(size));
+    std::reverse(payload.begin(), payload.end());
+    PRNET_CHECK(response_payload == payload);
+  }
+
+  // The handler closes the connection after the response.
+  ServerRequestHeader request;
+  request.outputs = kCloseOutputs;
+  PRNET_CHECK(WriteChunked(fd, &request, sizeof(request), chunk));
+  ServerResponseHeader response;
+  std::vector<unsigned char> response_payload;
+  PRNET_CHECK(ReadResponse(fd, &response, &response_payload));
+  PRNET_CHECK_EQ(response.status, uint32_t(kServerStatusOk));
+  PRNET_CHECK(IsClosed(fd));
+  close(fd);
+}
+
+// An invalid header is answered with an error, and the connection is closed
+// since the stream can not be parsed any more.
+void TestBadRequest(const ServerRequestHeader &request) {
+  const int fd = Connect(kSocketPath);
+  PRNET_CHECK(fd >= 0);
+  if (fd < 0) {
+    return;
+  }
+  PRNET_CHECK(WriteChunked(fd, &request, sizeof(request), sizeof(request)));
+  ServerResponseHeader response;
+  std::vector<unsigned char> message;
+  PRNET_CHECK(ReadResponse(fd, &response, &message));
+  PRNET_CHECK_EQ(response.magic, kServerResponseMagic);
+  PRNET_CHECK_EQ(response.status, uint32_t(kServerStatusBadRequest));
+  PRNET_CHECK_EQ(response.n_faces, 0u);
+  PRNET_CHECK(!message.empty());
+  PRNET_CHECK(IsClosed(fd));
+  close(fd);
+}
+
+// Sends an empty request and checks the response.
+bool RoundTrip(int fd) {
+  ServerRequestHeader request;
+  ServerResponseHeader response;
+  std::vector<unsigned char> payload;
+  return WriteChunked(fd, &request, sizeof(request), sizeof(request)) &&
+         ReadResponse(fd, &response, &payload) &&
+         (response.status == kServerStatusOk);
+}
+
+// Connections which were closed do not count toward `max_connections`.
+void TestConnectionLimit(size_t max_connections) {
+  for (int round = 0; round < 3; round++) {
+    std::vector<int> fds;
+    for (size_t i = 0; i < max_connections; i++) {
+      fds.push_back(Connect(kSocketPath));
+      PRNET_CHECK(fds.back() >= 0);
+      PRNET_CHECK(RoundTrip(fds.back()));
+    }
+    for (int fd : fds) {
+      close(fd);
+    }
+    // Let the connection threads see the end of the connections.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+}
+
+void TestServer() {
+  InferenceServerOptions options;
+  options.unix_socket_path = kSocketPath;
+  options.max_payload_size = 1024 * 1024;
+  options.max_connections = 4;
+
+  std::unique_ptr<InferenceServer> server(new InferenceServer());
+  PRNET_CHECK(server->start(options, EchoHandler));
+  std::thread thread([&server]() { server->run(); });
+
+  // Another server does not replace the socket of a running one.
+  {
+    InferenceServer other;
+    PRNET_CHECK(!other.start(options, EchoHandler));
+  }
+  PRNET_CHECK(FileExists(kSocketPath));
+
+  TestRequests(/* chunk */ 1 << 20);
+  TestRequests(/* chunk */ 5);
+  TestConnectionLimit(options.max_connections);
+
+  ServerRequestHeader bad_magic;
+  bad_magic.magic = 0x12345678;
+  TestBadRequest(bad_magic);
+
+  ServerRequestHeader bad_version;
+  bad_version.version = kServerProtocolVersion + 1;
+  TestBadRequest(bad_version);
+
+  ServerRequestHeader too_large;
+  too_large.payload_size = options.max_payload_size + 1;
+  TestBadRequest(too_large);
+
+  server->stop();
+  thread.join();
+  server.reset();
+
+  // The socket file is removed by the server, and a stale one is replaced.
+  PRNET_CHECK(!FileExists(kSocketPath));
+}
+
+void TestStaleSocket() {
+  InferenceServerOptions options;
+  options.unix_socket_path = kSocketPath;
+
+  // A socket file left without a server.
+  {
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, kSocketPath, sizeof(kSocketPath));
+    PRNET_CHECK(bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) ==
+                0);
+    close(fd);
+  }
+  PRNET_CHECK(FileExists(kSocketPath));
+  {
+    InferenceServer server;
+    PRNET_CHECK(server.start(options, EchoHandler));
+  }
+  PRNET_CHECK(!FileExists(kSocketPath));
+
+  // Other files are not overwritten.
+  FILE *fp = fopen(kSocketPath, "w");
+  PRNET_CHECK(fp != nullptr);
+  if (fp) {
+    fclose(fp);
+  }
+  {
+    InferenceServer server;
+    PRNET_CHECK(!server.start(options, EchoHandler));
+  }
+  PRNET_CHECK(FileExists(kSocketPath));
+  unlink(kSocketPath);
+}
+
+// Payload written to an external buffer(e.g. a shared memory slot).
+void TestExternalBuffer() {
+  unsigned char buf[8];
+  ServerResponse response;
+  response.set_external_buffer(buf, sizeof(buf));
+  const uint32_t values[2] = {1, 2};
+  PRNET_CHECK(response.append(values, 1));
+  PRNET_CHECK(response.append(values + 1, 1));
+  PRNET_CHECK(response.payload() == buf);
+  PRNET_CHECK_EQ(response.payload_size(), sizeof(buf));
+  PRNET_CHECK(memcmp(buf, values, sizeof(values)) == 0);
+  PRNET_CHECK(!response.overflowed());
+  PRNET_CHECK(response.buffer.empty());
+
+  PRNET_CHECK(!response.append(values, 1));
+  PRNET_CHECK(response.overflowed());
+  PRNET_CHECK_EQ(response.payload_size(), sizeof(buf));
+
+  // Error messages are truncated to the buffer.
+  response.reset();
+  response.set_error(kServerStatusFailed, "a long error message");
+  PRNET_CHECK_EQ(response.header.status, uint32_t(kServerStatusFailed));
+  PRNET_CHECK_EQ(response.payload_size(), sizeof(buf));
+  PRNET_CHECK(memcmp(buf, "a long e", sizeof(buf)) == 0);
+}
+
+} // anonymous namespace
+
+int main() {
+  unlink(kSocketPath);
+  TestServer();
+  TestStaleSocket();
+  TestExternalBuffer();
+  return prnet::test::Result("test_inference_server");
+}
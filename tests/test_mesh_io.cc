@@ -0,0 +1,130 @@
+#include "mesh_io.h"
+#include "test_util.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+
+namespace {
+
+using prnet::FormatFloat;
+using prnet::kMaxFloatChars;
+
+std::string Format(float v) {
+  char buf[kMaxFloatChars + 1];
+  const size_t n = FormatFloat(v, buf);
+  PRNET_CHECK_EQ(n, strlen(buf));
+  return buf;
+}
+
+// # of significant digits of a formatted value("-1.250e+03" -> 3).
+int SignificantDigits(const std::string &s) {
+  std::string digits;
+  for (char c : s) {
+    if ((c == 'e') || (c == 'E')) {
+      break;
+    }
+    if ((c >= '0') && (c <= '9')) {
+      digits.push_back(c);
+    }
+  }
+  const size_t first = digits.find_first_not_of('0');
+  if (first == std::string::npos) {
+    return 0;
+  }
+  const size_t last = digits.find_last_not_of('0');
+  return int(last - first + 1);
+}
+
+// Shortest precision of printf("%.*g") which round trips.
+int ShortestPrintfPrecision(float v) {
+  char buf[64];
+  for (int precision = 1; precision < 9; precision++) {
+    snprintf(buf, sizeof(buf), "%.*g", precision, double(v));
+    if (std::strtof(buf, nullptr) == v) {
+      return precision;
+    }
+  }
+  return 9;
+}
+
+void CheckRoundTrip(float v) {
+  const std::string s = Format(v);
+  PRNET_CHECK(s.size() <= kMaxFloatChars);
+
+  const float parsed = std::strtof(s.c_str(), nullptr);
+  uint32_t bits, parsed_bits;
+  memcpy(&bits, &v, sizeof(float));
+  memcpy(&parsed_bits, &parsed, sizeof(float));
+  if (bits != parsed_bits) {
+    std::cerr << "Round trip failed : " << s << " (bits " << std::hex << bits
+              << std::dec << ")" << std::endl;
+    prnet::test::NumFailures()++;
+    return;
+  }
+
+  // Not longer than the shortest printf representation.
+  if (SignificantDigits(s) > ShortestPrintfPrecision(v)) {
+    std::cerr << "Not shortest : " << s << std::endl;
+    prnet::test::NumFailures()++;
+  }
+}
+
+void TestSpecialValues() {
+  PRNET_CHECK_EQ(Format(0.0f), "0");
+  PRNET_CHECK_EQ(Format(-0.0f), "-0");
+  PRNET_CHECK_EQ(Format(std::numeric_limits<float>::infinity()), "inf");
+  PRNET_CHECK_EQ(Format(-std::numeric_limits<float>::infinity()), "-inf");
+  PRNET_CHECK_EQ(Format(std::numeric_limits<float>::quiet_NaN()), "nan");
+}
+
+void TestKnownValues() {
+  const float values[] = {
+      1.0f, -1.0f, 0.1f, 0.5f, 1.5f, 100.0f, 123.456f, -0.001f, 3.14159265f,
+      1e10f, 1e-10f, 16777216.0f, 0.3f, 2.0f / 3.0f,
+      std::numeric_limits<float>::max(),
+      std::numeric_limits<float>::min(),           // smallest normal
+      std::numeric_limits<float>::denorm_min(),
+      std::numeric_limits<float>::epsilon()};
+  for (float v : values) {
+    CheckRoundTrip(v);
+  }
+
+  PRNET_CHECK_EQ(std::strtof(Format(0.1f).c_str(), nullptr), 0.1f);
+  PRNET_CHECK_EQ(SignificantDigits(Format(0.1f)), 1);
+  PRNET_CHECK_EQ(SignificantDigits(Format(123.456f)), 6);
+}
+
+// Typical vertex positions(pixel coordinates) and random bit patterns.
+void TestRandomValues() {
+  std::mt19937 rng(12345);
+
+  std::uniform_real_distribution<float> position(-1024.0f, 1024.0f);
+  for (int i = 0; i < 200000; i++) {
+    CheckRoundTrip(position(rng));
+  }
+
+  std::uniform_int_distribution<uint32_t> bits_dist;
+  for (int i = 0; i < 200000; i++) {
+    const uint32_t bits = bits_dist(rng);
+    float v;
+    memcpy(&v, &bits, sizeof(float));
+    if (std::isnan(v) || std::isinf(v)) {
+      continue;
+    }
+    CheckRoundTrip(v);
+  }
+}
+
+} // anonymous namespace
+
+int main() {
+  TestSpecialValues();
+  TestKnownValues();
+  TestRandomValues();
+  return prnet::test::Result("test_mesh_io");
+}
@@ -0,0 +1,198 @@
+#include "mesh_sequence.h"
+#include "test_util.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using namespace prnet;
+
+const char kFilename[] = "test_mesh_sequence.prnseq";
+const size_t kNumVertices = 500;
+const float kExtent = 100.0f;  // of vertex positions
+
+MeshTopology MakeTopology() {
+  MeshTopology topology;
+  for (uint32_t i = 0; i + 2 < kNumVertices; i++) {
+    topology.faces.push_back(i);
+    topology.faces.push_back(i + 1);
+    topology.faces.push_back(i + 2);
+  }
+  for (size_t i = 0; i < kNumVertices; i++) {
+    topology.uvs.push_back(float(i) / kNumVertices);
+    topology.uvs.push_back(1.0f - float(i) / kNumVertices);
+  }
+  return topology;
+}
+
+// A random shape which moves slowly, and jumps at frame 50 so that a keyframe
+// is inserted before the keyframe interval.
+std::vector<Mesh> MakeFrames(size_t n_frames) {
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> position(0.0f, kExtent);
+  std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+
+  std::vector<float> shape(3 * kNumVertices);
+  for (float &x : shape) {
+    x = position(rng);
+  }
+
+  std::vector<Mesh> frames(n_frames);
+  for (size_t f = 0; f < n_frames; f++) {
+    const float shift = (f < 50) ? 0.2f * f : 300.0f + 0.2f * f;
+    frames[f].vertices.resize(3 * kNumVertices);
+    for (size_t i = 0; i < 3 * kNumVertices; i++) {
+      frames[f].vertices[i] = shape[i] + shift + noise(rng);
+    }
+  }
+  return frames;
+}
+
+void CheckTopology(const MeshSequenceReader &reader,
+                   const MeshTopology &topology) {
+  PRNET_CHECK(reader.get_topology() != nullptr);
+  if (reader.get_topology()) {
+    PRNET_CHECK(reader.get_topology()->faces == topology.faces);
+    PRNET_CHECK(reader.get_topology()->uvs == topology.uvs);
+  }
+}
+
+// Writes `frames` with frame numbers 3 * i(frames without the face are
+// skipped in the image sequence), and reads them back.
+void TestRoundTrip(const MeshSequenceOptions &options, float tolerance) {
+  const MeshTopology topology = MakeTopology();
+  const std::vector<Mesh> frames = MakeFrames(70);
+
+  MeshSequenceWriter writer;
+  PRNET_CHECK(writer.open(kFilename, topology, kNumVertices, options));
+  for (size_t f = 0; f < frames.size(); f++) {
+    PRNET_CHECK(writer.append(frames[f], uint32_t(3 * f)));
+  }
+  PRNET_CHECK_EQ(writer.num_frames(), frames.size());
+  PRNET_CHECK(writer.close());
+
+  MeshSequenceReader reader;
+  PRNET_CHECK(reader.open(kFilename));
+  PRNET_CHECK_EQ(reader.num_frames(), frames.size());
+  PRNET_CHECK_EQ(reader.num_vertices(), kNumVertices);
+  CheckTopology(reader, topology);
+  if (reader.num_frames() != frames.size()) {
+    return;
+  }
+
+  std::vector<Mesh> decoded(frames.size());
+  for (size_t f = 0; f < frames.size(); f++) {
+    PRNET_CHECK_EQ(reader.frame_number(f), uint32_t(3 * f));
+    PRNET_CHECK(reader.read(f, &decoded[f]));
+    PRNET_CHECK_EQ(decoded[f].num_vertices(), kNumVertices);
+    if (decoded[f].num_vertices() != kNumVertices) {
+      return;
+    }
+    float max_error = 0.0f;
+    for (size_t i = 0; i < 3 * kNumVertices; i++) {
+      max_error = std::max(
+          max_error, std::fabs(decoded[f].vertices[i] - frames[f].vertices[i]));
+    }
+    if (max_error > tolerance) {
+      std::cerr << "Frame " << f << " : error " << max_error << " > "
+                << tolerance << std::endl;
+      prnet::test::NumFailures()++;
+    }
+  }
+
+  // Random access decodes the same vertices as sequential reads.
+  for (size_t f : {size_t(69), size_t(12), size_t(49), size_t(50),
+                   size_t(0), size_t(31)}) {
+    Mesh mesh;
+    PRNET_CHECK(reader.read(f, &mesh));
+    PRNET_CHECK(mesh.vertices == decoded[f].vertices);
+  }
+}
+
+// Frames are scanned(with their frame numbers) when the index is missing,
+// e.g. the writer was killed.
+void TestMissingIndex() {
+  const MeshTopology topology = MakeTopology();
+  const std::vector<Mesh> frames = MakeFrames(10);
+
+  MeshSequenceWriter writer;
+  PRNET_CHECK(writer.open(kFilename, topology, kNumVertices));
+  for (size_t f = 0; f < frames.size(); f++) {
+    PRNET_CHECK(writer.append(frames[f], uint32_t(100 + f)));
+  }
+  PRNET_CHECK(writer.close());
+
+  std::vector<char> data;
+  {
+    std::ifstream ifs(kFilename, std::ios::binary);
+    data.assign(std::istreambuf_iterator<char>(ifs),
+                std::istreambuf_iterator<char>());
+  }
+  // Index entries(20 bytes each) and the trailer(24 bytes).
+  const size_t index_size = 20 * frames.size() + 24;
+  PRNET_CHECK(data.size() > index_size);
+  {
+    std::ofstream ofs(kFilename, std::ios::binary | std::ios::trunc);
+    ofs.write(data.data(), std::streamsize(data.size() - index_size));
+  }
+
+  MeshSequenceReader reader;
+  PRNET_CHECK(reader.open(kFilename));
+  PRNET_CHECK_EQ(reader.num_frames(), frames.size());
+  CheckTopology(reader, topology);
+  for (size_t f = 0; f < reader.num_frames(); f++) {
+    PRNET_CHECK_EQ(reader.frame_number(f), uint32_t(100 + f));
+    Mesh mesh;
+    PRNET_CHECK(reader.read(f, &mesh));
+    PRNET_CHECK_EQ(mesh.num_vertices(), kNumVertices);
+  }
+}
+
+void TestInvalidInput() {
+  MeshSequenceWriter writer;
+  MeshSequenceOptions options;
+  options.quantization_bits = 17;
+  PRNET_CHECK(!writer.open(kFilename, MakeTopology(), kNumVertices, options));
+
+  PRNET_CHECK(writer.open(kFilename, MakeTopology(), kNumVertices));
+  Mesh mesh;
+  mesh.vertices.resize(3 * (kNumVertices - 1));
+  PRNET_CHECK(!writer.append(mesh, 0));
+  PRNET_CHECK(writer.close());
+
+  MeshSequenceReader reader;
+  PRNET_CHECK(!reader.open("test_mesh_sequence_missing.prnseq"));
+}
+
+} // anonymous namespace
+
+int main() {
+  // Quantized: errors are within half a quantization step. The box of a
+  // keyframe is (1 + 2 * 0.25) x the extent of its vertices, and the extent
+  // is at most kExtent + 1(noise).
+  MeshSequenceOptions quantized;
+  const float step = (kExtent + 1.0f) * 1.5f / float((1 << 16) - 1);
+  TestRoundTrip(quantized, 0.5f * step * 1.01f);
+
+  MeshSequenceOptions coarse;
+  coarse.quantization_bits = 8;
+  coarse.keyframe_interval = 7;
+  TestRoundTrip(coarse, 0.5f * (kExtent + 1.0f) * 1.5f / 255.0f * 1.01f);
+
+  // Float positions are exact.
+  MeshSequenceOptions raw;
+  raw.quantize = false;
+  TestRoundTrip(raw, 0.0f);
+
+  TestMissingIndex();
+  TestInvalidInput();
+
+  std::remove(kFilename);
+  return prnet::test::Result("test_mesh_sequence");
+}
@@ -0,0 +1,214 @@
+#include "npy_writer.h"
+#include "test_util.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace {
+
+using prnet::NpyWriter;
+
+const char kFilename[] = "test_npy_writer.npy";
+
+std::vector<char> ReadFile(const std::string &filename) {
+  std::ifstream ifs(filename, std::ios::binary);
+  return std::vector<char>(std::istreambuf_iterator<char>(ifs),
+                           std::istreambuf_iterator<char>());
+}
+
+void WriteFile(const std::string &filename, const std::vector<char> &data) {
+  std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
+  ofs.write(data.data(), std::streamsize(data.size()));
+}
+
+std::string FloatDescr() {
+  const uint32_t one = 1;
+  unsigned char c;
+  memcpy(&c, &one, 1);
+  return (c == 1) ? "<f4" : ">f4";
+}
+
+// Header dict of the file(magic and version 1.0 are checked).
+std::string HeaderDict(const std::vector<char> &data, size_t *data_offset) {
+  PRNET_CHECK(data.size() >= 10);
+  if (data.size() < 10) {
+    return std::string();
+  }
+  PRNET_CHECK(memcmp(data.data(), "\x93NUMPY", 6) == 0);
+  PRNET_CHECK_EQ(int(data[6]), 1);
+  const size_t dict_size = size_t(static_cast<unsigned char>(data[8])) |
+                           (size_t(static_cast<unsigned char>(data[9])) << 8);
+  (*data_offset) = 10 + dict_size;
+  PRNET_CHECK(data.size() >= (*data_offset));
+  return std::string(data.data() + 10,
+                     std::min(dict_size, data.size() - 10));
+}
+
+std::vector<float> Items(size_t begin, size_t count, size_t item_size) {
+  std::vector<float> values(count * item_size);
+  for (size_t i = 0; i < values.size(); i++) {
+    values[i] = float(begin * item_size + i) * 0.25f - 3.0f;
+  }
+  return values;
+}
+
+void TestCreateAndAppend() {
+  const std::vector<size_t> shape = {4, 3};
+  {
+    NpyWriter writer;
+    PRNET_CHECK(writer.open(kFilename, shape));
+    PRNET_CHECK_EQ(writer.item_size(), size_t(12));
+    PRNET_CHECK(writer.append(Items(0, 1, 12).data()));
+    PRNET_CHECK(writer.append(Items(1, 3, 12).data(), 3));
+    PRNET_CHECK_EQ(writer.num_items(), size_t(4));
+    PRNET_CHECK(writer.close());
+  }
+
+  // The file is a valid .npy: a header padded to a 64 byte aligned offset,
+  // followed by the items.
+  std::vector<char> data = ReadFile(kFilename);
+  size_t data_offset = 0;
+  const std::string dict = HeaderDict(data, &data_offset);
+  PRNET_CHECK_EQ(data_offset % 64, size_t(0));
+  PRNET_CHECK(!dict.empty() && (dict.back() == '\n'));
+  PRNET_CHECK(dict.find("'descr': '" + FloatDescr() + "'") !=
+              std::string::npos);
+  PRNET_CHECK(dict.find("'fortran_order': False") != std::string::npos);
+  PRNET_CHECK(dict.find("'shape': (4, 4, 3)") != std::string::npos);
+  PRNET_CHECK_EQ(data.size(), data_offset + 4 * 12 * sizeof(float));
+  const std::vector<float> expected = Items(0, 4, 12);
+  PRNET_CHECK(memcmp(data.data() + data_offset, expected.data(),
+                     expected.size() * sizeof(float)) == 0);
+
+  // Append to the existing file and continue from its last item.
+  {
+    NpyWriter writer;
+    PRNET_CHECK(writer.open(kFilename, shape, /* append */ true));
+    PRNET_CHECK_EQ(writer.num_items(), size_t(4));
+    std::vector<float> last(12);
+    PRNET_CHECK(writer.read(3, last.data()));
+    PRNET_CHECK(last == Items(3, 1, 12));
+    PRNET_CHECK(!writer.read(4, last.data()));
+    PRNET_CHECK(writer.append(Items(4, 2, 12).data(), 2));
+    PRNET_CHECK_EQ(writer.num_items(), size_t(6));
+  }
+  data = ReadFile(kFilename);
+  PRNET_CHECK(HeaderDict(data, &data_offset).find("'shape': (6, 4, 3)") !=
+              std::string::npos);
+  {
+    NpyWriter writer;
+    PRNET_CHECK(writer.open(kFilename, shape, true));
+    std::vector<float> item(12);
+    for (size_t i = 0; i < 6; i++) {
+      PRNET_CHECK(writer.read(i, item.data()));
+      PRNET_CHECK(item == Items(i, 1, 12));
+    }
+  }
+
+  // Item shape mismatch.
+  {
+    NpyWriter writer;
+    PRNET_CHECK(!writer.open(kFilename, {3, 4}, true));
+  }
+
+  // Without `append`, the file is recreated.
+  {
+    NpyWriter writer;
+    PRNET_CHECK(writer.open(kFilename, shape));
+    PRNET_CHECK_EQ(writer.num_items(), size_t(0));
+  }
+}
+
+// Bytes after the last item in the header(e.g. the writer was killed
+// between writing an item and the header) are ignored and overwritten.
+void TestPartialItem() {
+  {
+    NpyWriter writer;
+    PRNET_CHECK(writer.open(kFilename, {2}));
+    PRNET_CHECK(writer.append(Items(0, 2, 2).data(), 2));
+  }
+  std::vector<char> data = ReadFile(kFilename);
+  data.insert(data.end(), 5, '\x7f');
+  WriteFile(kFilename, data);
+
+  NpyWriter writer;
+  PRNET_CHECK(writer.open(kFilename, {2}, true));
+  PRNET_CHECK_EQ(writer.num_items(), size_t(2));
+  PRNET_CHECK(writer.append(Items(2, 1, 2).data()));
+  writer.close();
+
+  size_t data_offset = 0;
+  data = ReadFile(kFilename);
+  PRNET_CHECK(HeaderDict(data, &data_offset).find("'shape': (3, 2)") !=
+              std::string::npos);
+  PRNET_CHECK_EQ(data.size(), data_offset + 3 * 2 * sizeof(float));
+}
+
+// Scalar items have the shape (N,).
+void TestScalarItems() {
+  NpyWriter writer;
+  PRNET_CHECK(writer.open(kFilename, {}));
+  const float values[3] = {1.0f, 2.0f, 3.0f};
+  PRNET_CHECK(writer.append(values, 3));
+  writer.close();
+
+  size_t data_offset = 0;
+  PRNET_CHECK(HeaderDict(ReadFile(kFilename), &data_offset)
+                  .find("'shape': (3,)") != std::string::npos);
+}
+
+// Appends to a file written by numpy(`numpy.save`), whose header is padded
+// differently.
+void TestAppendToNumpyFile() {
+  std::string dict = "{'descr': '" + FloatDescr() +
+                     "', 'fortran_order': False, 'shape': (2, 3), }";
+  dict.resize(128 - 10 - 1, ' ');
+  dict.push_back('\n');
+  std::vector<char> data = {'\x93', 'N', 'U', 'M', 'P', 'Y', 1, 0,
+                            char(dict.size() & 0xff), char(dict.size() >> 8)};
+  data.insert(data.end(), dict.begin(), dict.end());
+  const std::vector<float> items = Items(0, 2, 3);
+  const char *bytes = reinterpret_cast<const char *>(items.data());
+  data.insert(data.end(), bytes, bytes + items.size() * sizeof(float));
+  WriteFile(kFilename, data);
+
+  NpyWriter writer;
+  PRNET_CHECK(writer.open(kFilename, {3}, true));
+  PRNET_CHECK_EQ(writer.num_items(), size_t(2));
+  PRNET_CHECK(writer.append(Items(2, 1, 3).data()));
+  std::vector<float> item(3);
+  for (size_t i = 0; i < 3; i++) {
+    PRNET_CHECK(writer.read(i, item.data()));
+    PRNET_CHECK(item == Items(i, 1, 3));
+  }
+  writer.close();
+
+  size_t data_offset = 0;
+  PRNET_CHECK(HeaderDict(ReadFile(kFilename), &data_offset)
+                  .find("'shape': (3, 3)") != std::string::npos);
+  PRNET_CHECK_EQ(data_offset, size_t(128));
+}
+
+void TestNotNpy() {
+  WriteFile(kFilename, std::vector<char>(200, 'x'));
+  NpyWriter writer;
+  PRNET_CHECK(!writer.open(kFilename, {3}, true));
+}
+
+} // anonymous namespace
+
+int main() {
+  TestCreateAndAppend();
+  TestPartialItem();
+  TestScalarItems();
+  TestAppendToNumpyFile();
+  TestNotNpy();
+
+  std::remove(kFilename);
+  return prnet::test::Result("test_npy_writer");
+}
@@ -0,0 +1,240 @@
+#include "shm_ring.h"
+#include "test_util.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+using namespace prnet;
+
+const size_t kNumSlots = 2;
+const size_t kInputCapacity = 4096;
+const size_t kOutputCapacity = 256;
+
+// Echoes the payload reversed. `n_faces` is the # of payload bytes.
+bool EchoHandler(const ServerRequest &request, ServerResponse *response) {
+  const uint32_t size = request.header.payload_size;
+  std::vector<unsigned char> reversed(request.payload, request.payload + size);
+  std::reverse(reversed.begin(), reversed.end());
+  response->header.n_faces = size;
+  response->append(reversed.data(), reversed.size());
+  return true;
+}
+
+bool ObjectExists(const std::string &name) {
+  const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    return false;
+  }
+  close(fd);
+  return true;
+}
+
+// Submits `payload` in a slot and checks the echoed response.
+void CheckEcho(ShmRingClient *client, size_t size, unsigned char seed) {
+  const int slot = client->acquire();
+  PRNET_CHECK(slot >= 0);
+  if (slot < 0) {
+    return;
+  }
+  std::vector<unsigned char> payload(size);
+  for (size_t i = 0; i < size; i++) {
+    payload[i] = static_cast<unsigned char>(i * 13 + seed);
+  }
+  memcpy(client->input(slot), payload.data(), size);
+
+  ServerRequestHeader request;
+  request.type = kServerRequestRawImage;
+  request.payload_size = uint32_t(size);
+  PRNET_CHECK(client->submit(slot, request));
+  PRNET_CHECK(client->wait(slot, 5000));
+
+  const ServerResponseHeader &response = client->response(slot);
+  PRNET_CHECK_EQ(response.magic, kServerResponseMagic);
+  PRNET_CHECK_EQ(response.status, uint32_t(kServerStatusOk));
+  PRNET_CHECK_EQ(response.n_faces, uint32_t(size));
+  PRNET_CHECK_EQ(response.payload_size, uint32_t(size));
+  std::reverse(payload.begin(), payload.end());
+  PRNET_CHECK(std::equal(payload.begin(), payload.end(), client->output(slot)));
+  client->release(slot);
+}
+
+void TestRequests(ShmRingClient *client) {
+  PRNET_CHECK_EQ(client->input_capacity(), kInputCapacity);
+  PRNET_CHECK_EQ(client->output_capacity(), kOutputCapacity);
+
+  for (size_t size : {size_t(10), size_t(0), kOutputCapacity}) {
+    CheckEcho(client, size, static_cast<unsigned char>(size));
+  }
+
+  // Outputs larger than the output area are an error, with the message
+  // truncated to the area.
+  int slot = client->acquire();
+  PRNET_CHECK(slot >= 0);
+  ServerRequestHeader request;
+  request.payload_size = uint32_t(kOutputCapacity + 1);
+  PRNET_CHECK(client->submit(slot, request));
+  PRNET_CHECK(client->wait(slot, 5000));
+  PRNET_CHECK_EQ(client->response(slot).status, uint32_t(kServerStatusFailed));
+  PRNET_CHECK(client->response(slot).payload_size > 0);
+  PRNET_CHECK(client->response(slot).payload_size <= kOutputCapacity);
+  client->release(slot);
+
+  // An invalid header is rejected.
+  slot = client->acquire();
+  PRNET_CHECK(slot >= 0);
+  request = ServerRequestHeader();
+  request.magic = 0x12345678;
+  PRNET_CHECK(client->submit(slot, request));
+  PRNET_CHECK(client->wait(slot, 5000));
+  PRNET_CHECK_EQ(client->response(slot).status,
+                 uint32_t(kServerStatusBadRequest));
+
+  // A payload larger than the input area can not be submitted.
+  request = ServerRequestHeader();
+  client->release(slot);
+  slot = client->acquire();
+  request.payload_size = uint32_t(kInputCapacity + 1);
+  PRNET_CHECK(!client->submit(slot, request));
+  client->release(slot);
+}
+
+// Clients wait for a free slot.
+void TestSlotExhaustion(ShmRingClient *client) {
+  std::vector<int> slots;
+  for (size_t i = 0; i < kNumSlots; i++) {
+    slots.push_back(client->acquire());
+    PRNET_CHECK(slots.back() >= 0);
+  }
+  PRNET_CHECK_EQ(client->acquire(/* timeout_ms */ 50), -1);
+
+  std::thread releaser([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    client->release(slots[0]);
+  });
+  const int slot = client->acquire(5000);
+  PRNET_CHECK_EQ(slot, slots[0]);
+  releaser.join();
+  client->release(slot);
+  client->release(slots[1]);
+}
+
+// Requests from more threads than slots.
+void TestConcurrentClients(ShmRingClient *client) {
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([client, t]() {
+      for (int i = 0; i < 50; i++) {
+        CheckEcho(client, size_t(1 + (t * 50 + i) % 200),
+                  static_cast<unsigned char>(t * 50 + i));
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+}
+
+// A slot held by a process which exited without releasing it is freed by
+// the server.
+void TestDeadClient(ShmRingClient *client) {
+  const pid_t pid = fork();
+  if (pid == 0) {
+    // The mapping is inherited. Only atomics are used in the child.
+    const int slot = client->acquire(1000);
+    _exit((slot >= 0) ? 0 : 1);
+  }
+  PRNET_CHECK(pid > 0);
+  int status = 0;
+  waitpid(pid, &status, 0);
+  PRNET_CHECK(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+
+  // All slots become available again.
+  std::vector<int> slots;
+  for (size_t i = 0; i < kNumSlots; i++) {
+    slots.push_back(client->acquire(5000));
+    PRNET_CHECK(slots.back() >= 0);
+  }
+  for (int slot : slots) {
+    if (slot >= 0) {
+      client->release(slot);
+    }
+  }
+}
+
+void TestServer() {
+  ShmRingOptions options;
+  options.name = "/prnet_test_shm_ring_" + std::to_string(getpid());
+  options.n_slots = kNumSlots;
+  options.input_capacity = kInputCapacity;
+  options.output_capacity = kOutputCapacity;
+
+  {
+    ShmRingServer server;
+    PRNET_CHECK(server.start(options, EchoHandler));
+    std::thread thread([&server]() { server.run(); });
+
+    // The object of a running server is not replaced by default.
+    {
+      ShmRing other;
+      PRNET_CHECK(!other.create(options));
+    }
+    PRNET_CHECK(ObjectExists(options.name));
+
+    ShmRingClient client;
+    PRNET_CHECK(client.open(options.name));
+    TestRequests(&client);
+    TestSlotExhaustion(&client);
+    TestConcurrentClients(&client);
+    TestDeadClient(&client);
+
+    server.stop();
+    thread.join();
+  }
+
+  // The object is removed by the server.
+  PRNET_CHECK(!ObjectExists(options.name));
+
+  ShmRingClient client;
+  PRNET_CHECK(!client.open(options.name));
+}
+
+// A left over object is replaced on request.
+void TestReplace() {
+  ShmRingOptions options;
+  options.name = "/prnet_test_shm_ring_replace_" + std::to_string(getpid());
+  const int fd = shm_open(options.name.c_str(), O_RDWR | O_CREAT, 0600);
+  PRNET_CHECK(fd >= 0);
+  if (fd >= 0) {
+    close(fd);
+  }
+  options.n_slots = 1;
+  options.input_capacity = 64;
+  options.output_capacity = 64;
+
+  ShmRing ring;
+  PRNET_CHECK(!ring.create(options));
+  options.replace = true;
+  PRNET_CHECK(ring.create(options));
+  PRNET_CHECK_EQ(ring.num_slots(), size_t(1));
+  ring.close();
+  PRNET_CHECK(!ObjectExists(options.name));
+}
+
+} // anonymous namespace
+
+int main() {
+  TestServer();
+  TestReplace();
+  return prnet::test::Result("test_shm_ring");
+}
@@ -0,0 +1,82 @@
+#include "temporal_filter.h"
+#include "test_util.h"
+
+#include <cmath>
+#include <vector>
+
+namespace {
+
+using namespace prnet;
+
+// Position map of a face of `size` pixels centered at (`cx`, `cy`).
+Image<float> MakeFace(float cx, float cy, float size) {
+  const size_t n = 64;
+  Image<float> pos_img;
+  pos_img.create(n, n, 3);
+  for (size_t y = 0; y < n; y++) {
+    for (size_t x = 0; x < n; x++) {
+      float *p = &pos_img.getData()[(y * n + x) * 3];
+      p[0] = cx + size * (float(x) / (n - 1) - 0.5f);
+      p[1] = cy + size * (float(y) / (n - 1) - 0.5f);
+      p[2] = 0.0f;
+    }
+  }
+  return pos_img;
+}
+
+// x of the center pixel.
+float CenterX(const Image<float> &pos_img) {
+  const size_t n = pos_img.getWidth();
+  return pos_img.getData()[((n / 2) * n + n / 2) * 3];
+}
+
+// Faces which swap their detection order keep their own filters.
+void TestReorderedFaces() {
+  FaceFilterBank filters(/* min_cutoff */ 0.1f, /* beta */ 0.0f);
+  const float dt = 1.0f / 30.0f;
+
+  std::vector<Image<float>> frame = {MakeFace(100, 100, 80),
+                                     MakeFace(400, 300, 80)};
+  filters.apply(&frame, dt);
+
+  frame = {MakeFace(404, 300, 80), MakeFace(104, 100, 80)};
+  const float cx[2] = {CenterX(frame[0]), CenterX(frame[1])};
+  filters.apply(&frame, dt);
+  // Smoothed toward the previous position of the same face(a few pixels),
+  // not toward the other face(300 pixels away).
+  PRNET_CHECK(std::fabs(CenterX(frame[0]) - cx[0]) < 4.0f);
+  PRNET_CHECK(std::fabs(CenterX(frame[1]) - cx[1]) < 4.0f);
+  PRNET_CHECK(CenterX(frame[0]) < cx[0]);
+  PRNET_CHECK(CenterX(frame[1]) < cx[1]);
+}
+
+// A face which jumps(or a new face) starts a new filter, i.e. is passed
+// through.
+void TestNewFace() {
+  FaceFilterBank filters(0.1f, 0.0f);
+  const float dt = 1.0f / 30.0f;
+
+  std::vector<Image<float>> frame = {MakeFace(100, 100, 80)};
+  filters.apply(&frame, dt);
+
+  frame = {MakeFace(500, 100, 80), MakeFace(102, 100, 80)};
+  const float cx[2] = {CenterX(frame[0]), CenterX(frame[1])};
+  filters.apply(&frame, dt);
+  PRNET_CHECK_EQ(CenterX(frame[0]), cx[0]);
+  PRNET_CHECK(CenterX(frame[1]) < cx[1]);
+
+  // The second face disappears, and the first one continues its filter.
+  frame = {MakeFace(504, 100, 80)};
+  const float cx_moved = CenterX(frame[0]);
+  filters.apply(&frame, dt);
+  PRNET_CHECK(CenterX(frame[0]) < cx_moved);
+  PRNET_CHECK(CenterX(frame[0]) > cx[0]);
+}
+
+} // anonymous namespace
+
+int main() {
+  TestReorderedFaces();
+  TestNewFace();
+  return prnet::test::Result("test_temporal_filter");
+}
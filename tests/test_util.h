@@ -0,0 +1,52 @@
+#ifndef PRNET_INFER_TEST_UTIL_H_
+#define PRNET_INFER_TEST_UTIL_H_
+
+#include <iostream>
+#include <string>
+
+namespace prnet {
+namespace test {
+
+///
+/// Minimal check macros for the tests(no test framework is required). A test
+/// is an executable which returns nonzero when any check failed.
+///
+
+inline int &NumFailures() {
+  static int n = 0;
+  return n;
+}
+
+inline int Result(const std::string &name) {
+  if (NumFailures() > 0) {
+    std::cerr << name << " : " << NumFailures() << " check(s) failed"
+              << std::endl;
+    return 1;
+  }
+  std::cout << name << " : OK" << std::endl;
+  return 0;
+}
+
+} // namespace test
+} // namespace prnet
+
+#define PRNET_CHECK(cond)                                                   \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": check failed : " #cond \
+                << std::endl;                                               \
+      prnet::test::NumFailures()++;                                         \
+    }                                                                       \
+  } while (false)
+
+#define PRNET_CHECK_EQ(a, b)                                                \
+  do {                                                                      \
+    if (!((a) == (b))) {                                                    \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": check failed : " #a    \
+                << " == " #b << " (" << (a) << " vs " << (b) << ")"         \
+                << std::endl;                                               \
+      prnet::test::NumFailures()++;                                         \
+    }                                                                       \
+  } while (false)
+
+#endif // PRNET_INFER_TEST_UTIL_H_